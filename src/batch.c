@@ -0,0 +1,360 @@
+/* File:    batch.c
+ *
+ * Purpose: The batch game (-b), which plays a list of small, separate games
+ *          instead of one big one, all within the one mpiexec. Each line of
+ *          the job file is a game: its seed, its number of live cells and
+ *          optionally its rule, like "42 300 B36/S23" (Conway's B3/S23 if
+ *          left out); the size and number of iterations are the usual m, n
+ *          and j. Blank lines and lines starting with # are skipped.
+ *
+ *          The controller hands the jobs out one at a time: every worker gets
+ *          one to start with and a new one each time it sends back a result,
+ *          so quick and slow games even out by themselves. Results are
+ *          written to the job file's name with ".results" on the end as they
+ *          come in, in the order they finish: the final population, the
+ *          period the game settled into (found by keeping the hashes of the
+ *          last few generations) and the iteration it died out on. A game
+ *          that settles stops early, since the rest of it is known. With a
+ *          single processor the controller plays the jobs itself.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "life.h"
+
+// Generations kept to look for a period in, so the longest one found
+#define BATCH_HISTORY 64
+
+typedef struct BatchGame
+{
+	int width;
+	int height;
+	// (height + 2) x (width + 2) cells, with a border of dead cells
+	bool* last_cells;
+	bool* new_cells;
+	// The next state of a dead and a live cell for each neighbour count
+	bool next_state[2][9];
+	ProcInfo rows;
+} BatchGame;
+
+// Birth and survival counts in the usual B/S notation, like "B3/S23"
+bool parse_life_rule( const char* rule, bool next_state[2][9] )
+{
+	memset( next_state, 0, 2 * 9 * sizeof( bool ) );
+	if ( rule[0] != 'B' && rule[0] != 'b' )
+		return false;
+
+	int state = 0;
+	for ( const char* c = rule + 1; *c != '\0'; ++c )
+	{
+		if ( *c >= '0' && *c <= '8' )
+		{
+			next_state[state][*c - '0'] = true;
+		}
+		else if ( state == 0 && c[0] == '/' && ( c[1] == 'S' || c[1] == 's' ) )
+		{
+			state = 1;
+			++c;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return state == 1;
+}
+
+static bool* cell_at( BatchGame* game, bool* cells, int x, int y )
+{
+	return cells + (size_t)( y + 1 ) * ( game->width + 2 ) + x + 1;
+}
+
+static void generation_task( int thread, int num_threads, void* arg )
+{
+	BatchGame* game = arg;
+	ProcInfo share = split_cells( &game->rows, thread, num_threads );
+	int stride = game->width + 2;
+
+	for ( int y = share.offset; y < share.offset + share.num_cells; ++y )
+	{
+		const bool* row = cell_at( game, game->last_cells, 0, y );
+		bool* new_row = cell_at( game, game->new_cells, 0, y );
+		for ( int x = 0; x < game->width; ++x )
+		{
+			const bool* above = row + x - stride;
+			const bool* below = row + x + stride;
+			int count = above[-1] + above[0] + above[1] + row[x - 1] + row[x + 1] +
+			            below[-1] + below[0] + below[1];
+			new_row[x] = game->next_state[row[x]][count];
+		}
+	}
+}
+
+// FNV-1a over the cells, and the number of them alive while we're at it
+static uint64_t hash_board( BatchGame* game, long long* population )
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	*population = 0;
+	for ( int y = 0; y < game->height; ++y )
+	{
+		const bool* row = cell_at( game, game->last_cells, 0, y );
+		for ( int x = 0; x < game->width; ++x )
+		{
+			hash = ( hash ^ row[x] ) * 0x100000001b3ULL;
+			*population += row[x];
+		}
+	}
+	return hash;
+}
+
+static void play_generation( BatchGame* game, WorkerPool* pool )
+{
+	worker_pool_run( pool, generation_task, game );
+	bool* temp_cells = game->last_cells;
+	game->last_cells = game->new_cells;
+	game->new_cells = temp_cells;
+}
+
+// Plays one game to the end (or until it settles), leaving the board on the
+// last iteration in final_board unless that is NULL
+BatchResult play_batch_job( BatchJob* job, WorkerPool* pool, bool* final_board )
+{
+	int width = job->width, height = job->height, iterations = job->iterations;
+	BatchGame game;
+	game.width = width;
+	game.height = height;
+	game.rows.offset = 0;
+	game.rows.num_cells = height;
+	parse_life_rule( job->rule, game.next_state );
+	size_t cells = (size_t)( width + 2 ) * ( height + 2 );
+	game.last_cells = calloc( cells, sizeof( bool ) );
+	game.new_cells = calloc( cells, sizeof( bool ) );
+
+	bool* field = calloc( (size_t)width * height, sizeof( bool ) );
+	fill_game_field( field, width, height, job->live_cells, job->seed );
+	for ( int y = 0; y < height; ++y )
+	{
+		memcpy( cell_at( &game, game.last_cells, 0, y ), field + (size_t)y * width,
+		        width * sizeof( bool ) );
+	}
+	free( field );
+
+	BatchResult result = { job->index, 0, 0, -1, 0 };
+	uint64_t hashes[BATCH_HISTORY];
+	long long populations[BATCH_HISTORY];
+	for ( int generation = 0;; ++generation )
+	{
+		long long population;
+		uint64_t hash = hash_board( &game, &population );
+		if ( population == 0 && result.died_on < 0 )
+			result.died_on = generation;
+
+		// Same as a few generations back, so it repeats from here on and the
+		// population on the last iteration is one we have already seen
+		for ( int back = 1; back <= BATCH_HISTORY && back <= generation; ++back )
+		{
+			if ( hashes[( generation - back ) % BATCH_HISTORY] == hash )
+			{
+				result.period = back;
+				break;
+			}
+		}
+		if ( result.period > 0 )
+		{
+			int same_as = generation - result.period +
+			              ( iterations - generation ) % result.period;
+			result.population = populations[same_as % BATCH_HISTORY];
+			result.generations = generation;
+			// Only the board has to be played on to where it would have been
+			if ( final_board != NULL )
+			{
+				for ( int g = 0; g < ( iterations - generation ) % result.period;
+				      ++g )
+					play_generation( &game, pool );
+			}
+			break;
+		}
+		if ( generation == iterations )
+		{
+			result.population = population;
+			result.generations = generation;
+			break;
+		}
+
+		hashes[generation % BATCH_HISTORY] = hash;
+		populations[generation % BATCH_HISTORY] = population;
+		play_generation( &game, pool );
+	}
+
+	if ( final_board != NULL )
+	{
+		for ( int y = 0; y < height; ++y )
+		{
+			memcpy( final_board + (size_t)y * width,
+			        cell_at( &game, game.last_cells, 0, y ), width * sizeof( bool ) );
+		}
+	}
+	free( game.last_cells );
+	free( game.new_cells );
+	return result;
+}
+
+// Reads every job in the file, checking each line as it goes
+static BatchJob* read_jobs( const char* path, int width, int height,
+                            int iterations, int* num_jobs )
+{
+	FILE* file = fopen( path, "r" );
+	if ( file == NULL )
+	{
+		fprintf( stderr, "Reading jobs from %s: %s\n", path, strerror( errno ) );
+		MPI_Abort( MPI_COMM_WORLD, 1 );
+	}
+
+	int max_jobs = 64, line_number = 0;
+	BatchJob* jobs = malloc( max_jobs * sizeof( BatchJob ) );
+	*num_jobs = 0;
+	char line[256];
+	while ( fgets( line, sizeof( line ), file ) != NULL )
+	{
+		++line_number;
+		char first[2];
+		if ( sscanf( line, " %1s", first ) != 1 || first[0] == '#' )
+			continue;
+
+		if ( *num_jobs == max_jobs )
+		{
+			max_jobs *= 2;
+			jobs = realloc( jobs, max_jobs * sizeof( BatchJob ) );
+		}
+		BatchJob* job = &jobs[*num_jobs];
+		job->index = *num_jobs;
+		job->width = width;
+		job->height = height;
+		job->iterations = iterations;
+		job->want_board = false;
+		strcpy( job->rule, "B3/S23" );
+		bool next_state[2][9];
+		if ( sscanf( line, "%ld %d %31s", &job->seed, &job->live_cells,
+		             job->rule ) < 2 ||
+		     job->live_cells < 0 || !parse_life_rule( job->rule, next_state ) )
+		{
+			fprintf( stderr, "%s:%d: expected \"seed live_cells [B3/S23]\"\n",
+			         path, line_number );
+			MPI_Abort( MPI_COMM_WORLD, 1 );
+		}
+		( *num_jobs )++;
+	}
+	fclose( file );
+	return jobs;
+}
+
+static void write_result( FILE* results, BatchJob* job, BatchResult* result )
+{
+	fprintf( results, "%d %ld %d %s %lld %d %d %d\n", job->index, job->seed,
+	         job->live_cells, job->rule, result->population, result->period,
+	         result->died_on, result->generations );
+	// Whatever has finished is there to look at while the rest run
+	fflush( results );
+}
+
+void batch_types_create( MPI_Datatype* job_type, MPI_Datatype* result_type )
+{
+	MPI_Type_contiguous( sizeof( BatchJob ), MPI_BYTE, job_type );
+	MPI_Type_commit( job_type );
+	MPI_Type_contiguous( sizeof( BatchResult ), MPI_BYTE, result_type );
+	MPI_Type_commit( result_type );
+}
+
+void play_batch_game( const char* jobs_path, int iterations, int print_modulo,
+                      int width, int height, WorkerPool* pool )
+{
+	int world_rank, world_size;
+	MPI_Comm_rank( MPI_COMM_WORLD, &world_rank );
+	MPI_Comm_size( MPI_COMM_WORLD, &world_size );
+
+	MPI_Datatype job_type, result_type;
+	batch_types_create( &job_type, &result_type );
+
+	if ( world_rank != 0 )
+	{
+		// Play whatever we're given until told to stop
+		BatchJob job;
+		MPI_Recv( &job, 1, job_type, 0, BATCH_JOB, MPI_COMM_WORLD,
+		          MPI_STATUS_IGNORE );
+		while ( job.index >= 0 )
+		{
+			BatchResult result = play_batch_job( &job, pool, NULL );
+			MPI_Send( &result, 1, result_type, 0, BATCH_RESULT, MPI_COMM_WORLD );
+			MPI_Recv( &job, 1, job_type, 0, BATCH_JOB, MPI_COMM_WORLD,
+			          MPI_STATUS_IGNORE );
+		}
+	}
+	else
+	{
+		int num_jobs;
+		BatchJob* jobs =
+		  read_jobs( jobs_path, width, height, iterations, &num_jobs );
+		char* results_path = malloc( strlen( jobs_path ) + sizeof( ".results" ) );
+		sprintf( results_path, "%s.results", jobs_path );
+		FILE* results = fopen( results_path, "w" );
+		if ( results == NULL )
+		{
+			fprintf( stderr, "Writing %s: %s\n", results_path, strerror( errno ) );
+			MPI_Abort( MPI_COMM_WORLD, 1 );
+		}
+		fprintf( results, "# job seed live_cells rule population period "
+		                  "died_on generations\n" );
+
+		double start = MPI_Wtime();
+		int next_job = 0, done = 0;
+		BatchJob stop = { .index = -1 };
+		BatchResult result;
+		if ( world_size == 1 )
+		{
+			for ( ; next_job < num_jobs; ++next_job, ++done )
+			{
+				result = play_batch_job( &jobs[next_job], pool, NULL );
+				write_result( results, &jobs[next_job], &result );
+				if ( ( done + 1 ) % print_modulo == 0 )
+					printf( "Batch: %d of %d jobs done\n", done + 1, num_jobs );
+			}
+		}
+		else
+		{
+			// Everyone starts with one job (or is told there are none)
+			for ( int worker = 1; worker < world_size; ++worker )
+			{
+				BatchJob* job = next_job < num_jobs ? &jobs[next_job++] : &stop;
+				MPI_Send( job, 1, job_type, worker, BATCH_JOB, MPI_COMM_WORLD );
+			}
+			while ( done < num_jobs )
+			{
+				MPI_Status status;
+				MPI_Recv( &result, 1, result_type, MPI_ANY_SOURCE, BATCH_RESULT,
+				          MPI_COMM_WORLD, &status );
+				BatchJob* job = next_job < num_jobs ? &jobs[next_job++] : &stop;
+				MPI_Send( job, 1, job_type, status.MPI_SOURCE, BATCH_JOB,
+				          MPI_COMM_WORLD );
+
+				write_result( results, &jobs[result.index], &result );
+				if ( ++done % print_modulo == 0 )
+					printf( "Batch: %d of %d jobs done\n", done, num_jobs );
+			}
+		}
+
+		double elapsed = MPI_Wtime() - start;
+		printf( "Batch: %d jobs in %.3f seconds (%.1f jobs per second), "
+		        "results in %s\n",
+		        num_jobs, elapsed, elapsed > 0 ? num_jobs / elapsed : 0.0,
+		        results_path );
+		fclose( results );
+		free( results_path );
+		free( jobs );
+	}
+
+	MPI_Type_free( &job_type );
+	MPI_Type_free( &result_type );
+}
@@ -0,0 +1,76 @@
+/* File:    comm.c
+ *
+ * Purpose: The MPI backend of the communication interface the original and
+ *          halo games play over (LifeComm). Every operation is the MPI call
+ *          of the same name on the wrapped communicator, in bytes, so a game
+ *          played over it sends exactly what it sent when it called MPI
+ *          itself.
+ */
+
+#include "life.h"
+
+static void mpi_send( LifeComm* comm, const void* buffer, int bytes, int dest,
+                      int tag )
+{
+	MPI_Send( buffer, bytes, MPI_BYTE, dest, tag, comm->mpi );
+}
+
+static void mpi_recv( LifeComm* comm, void* buffer, int bytes, int source,
+                      int tag )
+{
+	MPI_Recv( buffer, bytes, MPI_BYTE, source, tag, comm->mpi,
+	          MPI_STATUS_IGNORE );
+}
+
+static void mpi_sendrecv( LifeComm* comm, const void* send_buffer,
+                          int send_bytes, int dest, void* recv_buffer,
+                          int recv_bytes, int source, int tag )
+{
+	MPI_Sendrecv( send_buffer, send_bytes, MPI_BYTE, dest, tag, recv_buffer,
+	              recv_bytes, MPI_BYTE, source, tag, comm->mpi,
+	              MPI_STATUS_IGNORE );
+}
+
+static void mpi_barrier( LifeComm* comm )
+{
+	MPI_Barrier( comm->mpi );
+}
+
+static void mpi_bcast( LifeComm* comm, void* buffer, int bytes, int root )
+{
+	MPI_Bcast( buffer, bytes, MPI_BYTE, root, comm->mpi );
+}
+
+static void mpi_scatterv( LifeComm* comm, const void* send_buffer,
+                          const int* counts, const int* displs,
+                          void* recv_buffer, int recv_bytes, int root )
+{
+	MPI_Scatterv( send_buffer, counts, displs, MPI_BYTE, recv_buffer,
+	              recv_bytes, MPI_BYTE, root, comm->mpi );
+}
+
+static void mpi_gatherv( LifeComm* comm, const void* send_buffer,
+                         int send_bytes, void* recv_buffer, const int* counts,
+                         const int* displs, int root )
+{
+	MPI_Gatherv( send_buffer, send_bytes, MPI_BYTE, recv_buffer, counts,
+	             displs, MPI_BYTE, root, comm->mpi );
+}
+
+static void mpi_abort( LifeComm* comm, int code )
+{
+	MPI_Abort( comm->mpi, code );
+}
+
+const CommBackend mpi_comm_backend = {
+  "mpi",        mpi_send,    mpi_recv,     mpi_sendrecv, mpi_barrier,
+  mpi_bcast,    mpi_scatterv, mpi_gatherv, mpi_abort };
+
+void comm_from_mpi( LifeComm* comm, MPI_Comm mpi )
+{
+	comm->backend = &mpi_comm_backend;
+	MPI_Comm_rank( mpi, &comm->rank );
+	MPI_Comm_size( mpi, &comm->size );
+	comm->mpi = mpi;
+	comm->data = NULL;
+}
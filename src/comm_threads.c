@@ -0,0 +1,253 @@
+/* File:    comm_threads.c
+ *
+ * Purpose: The threads backend of the communication interface (LifeComm):
+ *          every rank is a thread of this one process, so the original and
+ *          halo games can be played and tested without mpiexec (-L). Nothing
+ *          goes through MPI, and nothing is buffered on the way either: a
+ *          send hands the receiver a pointer to the sender's buffer and waits
+ *          for it to be copied straight into the receiver's, and the
+ *          collectives copy straight between the root's buffers and everyone
+ *          else's.
+ *
+ *          Messages from one rank to another with the same tag arrive in the
+ *          order they were sent, as with MPI, and every rank only sees the
+ *          data it asked for, so a game plays out the same on any number of
+ *          ranks and on either backend.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "life.h"
+
+// A send waiting for its receiver, on the sender's stack until it is taken
+typedef struct CommOffer
+{
+	int source;
+	int tag;
+	const void* buffer;
+	int bytes;
+	bool taken;
+	struct CommOffer* next;
+} CommOffer;
+
+typedef struct ThreadWorld
+{
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	// Every rank's offers, oldest first
+	CommOffer** offers;
+	pthread_barrier_t barrier;
+	// The root's buffers for the collective in progress
+	const void* root_send;
+	void* root_recv;
+	const int* counts;
+	const int* displs;
+} ThreadWorld;
+
+typedef struct RankStart
+{
+	LifeComm comm;
+	CommRankMain rank_main;
+	void* arg;
+} RankStart;
+
+static void post_offer( LifeComm* comm, CommOffer* offer, const void* buffer,
+                        int bytes, int dest, int tag )
+{
+	ThreadWorld* world = comm->data;
+	offer->source = comm->rank;
+	offer->tag = tag;
+	offer->buffer = buffer;
+	offer->bytes = bytes;
+	offer->taken = false;
+	offer->next = NULL;
+
+	pthread_mutex_lock( &world->lock );
+	CommOffer** last = &world->offers[dest];
+	while ( *last != NULL )
+		last = &( *last )->next;
+	*last = offer;
+	pthread_cond_broadcast( &world->changed );
+	pthread_mutex_unlock( &world->lock );
+}
+
+static void wait_taken( LifeComm* comm, CommOffer* offer )
+{
+	ThreadWorld* world = comm->data;
+	pthread_mutex_lock( &world->lock );
+	while ( !offer->taken )
+		pthread_cond_wait( &world->changed, &world->lock );
+	pthread_mutex_unlock( &world->lock );
+}
+
+// Takes the oldest offer from source with the tag, copying it into buffer
+static void take_offer( LifeComm* comm, void* buffer, int bytes, int source,
+                        int tag )
+{
+	ThreadWorld* world = comm->data;
+	pthread_mutex_lock( &world->lock );
+	CommOffer* offer = NULL;
+	for ( ;; )
+	{
+		CommOffer** link = &world->offers[comm->rank];
+		while ( *link != NULL &&
+		        ( ( *link )->source != source || ( *link )->tag != tag ) )
+			link = &( *link )->next;
+		if ( *link != NULL )
+		{
+			offer = *link;
+			*link = offer->next;
+			break;
+		}
+		pthread_cond_wait( &world->changed, &world->lock );
+	}
+	pthread_mutex_unlock( &world->lock );
+
+	// The sender waits for us, so its buffer stays put while we copy
+	memcpy( buffer, offer->buffer, offer->bytes < bytes ? offer->bytes : bytes );
+
+	pthread_mutex_lock( &world->lock );
+	offer->taken = true;
+	pthread_cond_broadcast( &world->changed );
+	pthread_mutex_unlock( &world->lock );
+}
+
+static void threads_send( LifeComm* comm, const void* buffer, int bytes,
+                          int dest, int tag )
+{
+	if ( dest == COMM_NONE )
+		return;
+	CommOffer offer;
+	post_offer( comm, &offer, buffer, bytes, dest, tag );
+	wait_taken( comm, &offer );
+}
+
+static void threads_recv( LifeComm* comm, void* buffer, int bytes, int source,
+                          int tag )
+{
+	if ( source != COMM_NONE )
+		take_offer( comm, buffer, bytes, source, tag );
+}
+
+// The send is offered before receiving, so two ranks swapping never wait on
+// each other
+static void threads_sendrecv( LifeComm* comm, const void* send_buffer,
+                              int send_bytes, int dest, void* recv_buffer,
+                              int recv_bytes, int source, int tag )
+{
+	CommOffer offer;
+	if ( dest != COMM_NONE )
+		post_offer( comm, &offer, send_buffer, send_bytes, dest, tag );
+	if ( source != COMM_NONE )
+		take_offer( comm, recv_buffer, recv_bytes, source, tag );
+	if ( dest != COMM_NONE )
+		wait_taken( comm, &offer );
+}
+
+static void threads_barrier( LifeComm* comm )
+{
+	ThreadWorld* world = comm->data;
+	pthread_barrier_wait( &world->barrier );
+}
+
+// The root puts its buffers up, everyone copies what is theirs, and the
+// root's buffers are left alone again once everyone is done
+static void threads_bcast( LifeComm* comm, void* buffer, int bytes, int root )
+{
+	ThreadWorld* world = comm->data;
+	if ( comm->rank == root )
+		world->root_send = buffer;
+	pthread_barrier_wait( &world->barrier );
+	if ( comm->rank != root )
+		memcpy( buffer, world->root_send, bytes );
+	pthread_barrier_wait( &world->barrier );
+}
+
+static void threads_scatterv( LifeComm* comm, const void* send_buffer,
+                              const int* counts, const int* displs,
+                              void* recv_buffer, int recv_bytes, int root )
+{
+	ThreadWorld* world = comm->data;
+	if ( comm->rank == root )
+	{
+		world->root_send = send_buffer;
+		world->counts = counts;
+		world->displs = displs;
+	}
+	pthread_barrier_wait( &world->barrier );
+	int bytes = world->counts[comm->rank];
+	memcpy( recv_buffer,
+	        (const char*)world->root_send + world->displs[comm->rank],
+	        bytes < recv_bytes ? bytes : recv_bytes );
+	pthread_barrier_wait( &world->barrier );
+}
+
+static void threads_gatherv( LifeComm* comm, const void* send_buffer,
+                             int send_bytes, void* recv_buffer,
+                             const int* counts, const int* displs, int root )
+{
+	ThreadWorld* world = comm->data;
+	if ( comm->rank == root )
+	{
+		world->root_recv = recv_buffer;
+		world->counts = counts;
+		world->displs = displs;
+	}
+	pthread_barrier_wait( &world->barrier );
+	int bytes = world->counts[comm->rank];
+	memcpy( (char*)world->root_recv + world->displs[comm->rank], send_buffer,
+	        send_bytes < bytes ? send_bytes : bytes );
+	pthread_barrier_wait( &world->barrier );
+}
+
+static void threads_abort( LifeComm* comm, int code )
+{
+	exit( code );
+}
+
+const CommBackend threads_comm_backend = {
+  "threads",       threads_send,     threads_recv,
+  threads_sendrecv, threads_barrier, threads_bcast,
+  threads_scatterv, threads_gatherv, threads_abort };
+
+static void* rank_thread( void* arg )
+{
+	RankStart* start = arg;
+	start->rank_main( &start->comm, start->arg );
+	return NULL;
+}
+
+void comm_run_threads( int size, CommRankMain rank_main, void* arg )
+{
+	ThreadWorld world;
+	pthread_mutex_init( &world.lock, NULL );
+	pthread_cond_init( &world.changed, NULL );
+	world.offers = calloc( size, sizeof( CommOffer* ) );
+	pthread_barrier_init( &world.barrier, NULL, size );
+
+	// The calling thread plays rank 0, as it does for the worker pool
+	RankStart* starts = calloc( size, sizeof( RankStart ) );
+	pthread_t* threads = calloc( size, sizeof( pthread_t ) );
+	for ( int rank = 0; rank < size; ++rank )
+	{
+		LifeComm comm = { &threads_comm_backend, rank, size, MPI_COMM_NULL,
+		                  &world };
+		starts[rank].comm = comm;
+		starts[rank].rank_main = rank_main;
+		starts[rank].arg = arg;
+		if ( rank > 0 )
+			pthread_create( &threads[rank], NULL, rank_thread, &starts[rank] );
+	}
+	rank_thread( &starts[0] );
+	for ( int rank = 1; rank < size; ++rank )
+		pthread_join( threads[rank], NULL );
+
+	free( threads );
+	free( starts );
+	free( world.offers );
+	pthread_barrier_destroy( &world.barrier );
+	pthread_cond_destroy( &world.changed );
+	pthread_mutex_destroy( &world.lock );
+}
@@ -0,0 +1,203 @@
+/* File:    counters.c
+ *
+ * Purpose: Counts what the kernels cost the processor (-c) with the hardware
+ *          counters Linux gives out through perf_event_open: cycles,
+ *          instructions, branch misses and last level cache misses, each per
+ *          cell update, so a kernel can be told apart as bound by branches,
+ *          by memory or by sheer instructions, and different board layouts
+ *          compared. Every worker thread opens the counters for itself; the
+ *          main thread reads them all before and after each round of
+ *          generations, so only the time spent applying the rules is
+ *          counted, not the messages. That time is kept too, so the report
+ *          also gives the nanoseconds per cell update the counts go with.
+ *
+ *          Plenty of computers (and most virtual machines) have no counters
+ *          to hand out, or only some of them, in which case the game plays
+ *          on and the report says which ones were missing.
+ */
+
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "life.h"
+
+typedef enum CounterEvent
+{
+	COUNT_CYCLES,
+	COUNT_INSTRUCTIONS,
+	COUNT_BRANCH_MISSES,
+	COUNT_CACHE_MISSES,
+	NUM_COUNTER_EVENTS
+} CounterEvent;
+
+static const char* event_names[NUM_COUNTER_EVENTS] = {
+  "cycles", "instructions", "branch misses", "LLC misses" };
+
+typedef struct HardwareCounters
+{
+	int num_threads;
+	// Each thread's counters side by side, -1 where one could not be opened
+	int* fds;
+	double* at_start;
+	double counts[NUM_COUNTER_EVENTS];
+	long long cell_updates;
+	double started;
+	double seconds;
+} HardwareCounters;
+
+static HardwareCounters counters;
+
+static void open_task( int thread, int num_threads, void* arg )
+{
+	static const struct
+	{
+		__u32 type;
+		__u64 config;
+	} events[NUM_COUNTER_EVENTS] = {
+	  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	  { PERF_TYPE_HW_CACHE,
+	    PERF_COUNT_HW_CACHE_LL | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) |
+	      ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 ) } };
+
+	for ( int event = 0; event < NUM_COUNTER_EVENTS; ++event )
+	{
+		struct perf_event_attr attr;
+		memset( &attr, 0, sizeof( attr ) );
+		attr.size = sizeof( attr );
+		attr.type = events[event].type;
+		attr.config = events[event].config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		// With more events than counters they take turns, so the running time
+		// is needed to scale them back up
+		attr.read_format =
+		  PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		// This thread only, on whichever core it happens to be on
+		counters.fds[thread * NUM_COUNTER_EVENTS + event] =
+		  syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 );
+	}
+}
+
+static double read_counter( int fd )
+{
+	// The count, the time enabled and the time actually counting
+	__u64 values[3];
+	if ( read( fd, values, sizeof( values ) ) != sizeof( values ) ||
+	     values[2] == 0 )
+		return 0;
+	return (double)values[0] * values[1] / values[2];
+}
+
+static bool event_available( int event )
+{
+	for ( int thread = 0; thread < counters.num_threads; ++thread )
+	{
+		if ( counters.fds[thread * NUM_COUNTER_EVENTS + event] < 0 )
+			return false;
+	}
+	return counters.num_threads > 0;
+}
+
+void counters_open( WorkerPool* pool )
+{
+	counters.num_threads = worker_pool_size( pool );
+	counters.fds =
+	  malloc( counters.num_threads * NUM_COUNTER_EVENTS * sizeof( int ) );
+	counters.at_start =
+	  calloc( counters.num_threads * NUM_COUNTER_EVENTS, sizeof( double ) );
+	worker_pool_run( pool, open_task, NULL );
+}
+
+void counters_start( void )
+{
+	if ( counters.fds == NULL )
+		return;
+
+	for ( int i = 0; i < counters.num_threads * NUM_COUNTER_EVENTS; ++i )
+	{
+		if ( counters.fds[i] >= 0 )
+			counters.at_start[i] = read_counter( counters.fds[i] );
+	}
+	counters.started = MPI_Wtime();
+}
+
+void counters_stop( long long cell_updates )
+{
+	if ( counters.fds == NULL )
+		return;
+
+	counters.seconds += MPI_Wtime() - counters.started;
+	for ( int thread = 0; thread < counters.num_threads; ++thread )
+	{
+		for ( int event = 0; event < NUM_COUNTER_EVENTS; ++event )
+		{
+			int i = thread * NUM_COUNTER_EVENTS + event;
+			if ( counters.fds[i] >= 0 )
+			{
+				counters.counts[event] +=
+				  read_counter( counters.fds[i] ) - counters.at_start[i];
+			}
+		}
+	}
+	counters.cell_updates += cell_updates;
+}
+
+void counters_report( MPI_Comm comm )
+{
+	if ( counters.fds == NULL )
+		return;
+
+	int rank;
+	MPI_Comm_rank( comm, &rank );
+
+	// A count is only worth adding up if every processor could count it
+	int available[NUM_COUNTER_EVENTS], all_available[NUM_COUNTER_EVENTS];
+	for ( int event = 0; event < NUM_COUNTER_EVENTS; ++event )
+		available[event] = event_available( event );
+	MPI_Allreduce( available, all_available, NUM_COUNTER_EVENTS, MPI_INT,
+	               MPI_LAND, comm );
+	double local[NUM_COUNTER_EVENTS + 2], totals[NUM_COUNTER_EVENTS + 2];
+	memcpy( local, counters.counts, sizeof( counters.counts ) );
+	local[NUM_COUNTER_EVENTS] = counters.cell_updates;
+	local[NUM_COUNTER_EVENTS + 1] = counters.seconds;
+	MPI_Reduce( local, totals, NUM_COUNTER_EVENTS + 2, MPI_DOUBLE, MPI_SUM, 0,
+	            comm );
+
+	double updates = totals[NUM_COUNTER_EVENTS];
+	if ( rank == 0 && updates > 0 )
+	{
+		printf( "Hardware counters over %.0f cell updates (%.3f ns per update "
+		        "computing):\n",
+		        updates, totals[NUM_COUNTER_EVENTS + 1] * 1e9 / updates );
+		for ( int event = 0; event < NUM_COUNTER_EVENTS; ++event )
+		{
+			if ( !all_available[event] )
+			{
+				printf( "  %-14s not available\n", event_names[event] );
+				continue;
+			}
+			printf( "  %-14s %16.0f %10.4f per update", event_names[event],
+			        totals[event], totals[event] / updates );
+			if ( event == COUNT_INSTRUCTIONS && all_available[COUNT_CYCLES] &&
+			     totals[COUNT_CYCLES] > 0 )
+				printf( " (%.2f per cycle)", totals[event] / totals[COUNT_CYCLES] );
+			printf( "\n" );
+		}
+	}
+
+	for ( int i = 0; i < counters.num_threads * NUM_COUNTER_EVENTS; ++i )
+	{
+		if ( counters.fds[i] >= 0 )
+			close( counters.fds[i] );
+	}
+	free( counters.fds );
+	free( counters.at_start );
+	counters.fds = NULL;
+	counters.num_threads = 0;
+}
@@ -0,0 +1,187 @@
+/* File:    cycles.c
+ *
+ * Purpose: Spots the halo game settling down (-p), so it can skip the
+ *          generations that would only repeat what it has already played.
+ *          After every round each processor hashes its own rows by adding up
+ *          a random number for each live cell, picked by the cell's place on
+ *          the whole board; adding up the processors' sums then gives the
+ *          same hash of the board however it is split up. The sums (and the
+ *          number of live cells) are kept until -r rounds have gone by, and
+ *          then added up across the processors in a single reduction.
+ *
+ *          The board hashes of the last -p iterations are kept. If one turns
+ *          up again the board repeats with that period (a still life if it
+ *          is 1), and if nothing is alive it stays that way, so the game
+ *          jumps ahead by as many whole periods as fit before the end. The
+ *          rounds are only seen every -d generations, so with deeper halos
+ *          the period found is a multiple of the real one.
+ */
+
+#include <stdlib.h>
+
+#include "life.h"
+
+typedef struct CycleCheck
+{
+	int max_period;
+	int check_every;
+	WorkerPool* pool;
+	// Rounds hashed here but not yet added up across the processors; hash and
+	// live cells side by side, so one reduction does both
+	int* pending_iterations;
+	uint64_t* pending;
+	int num_pending;
+	// Whole-board hashes of recent iterations, oldest first
+	int* seen_iterations;
+	uint64_t* seen_hashes;
+	int num_seen;
+	bool settled;
+	// Threads' shares of the hash of the rows in hand
+	const bool* cells;
+	long long first_cell;
+	ProcInfo range;
+	uint64_t* thread_sums;
+} CycleCheck;
+
+static CycleCheck check;
+
+// splitmix64, to give every cell of the board its own random number
+static uint64_t cell_number( long long cell )
+{
+	uint64_t bits = (uint64_t)cell * 0x9e3779b97f4a7c15ULL;
+	bits = ( bits ^ ( bits >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+	bits = ( bits ^ ( bits >> 27 ) ) * 0x94d049bb133111ebULL;
+	return bits ^ ( bits >> 31 );
+}
+
+static void hash_task( int thread, int num_threads, void* arg )
+{
+	ProcInfo share = split_cells( &check.range, thread, num_threads );
+	uint64_t hash = 0, live = 0;
+	for ( int i = share.offset; i < share.offset + share.num_cells; ++i )
+	{
+		if ( check.cells[i] )
+		{
+			hash += cell_number( check.first_cell + i );
+			live++;
+		}
+	}
+	check.thread_sums[2 * thread] = hash;
+	check.thread_sums[2 * thread + 1] = live;
+}
+
+void cycles_open( int max_period, int check_every, WorkerPool* pool )
+{
+	check.max_period = max_period;
+	check.check_every = check_every;
+	check.pool = pool;
+	check.pending_iterations = malloc( check_every * sizeof( int ) );
+	check.pending = malloc( 2 * check_every * sizeof( uint64_t ) );
+	check.seen_iterations = malloc( ( max_period + 1 ) * sizeof( int ) );
+	check.seen_hashes = malloc( ( max_period + 1 ) * sizeof( uint64_t ) );
+	check.thread_sums =
+	  malloc( 2 * worker_pool_size( pool ) * sizeof( uint64_t ) );
+}
+
+// Looks for the newest board among the ones seen before it; returns the
+// period, or 0 if it is new
+static int find_period( int iteration, uint64_t hash, uint64_t live )
+{
+	// Forget what is too long ago to count
+	int forget = 0;
+	while ( forget < check.num_seen &&
+	        iteration - check.seen_iterations[forget] > check.max_period )
+		++forget;
+	for ( int i = forget; i < check.num_seen; ++i )
+	{
+		check.seen_iterations[i - forget] = check.seen_iterations[i];
+		check.seen_hashes[i - forget] = check.seen_hashes[i];
+	}
+	check.num_seen -= forget;
+
+	int period = 0;
+	for ( int i = check.num_seen - 1; i >= 0 && period == 0; --i )
+	{
+		if ( check.seen_hashes[i] == hash )
+			period = iteration - check.seen_iterations[i];
+	}
+	check.seen_iterations[check.num_seen] = iteration;
+	check.seen_hashes[check.num_seen++] = hash;
+
+	// Dead is dead whatever came before
+	return live == 0 ? 1 : period;
+}
+
+int cycles_skip( const bool* cells, long long first_cell, int num_cells,
+                 int iteration, int iterations, MPI_Comm comm )
+{
+	if ( check.pending == NULL || check.settled )
+		return iteration;
+
+	check.cells = cells;
+	check.first_cell = first_cell;
+	check.range.offset = 0;
+	check.range.num_cells = num_cells;
+	worker_pool_run( check.pool, hash_task, NULL );
+	uint64_t* sums = &check.pending[2 * check.num_pending];
+	sums[0] = sums[1] = 0;
+	for ( int thread = 0; thread < worker_pool_size( check.pool ); ++thread )
+	{
+		sums[0] += check.thread_sums[2 * thread];
+		sums[1] += check.thread_sums[2 * thread + 1];
+	}
+	check.pending_iterations[check.num_pending++] = iteration;
+	if ( check.num_pending < check.check_every )
+		return iteration;
+
+	// Unsigned sums wrap around the same way everywhere, so the order the
+	// processors are added in doesn't matter
+	MPI_Allreduce( MPI_IN_PLACE, check.pending, 2 * check.num_pending,
+	               MPI_UINT64_T, MPI_SUM, comm );
+	int num_pending = check.num_pending;
+	check.num_pending = 0;
+
+	for ( int i = 0; i < num_pending; ++i )
+	{
+		int seen_on = check.pending_iterations[i];
+		uint64_t live = check.pending[2 * i + 1];
+		int period = find_period( seen_on, check.pending[2 * i], live );
+		if ( period == 0 )
+			continue;
+
+		// The board we have now is just as periodic as the one we spotted
+		check.settled = true;
+		int skip_to = iteration + ( iterations - iteration ) / period * period;
+		int rank;
+		MPI_Comm_rank( comm, &rank );
+		if ( rank == 0 )
+		{
+			if ( live == 0 )
+				printf( "Everything is dead by iteration %d", seen_on );
+			else if ( period == 1 )
+				printf( "Still life by iteration %d", seen_on );
+			else
+				printf( "Repeating every %d iterations by iteration %d", period,
+				        seen_on );
+			printf( ", skipping from iteration %d to %d\n", iteration, skip_to );
+		}
+		return skip_to;
+	}
+	return iteration;
+}
+
+// Whether cycles_skip may still look at the board
+bool cycles_enabled( void )
+{
+	return check.pending != NULL && !check.settled;
+}
+
+void cycles_close( void )
+{
+	free( check.pending_iterations );
+	free( check.pending );
+	free( check.seen_iterations );
+	free( check.seen_hashes );
+	free( check.thread_sums );
+	check.pending = NULL;
+}
@@ -0,0 +1,190 @@
+/* File:    dataflow.c
+ *
+ * Purpose: The "dataflow" kernel, which drops the idea of everyone finishing
+ *          a generation before anyone starts the next. The cells are cut into
+ *          square tiles and every tile keeps its own generation counter; a
+ *          tile can go from generation g to g + 1 as soon as its (up to) eight
+ *          neighbouring tiles have reached g. Tiles that become ready are put
+ *          on a shared queue that the worker threads take from, so a fast
+ *          part of the board can run ahead of a slow one.
+ *
+ *          With only two boards, generation g + 1 of a tile overwrites
+ *          generation g - 1, so it has to wait until its neighbours are done
+ *          reading that, which they are once they reach g. That is the same
+ *          condition as above, so neighbouring tiles are never more than one
+ *          generation apart (more boards would allow more skew), while tiles
+ *          further apart can be several generations apart.
+ *
+ *          Combined with a halo depth above one (-d), a whole round of
+ *          generations between exchanges runs this way.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "life.h"
+
+typedef struct DataflowTask
+{
+	LifeStep* step;
+	TileGrid grid;
+	int generations;
+	bool* boards[2];
+	// Generation each tile has reached, and whether it is queued or running
+	atomic_int* generation;
+	atomic_bool* queued;
+	// Tiles ready to go, oldest first; every tile is on it at most once
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	int* queue;
+	int head;
+	int size;
+	// Tile generations left to play
+	int remaining;
+} DataflowTask;
+
+static void dataflow_apply( LifeStep* step );
+static void dataflow_advance( LifeStep* step, int generations );
+
+const LifeKernel dataflow_kernel = { "dataflow", dataflow_apply, NULL,
+                                     dataflow_advance, false, true };
+
+static bool is_ready( DataflowTask* task, int tile )
+{
+	TileGrid* grid = &task->grid;
+	int generation = atomic_load( &task->generation[tile] );
+	if ( generation >= task->generations )
+		return false;
+
+	int tile_row = tile / grid->tile_cols;
+	int tile_col = tile % grid->tile_cols;
+	for ( int row = tile_row - 1; row <= tile_row + 1; ++row )
+	{
+		for ( int col = tile_col - 1; col <= tile_col + 1; ++col )
+		{
+			if ( row < 0 || row >= grid->tile_rows || col < 0 ||
+			     col >= grid->tile_cols )
+				continue;
+			int neighbour = row * grid->tile_cols + col;
+			if ( atomic_load( &task->generation[neighbour] ) < generation )
+				return false;
+		}
+	}
+	return true;
+}
+
+// Queues the tile if it is ready and nobody has queued (or is running) it
+static void try_enqueue( DataflowTask* task, int tile )
+{
+	if ( !is_ready( task, tile ) ||
+	     atomic_exchange( &task->queued[tile], true ) )
+		return;
+
+	pthread_mutex_lock( &task->lock );
+	task->queue[( task->head + task->size++ ) % task->grid.num_tiles] = tile;
+	pthread_cond_signal( &task->ready );
+	pthread_mutex_unlock( &task->lock );
+}
+
+static void dataflow_task( int thread, int num_threads, void* arg )
+{
+	DataflowTask* task = arg;
+	TileGrid* grid = &task->grid;
+
+	for ( ;; )
+	{
+		pthread_mutex_lock( &task->lock );
+		while ( task->size == 0 && task->remaining > 0 )
+			pthread_cond_wait( &task->ready, &task->lock );
+		if ( task->size == 0 )
+		{
+			pthread_mutex_unlock( &task->lock );
+			break;
+		}
+		int tile = task->queue[task->head];
+		task->head = ( task->head + 1 ) % grid->num_tiles;
+		task->size--;
+		pthread_mutex_unlock( &task->lock );
+
+		int generation = atomic_load( &task->generation[tile] );
+		apply_rules_to_tile( grid, tile, task->step,
+		                     task->boards[generation % 2],
+		                     task->boards[( generation + 1 ) % 2] );
+		atomic_store( &task->generation[tile], generation + 1 );
+		atomic_store( &task->queued[tile], false );
+
+		pthread_mutex_lock( &task->lock );
+		if ( --task->remaining == 0 )
+			pthread_cond_broadcast( &task->ready );
+		pthread_mutex_unlock( &task->lock );
+
+		// Moving on may have made us or any of our neighbours ready
+		int tile_row = tile / grid->tile_cols;
+		int tile_col = tile % grid->tile_cols;
+		for ( int row = tile_row - 1; row <= tile_row + 1; ++row )
+		{
+			for ( int col = tile_col - 1; col <= tile_col + 1; ++col )
+			{
+				if ( row >= 0 && row < grid->tile_rows && col >= 0 &&
+				     col < grid->tile_cols )
+					try_enqueue( task, row * grid->tile_cols + col );
+			}
+		}
+	}
+}
+
+// Plays the generations, leaving the last one in boards[generations % 2]
+static void dataflow_run( LifeStep* step, int generations )
+{
+	DataflowTask task;
+	task.step = step;
+	tile_grid_init( &task.grid, &step->cells, step->width, step->tile_size, 1 );
+	task.generations = generations;
+	task.boards[0] = step->last_game_state;
+	task.boards[1] = step->new_game_state;
+
+	int num_tiles = task.grid.num_tiles;
+	task.generation = malloc( num_tiles * sizeof( atomic_int ) );
+	task.queued = malloc( num_tiles * sizeof( atomic_bool ) );
+	task.queue = malloc( num_tiles * sizeof( int ) );
+	pthread_mutex_init( &task.lock, NULL );
+	pthread_cond_init( &task.ready, NULL );
+	task.head = 0;
+	task.size = 0;
+	task.remaining = num_tiles * generations;
+
+	// Every tile is ready for the first generation
+	for ( int tile = 0; tile < num_tiles; ++tile )
+	{
+		atomic_init( &task.generation[tile], 0 );
+		atomic_init( &task.queued[tile], true );
+		task.queue[task.size++] = tile;
+	}
+
+	worker_pool_run( step->pool, dataflow_task, &task );
+
+	pthread_mutex_destroy( &task.lock );
+	pthread_cond_destroy( &task.ready );
+	free( task.generation );
+	free( task.queued );
+	free( task.queue );
+}
+
+static void dataflow_apply( LifeStep* step )
+{
+	dataflow_run( step, 1 );
+	if ( step->boundary_done != NULL )
+		step->boundary_done( step->boundary_arg );
+}
+
+static void dataflow_advance( LifeStep* step, int generations )
+{
+	dataflow_run( step, generations );
+	if ( generations % 2 == 1 )
+	{
+		bool* temp_game_state = step->last_game_state;
+		step->last_game_state = step->new_game_state;
+		step->new_game_state = temp_game_state;
+	}
+}
@@ -0,0 +1,242 @@
+/* File:    ensemble.c
+ *
+ * Purpose: The ensemble game (-e), which plays 64 separate m x n boards on
+ *          every processor at once instead of one big one, for studies that
+ *          need lots of small random games. The same cell of all 64 boards
+ *          shares one uint64_t, a bit per board, so the bitwise neighbour
+ *          count of the packed kernel plays all of them in a single pass over
+ *          the cells. Each board gets its own seed (the -s seed plus its
+ *          number), and every processor plays 64 boards of its own, so there
+ *          are 64 x p boards in all and no messages until the end.
+ *
+ *          Along the way the game notes the iteration each board dies out on,
+ *          and at the end it prints every board's population and that
+ *          iteration.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "life.h"
+
+#define ENSEMBLE_BOARDS 64
+
+typedef struct EnsembleGame
+{
+	int width;
+	int height;
+	// (height + 2) x (width + 2) words, with a border of dead cells
+	uint64_t* last_cells;
+	uint64_t* new_cells;
+	// Boards with any live cells left, found by each thread's rows
+	uint64_t* thread_alive;
+	ProcInfo rows;
+} EnsembleGame;
+
+// What every board ends up with, gathered on the controller
+typedef struct BoardResult
+{
+	long seed;
+	long long population;
+	// -1 if the board never died out
+	int died_on;
+} BoardResult;
+
+static uint64_t* cell_at( EnsembleGame* game, uint64_t* cells, int x, int y )
+{
+	return cells + (size_t)( y + 1 ) * ( game->width + 2 ) + x + 1;
+}
+
+static void generation_task( int thread, int num_threads, void* arg )
+{
+	EnsembleGame* game = arg;
+	ProcInfo share = split_cells( &game->rows, thread, num_threads );
+	int stride = game->width + 2;
+	uint64_t alive = 0;
+
+	for ( int y = share.offset; y < share.offset + share.num_cells; ++y )
+	{
+		const uint64_t* row = cell_at( game, game->last_cells, 0, y );
+		uint64_t* new_row = cell_at( game, game->new_cells, 0, y );
+		for ( int x = 0; x < game->width; ++x )
+		{
+			const uint64_t* above = row + x - stride;
+			const uint64_t* below = row + x + stride;
+			uint64_t neighbours[8] = { above[-1], above[0], above[1], row[x - 1],
+			                           row[x + 1], below[-1], below[0], below[1] };
+			new_row[x] = apply_rules_to_bits( neighbours, row[x] );
+			alive |= new_row[x];
+		}
+	}
+	game->thread_alive[thread] = alive;
+}
+
+static void count_population( EnsembleGame* game, long long population[] )
+{
+	memset( population, 0, ENSEMBLE_BOARDS * sizeof( long long ) );
+	for ( int y = 0; y < game->height; ++y )
+	{
+		const uint64_t* row = cell_at( game, game->last_cells, 0, y );
+		for ( int x = 0; x < game->width; ++x )
+		{
+			for ( uint64_t boards = row[x]; boards != 0; boards &= boards - 1 )
+				population[__builtin_ctzll( boards )]++;
+		}
+	}
+}
+
+static void print_ensemble( EnsembleGame* game, int iteration, int world_rank )
+{
+	long long population[ENSEMBLE_BOARDS];
+	count_population( game, population );
+
+	// Boards still alive and live cells, over every processor's boards
+	long long local[2] = { 0, 0 }, totals[2];
+	for ( int board = 0; board < ENSEMBLE_BOARDS; ++board )
+	{
+		local[0] += population[board] > 0;
+		local[1] += population[board];
+	}
+	MPI_Reduce( local, totals, 2, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD );
+
+	if ( world_rank == 0 )
+	{
+		int world_size;
+		MPI_Comm_size( MPI_COMM_WORLD, &world_size );
+		long long boards = (long long)world_size * ENSEMBLE_BOARDS;
+		printf( "Ensemble on iteration %d: %lld of %lld boards alive, "
+		        "%.1f live cells per board\n",
+		        iteration, totals[0], boards, (double)totals[1] / boards );
+	}
+}
+
+void play_ensemble_game( int live_cells, int iterations, int print_modulo,
+                         int width, int height, long seed, WorkerPool* pool )
+{
+	int world_rank, world_size;
+	MPI_Comm_rank( MPI_COMM_WORLD, &world_rank );
+	MPI_Comm_size( MPI_COMM_WORLD, &world_size );
+
+	// Every processor has to count its boards' seeds from the same place
+	if ( seed < 0 )
+	{
+		seed = time( NULL );
+		MPI_Bcast( &seed, 1, MPI_LONG, 0, MPI_COMM_WORLD );
+	}
+
+	EnsembleGame game;
+	game.width = width;
+	game.height = height;
+	game.rows.offset = 0;
+	game.rows.num_cells = height;
+	size_t words = (size_t)( width + 2 ) * ( height + 2 );
+	game.last_cells = calloc( words, sizeof( uint64_t ) );
+	game.new_cells = calloc( words, sizeof( uint64_t ) );
+	game.thread_alive = calloc( worker_pool_size( pool ), sizeof( uint64_t ) );
+
+	// Fill each board on its own, then slot it into its bit
+	BoardResult results[ENSEMBLE_BOARDS];
+	bool* field = malloc( (size_t)width * height * sizeof( bool ) );
+	for ( int board = 0; board < ENSEMBLE_BOARDS; ++board )
+	{
+		results[board].seed =
+		  seed + (long)world_rank * ENSEMBLE_BOARDS + board;
+		results[board].died_on = -1;
+		memset( field, 0, (size_t)width * height * sizeof( bool ) );
+		fill_game_field( field, width, height, live_cells, results[board].seed );
+		for ( int y = 0; y < height; ++y )
+		{
+			uint64_t* row = cell_at( &game, game.last_cells, 0, y );
+			for ( int x = 0; x < width; ++x )
+				row[x] |= (uint64_t)field[(size_t)y * width + x] << board;
+		}
+	}
+	free( field );
+
+	uint64_t alive = 0;
+	for ( size_t i = 0; i < words; ++i )
+		alive |= game.last_cells[i];
+	for ( int board = 0; board < ENSEMBLE_BOARDS; ++board )
+	{
+		if ( !( alive >> board & 1 ) )
+			results[board].died_on = 0;
+	}
+
+	double elapsed = 0;
+	for ( int iteration = 0; iteration <= iterations; ++iteration )
+	{
+		if ( iteration % print_modulo == 0 )
+			print_ensemble( &game, iteration, world_rank );
+		if ( iteration == iterations )
+			break;
+
+		double start = MPI_Wtime();
+		worker_pool_run( pool, generation_task, &game );
+		elapsed += MPI_Wtime() - start;
+
+		uint64_t now_alive = 0;
+		for ( int thread = 0; thread < worker_pool_size( pool ); ++thread )
+			now_alive |= game.thread_alive[thread];
+		for ( uint64_t died = alive & ~now_alive; died != 0; died &= died - 1 )
+			results[__builtin_ctzll( died )].died_on = iteration + 1;
+		alive = now_alive;
+
+		uint64_t* temp_cells = game.last_cells;
+		game.last_cells = game.new_cells;
+		game.new_cells = temp_cells;
+	}
+
+	long long population[ENSEMBLE_BOARDS];
+	count_population( &game, population );
+	for ( int board = 0; board < ENSEMBLE_BOARDS; ++board )
+		results[board].population = population[board];
+
+	// Every board's result, in seed order
+	MPI_Datatype result_type;
+	MPI_Type_contiguous( sizeof( BoardResult ), MPI_BYTE, &result_type );
+	MPI_Type_commit( &result_type );
+	BoardResult* all_results =
+	  world_rank == 0 ? malloc( (size_t)world_size * ENSEMBLE_BOARDS *
+	                            sizeof( BoardResult ) )
+	                  : NULL;
+	MPI_Gather( results, ENSEMBLE_BOARDS, result_type, all_results,
+	            ENSEMBLE_BOARDS, result_type, 0, MPI_COMM_WORLD );
+	double slowest;
+	MPI_Reduce( &elapsed, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD );
+
+	if ( world_rank == 0 )
+	{
+		int num_boards = world_size * ENSEMBLE_BOARDS, num_dead = 0;
+		for ( int board = 0; board < num_boards; ++board )
+		{
+			BoardResult* result = &all_results[board];
+			if ( result->died_on < 0 )
+			{
+				printf( "Board %d (seed %ld): %lld live cells\n", board,
+				        result->seed, result->population );
+			}
+			else
+			{
+				printf( "Board %d (seed %ld): died out on iteration %d\n", board,
+				        result->seed, result->died_on );
+				num_dead++;
+			}
+		}
+
+		printf( "Ensemble: %d boards, %d died out", num_boards, num_dead );
+		if ( iterations > 0 && slowest > 0 )
+		{
+			printf( ", %.1f million cell updates per second",
+			        (double)num_boards * width * height * iterations / slowest /
+			          1e6 );
+		}
+		printf( "\n" );
+		free( all_results );
+	}
+
+	MPI_Type_free( &result_type );
+	free( game.last_cells );
+	free( game.new_cells );
+	free( game.thread_alive );
+}
@@ -0,0 +1,451 @@
+/* File:    halo.c
+ *
+ * Purpose: The halo version of the game. Instead of sending the whole board
+ *          to every processor on every iteration, each processor keeps its
+ *          own band of rows (a "slab") for the whole game and only trades its
+ *          top and bottom rows with the processors above and below it. The
+ *          board is only gathered on the controller when it has to be
+ *          printed.
+ *
+ *          How the boundary rows get from one processor to the next is up to
+ *          the halo transport, which is picked by name at run time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "life.h"
+
+typedef struct PlainHalo
+{
+	MPI_Request requests[4];
+	TraceMessage messages[4];
+	// The board whose exchange has been started early, if any
+	bool* started;
+} PlainHalo;
+
+static void plain_init( Slab* slab );
+static void plain_exchange( Slab* slab );
+static void plain_finalize( Slab* slab );
+static void plain_start( Slab* slab, bool* board );
+
+// The simplest transport: each boundary row is sent as-is with a non-blocking
+// send, and the ghost rows are received straight into the board.
+static const HaloTransport plain_halo_transport = {
+  "plain", plain_init, plain_exchange, plain_finalize, plain_start };
+
+static void comm_init( Slab* slab );
+static void comm_exchange( Slab* slab );
+static void comm_finalize( Slab* slab );
+
+// Swaps the boundary rows through the slab's LifeComm rather than MPI, so it
+// is the one transport that also plays on the threads backend (-L)
+static const HaloTransport comm_halo_transport = {
+  "comm", comm_init, comm_exchange, comm_finalize, NULL };
+
+static const HaloTransport* const halo_transports[] = {
+  &plain_halo_transport,
+  &comm_halo_transport,
+  &adaptive_halo_transport,
+  &rma_halo_transport,
+  &persistent_halo_transport,
+};
+
+#define NUM_HALO_TRANSPORTS                                                    \
+	( sizeof( halo_transports ) / sizeof( halo_transports[0] ) )
+
+const HaloTransport* find_halo_transport( const char* name )
+{
+	for ( size_t i = 0; i < NUM_HALO_TRANSPORTS; ++i )
+	{
+		if ( strcmp( halo_transports[i]->name, name ) == 0 )
+			return halo_transports[i];
+	}
+	return NULL;
+}
+
+int num_halo_transports( void )
+{
+	return NUM_HALO_TRANSPORTS;
+}
+
+const HaloTransport* get_halo_transport( int index )
+{
+	return halo_transports[index];
+}
+
+void list_halo_transports( FILE* stream )
+{
+	for ( size_t i = 0; i < NUM_HALO_TRANSPORTS; ++i )
+	{
+		fprintf( stream, "%s%s", i == 0 ? "" : ", ", halo_transports[i]->name );
+	}
+}
+
+// Same split as the original game, just by rows instead of by cells: every
+// processor gets height / size rows and the last one also takes the remainder.
+static void slab_rows( int rank, int size, int height, int* first_row,
+                       int* num_rows )
+{
+	int normal_num_rows = height / size;
+	*first_row = rank * normal_num_rows;
+	*num_rows = normal_num_rows;
+	if ( rank == size - 1 )
+		*num_rows += height % size;
+}
+
+void slab_decompose( Slab* slab, LifeComm* comm, int width, int height,
+                     int halo_depth )
+{
+	int rank = comm->rank;
+	int size = comm->size;
+
+	// A neighbour has to own every row of our ghost rows
+	if ( height / size < halo_depth )
+	{
+		if ( rank == 0 )
+		{
+			fprintf( stderr,
+			         "The halo game needs at least %d row(s) per processor "
+			         "(%d rows, %d processors)\n",
+			         halo_depth, height, size );
+		}
+		// Everyone gets here, so wait for the message to be out first
+		comm->backend->barrier( comm );
+		comm->backend->abort( comm, 1 );
+	}
+
+	slab->width = width;
+	slab->height = height;
+	slab->halo_depth = halo_depth;
+	slab_renumber( slab, comm );
+	slab->pool = NULL;
+	slab->num_boards = 2;
+	slab->last_game_state = NULL;
+	slab->new_game_state = NULL;
+	slab->transport_data = NULL;
+	slab->quiet = false;
+}
+
+// Moves the slab to comm, which has the same processors under other ranks,
+// and gives it the rows that go with its rank there. Only transports do this,
+// in init, before they allocate the boards.
+void slab_renumber( Slab* slab, LifeComm* comm )
+{
+	int rank = comm->rank;
+	int size = comm->size;
+	slab_rows( rank, size, slab->height, &slab->first_row, &slab->num_rows );
+	slab->up_rank = rank == 0 ? COMM_NONE : rank - 1;
+	slab->down_rank = rank == size - 1 ? COMM_NONE : rank + 1;
+	slab->life_comm = comm;
+	slab->comm = comm->mpi;
+}
+
+// Clears the owned rows of a freshly allocated board from the threads that
+// will apply the rules to them, so their pages end up next to those threads
+void slab_first_touch( Slab* slab, bool* board )
+{
+	ProcInfo owned_cells = { slab->halo_depth * slab->width,
+	                         slab->num_rows * slab->width };
+	worker_pool_first_touch( slab->pool, board, &owned_cells );
+}
+
+// Both boards start out dead, which is also what the ghost rows at the edges
+// of the game field have to stay for the whole game.
+void slab_alloc_boards( Slab* slab )
+{
+	size_t ghost_cells = (size_t)slab->halo_depth * slab->width;
+	size_t cells = (size_t)slab->num_rows * slab->width + 2 * ghost_cells;
+	bool* boards[2] = { NULL, NULL };
+	for ( int board = 0; board < slab->num_boards; ++board )
+	{
+		boards[board] = malloc( cells * sizeof( bool ) );
+		memset( boards[board], 0, ghost_cells * sizeof( bool ) );
+		memset( boards[board] + cells - ghost_cells, 0,
+		        ghost_cells * sizeof( bool ) );
+		slab_first_touch( slab, boards[board] );
+	}
+	slab->last_game_state = boards[0];
+	slab->new_game_state = boards[1];
+}
+
+void slab_free_boards( Slab* slab )
+{
+	free( slab->last_game_state );
+	free( slab->new_game_state );
+}
+
+static void plain_init( Slab* slab )
+{
+	slab_alloc_boards( slab );
+	slab->transport_data = calloc( 1, sizeof( PlainHalo ) );
+}
+
+static void plain_start( Slab* slab, bool* board )
+{
+	PlainHalo* halo = slab->transport_data;
+	int width = slab->width;
+	int depth = slab->halo_depth;
+
+	// Ghost rows first so the sends never have to wait on an unposted receive
+	trace_begin( &halo->messages[0], TRACE_RECEIVE, slab->up_rank );
+	MPI_Irecv( board, depth * width, MPI_C_BOOL, slab->up_rank, HALO_DOWN,
+	           slab->comm, &halo->requests[0] );
+	trace_begin( &halo->messages[1], TRACE_RECEIVE, slab->down_rank );
+	MPI_Irecv( board + ( slab->num_rows + depth ) * width, depth * width,
+	           MPI_C_BOOL, slab->down_rank, HALO_UP, slab->comm,
+	           &halo->requests[1] );
+	trace_begin( &halo->messages[2], TRACE_SEND, slab->up_rank );
+	MPI_Isend( board + depth * width, depth * width, MPI_C_BOOL, slab->up_rank,
+	           HALO_UP, slab->comm, &halo->requests[2] );
+	trace_begin( &halo->messages[3], TRACE_SEND, slab->down_rank );
+	MPI_Isend( board + slab->num_rows * width, depth * width, MPI_C_BOOL,
+	           slab->down_rank, HALO_DOWN, slab->comm, &halo->requests[3] );
+	halo->started = board;
+}
+
+static void plain_exchange( Slab* slab )
+{
+	PlainHalo* halo = slab->transport_data;
+	if ( halo->started != slab->last_game_state )
+		plain_start( slab, slab->last_game_state );
+	double waited = MPI_Wtime();
+	trace_waitall( 4, halo->requests, halo->messages, MPI_STATUSES_IGNORE );
+	trace_event( TRACE_WAIT, waited, -1 );
+	halo->started = NULL;
+}
+
+static void plain_finalize( Slab* slab )
+{
+	// An exchange may have been started for a generation nobody will play
+	PlainHalo* halo = slab->transport_data;
+	if ( halo->started != NULL )
+		MPI_Waitall( 4, halo->requests, MPI_STATUSES_IGNORE );
+	free( halo );
+	slab_free_boards( slab );
+}
+
+static void comm_init( Slab* slab )
+{
+	slab_alloc_boards( slab );
+}
+
+// A send and a receive at once, which go on the timeline as one of each
+static void comm_sendrecv( LifeComm* comm, bool* send_rows, int dest,
+                           bool* recv_rows, int source, int bytes, int tag )
+{
+	double begun = MPI_Wtime();
+	comm->backend->sendrecv( comm, send_rows, bytes, dest, recv_rows, bytes,
+	                         source, tag );
+	if ( dest != COMM_NONE )
+		trace_event( TRACE_SEND, begun, dest );
+	if ( source != COMM_NONE )
+		trace_event( TRACE_RECEIVE, begun, source );
+}
+
+// Down then up, each a send and receive at once so neighbours never wait on
+// each other
+static void comm_exchange( Slab* slab )
+{
+	LifeComm* comm = slab->life_comm;
+	bool* board = slab->last_game_state;
+	int width = slab->width;
+	int depth = slab->halo_depth;
+	int bytes = depth * width * sizeof( bool );
+
+	comm_sendrecv( comm, board + slab->num_rows * width, slab->down_rank, board,
+	               slab->up_rank, bytes, HALO_DOWN );
+	comm_sendrecv( comm, board + depth * width, slab->up_rank,
+	               board + ( slab->num_rows + depth ) * width, slab->down_rank,
+	               bytes, HALO_UP );
+}
+
+static void comm_finalize( Slab* slab )
+{
+	slab_free_boards( slab );
+}
+
+// Collects every slab's owned rows into game_field on the controller
+static void gather_game( Slab* slab, bool* game_field, int* counts,
+                         int* displs, int root )
+{
+	LifeComm* comm = slab->life_comm;
+	comm->backend->gatherv( comm,
+	                        slab->last_game_state + slab->halo_depth * slab->width,
+	                        slab->num_rows * slab->width, game_field, counts,
+	                        displs, root );
+}
+
+typedef struct EarlyStart
+{
+	const HaloTransport* transport;
+	Slab* slab;
+} EarlyStart;
+
+static void start_halo_early( void* arg )
+{
+	EarlyStart* early = arg;
+	early->transport->start( early->slab, early->slab->new_game_state );
+}
+
+// The rows the kernel has to play for a round of generations. Every
+// generation garbles one more row at either end of whatever gets played, so
+// to finish with exact owned rows we have to start that many generations' worth
+// of rows into the ghost rows (except at the edges of the game field, where
+// the ghost rows are dead and stay that way).
+ProcInfo slab_round_cells( Slab* slab, int generations )
+{
+	int extra_rows = generations - 1;
+	int first_row = slab->halo_depth;
+	int last_row = slab->halo_depth + slab->num_rows;
+	if ( slab->up_rank != MPI_PROC_NULL )
+		first_row -= extra_rows;
+	if ( slab->down_rank != MPI_PROC_NULL )
+		last_row += extra_rows;
+
+	ProcInfo cells = { first_row * slab->width,
+	                   ( last_row - first_row ) * slab->width };
+	return cells;
+}
+
+// As many generations as the ghost rows allow from iteration on, stopping
+// early for the next print or the end of the game
+static int round_generations( int iteration, int iterations, int print_modulo,
+                              int halo_depth )
+{
+	int generations = halo_depth;
+	int next_print = ( iteration / print_modulo + 1 ) * print_modulo;
+	if ( generations > next_print - iteration )
+		generations = next_print - iteration;
+	if ( generations > iterations - iteration )
+		generations = iterations - iteration;
+	return generations;
+}
+
+void play_halo_game( LifeComm* comm, bool* game_field, int width, int height,
+                     int iterations, int print_modulo, int halo_depth,
+                     const HaloTransport* transport, const LifeKernel* kernel,
+                     LifeStep* step )
+{
+	int world_rank = comm->rank;
+	int world_size = comm->size;
+
+	Slab slab;
+	slab_decompose( &slab, comm, width, height, halo_depth );
+	slab.pool = step->pool;
+	slab.num_boards = kernel->in_place ? 1 : 2;
+	transport->init( &slab );
+
+	// Counts and displacements for scattering/gathering the owned rows. Only
+	// the controller needs these, but they are cheap enough to build anywhere.
+	int* counts = calloc( world_size, sizeof( int ) );
+	int* displs = calloc( world_size, sizeof( int ) );
+	for ( int proc = 0; proc < world_size; ++proc )
+	{
+		int first_row, num_rows;
+		slab_rows( proc, world_size, height, &first_row, &num_rows );
+		counts[proc] = num_rows * width;
+		displs[proc] = first_row * width;
+	}
+
+	// The transport may have moved the slab to ranks of its own, so the rows
+	// go out by those, from wherever the controller ended up
+	int root = slab.life_comm->rank;
+	comm->backend->bcast( comm, &root, sizeof( root ), 0 );
+	slab.life_comm->backend->scatterv( slab.life_comm, game_field, counts,
+	                                   displs,
+	                                   slab.last_game_state + halo_depth * width,
+	                                   slab.num_rows * width, root );
+
+	// The slab is indexed locally, so the original rules work on it unchanged
+	// as long as they see the ghost rows as the top and bottom of the board
+	step->height = slab.num_rows + 2 * halo_depth;
+	EarlyStart early = { transport, &slab };
+
+	// Between rounds the exchange only writes the ghost rows, so after the
+	// first round the owned rows are as the kernel left them. The ones past
+	// the boundary rows nobody looks at before the next round, unless it
+	// prints, checks for cycles or plays a different number of generations.
+	ProcInfo none = { 0, 0 };
+	ProcInfo owned_cells = { halo_depth * width, slab.num_rows * width };
+	ProcInfo inside_cells = { 2 * halo_depth * width,
+	                          ( slab.num_rows - 2 * halo_depth ) * width };
+	if ( inside_cells.num_cells < 0 )
+		inside_cells = none;
+	step->kept_cells = none;
+
+	int iteration = 0;
+	for ( ;; )
+	{
+		trace_iteration( iteration );
+
+		// Settled boards can skip ahead by whole periods (only with -p)
+		iteration = cycles_skip( slab.last_game_state + halo_depth * width,
+		                         (long long)slab.first_row * width,
+		                         slab.num_rows * width, iteration, iterations,
+		                         slab.comm );
+
+		if ( iteration % print_modulo == 0 )
+		{
+			timer_start( TIMER_PRINT );
+			gather_game( &slab, game_field, counts, displs, root );
+			if ( world_rank == 0 )
+			{
+				printf( "Game state on iteration %d:\n", iteration );
+				print_game( game_field, width, height );
+			}
+			timer_stop( TIMER_PRINT );
+		}
+
+		// Nobody will look at the generation after the last one
+		if ( iteration == iterations )
+			break;
+
+		int generations =
+		  round_generations( iteration, iterations, print_modulo, halo_depth );
+		int next = iteration + generations;
+		step->hidden_cells = none;
+		if ( next < iterations && next % print_modulo != 0 &&
+		     !cycles_enabled() &&
+		     round_generations( next, iterations, print_modulo, halo_depth ) ==
+		       generations )
+			step->hidden_cells = inside_cells;
+
+		// Transports that can start early get going as soon as the kernel has
+		// finished the rows they send, a whole halo's worth at either end, which
+		// only works one generation at a time
+		step->boundary_done = NULL;
+		if ( transport->start != NULL && generations == 1 )
+		{
+			step->boundary_done = start_halo_early;
+			step->boundary_arg = &early;
+			step->boundary_rows = halo_depth;
+		}
+
+		timer_start( TIMER_EXCHANGE );
+		transport->exchange( &slab );
+		timer_stop( TIMER_EXCHANGE );
+		step->cells = slab_round_cells( &slab, generations );
+		step->last_game_state = slab.last_game_state;
+		step->new_game_state = slab.new_game_state;
+		// Only the owned rows count as updates; the ghost rows played again
+		// for a deep halo are part of what they cost
+		long long updates = (long long)slab.num_rows * width * generations;
+		timer_start( TIMER_COMPUTE );
+		counters_start();
+		advance_generations( kernel, step, generations );
+		counters_stop( updates );
+		timer_stop( TIMER_COMPUTE );
+		timers_add_updates( updates );
+		slab.last_game_state = step->last_game_state;
+		slab.new_game_state = step->new_game_state;
+		step->kept_cells = owned_cells;
+		iteration += generations;
+	}
+
+	step->kept_cells = none;
+	step->hidden_cells = none;
+	transport->finalize( &slab );
+	free( counts );
+	free( displs );
+}
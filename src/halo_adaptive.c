@@ -0,0 +1,308 @@
+/* File:    halo_adaptive.c
+ *
+ * Purpose: A halo transport that shrinks the boundary rows before sending
+ *          them. On every exchange, and separately for each neighbour, the
+ *          row goes out as whichever of these is smallest:
+ *
+ *          - an "unchanged" token when it matches the row sent last time
+ *          - a run-length encoded row, which wins for mostly dead (or mostly
+ *            alive) rows
+ *          - a bit-packed row, 8 cells to a byte, which wins for busy rows
+ *
+ *          Picking one only takes a single pass over the row that compares it
+ *          against the last one sent and counts the runs, and the receiver
+ *          always rebuilds the row exactly. With deeper halos the boundary
+ *          rows are simply treated as one long row.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "life.h"
+
+enum HaloEncoding
+{
+	HALO_UNCHANGED,
+	HALO_RLE,
+	HALO_BITPACKED,
+	NUM_HALO_ENCODINGS,
+};
+
+enum HaloDirection
+{
+	UP,
+	DOWN,
+	NUM_DIRECTIONS,
+};
+
+typedef struct AdaptiveHalo
+{
+	// Largest message we can ever send: header byte plus a bit-packed row
+	int max_message;
+	unsigned char* send_buffer[NUM_DIRECTIONS];
+	unsigned char* recv_buffer[NUM_DIRECTIONS];
+	// The boundary row we sent last and the ghost row we received last, which
+	// is what an "unchanged" token refers to on either end
+	bool* sent_row[NUM_DIRECTIONS];
+	bool* ghost_row[NUM_DIRECTIONS];
+	bool have_sent[NUM_DIRECTIONS];
+	// Bookkeeping for the summary printed at the end
+	long long bytes_sent;
+	long long raw_bytes;
+	long long encodings_used[NUM_HALO_ENCODINGS];
+} AdaptiveHalo;
+
+static void adaptive_init( Slab* slab );
+static void adaptive_exchange( Slab* slab );
+static void adaptive_finalize( Slab* slab );
+
+const HaloTransport adaptive_halo_transport = {
+  "adaptive", adaptive_init, adaptive_exchange, adaptive_finalize };
+
+static int packed_size( int width )
+{
+	return ( width + 7 ) / 8;
+}
+
+// Run lengths are stored as little-endian base 128 varints, so short runs only
+// cost a single byte
+static int varint_size( int value )
+{
+	int size = 1;
+	while ( value >= 0x80 )
+	{
+		value >>= 7;
+		size++;
+	}
+	return size;
+}
+
+static int put_varint( unsigned char* out, int value )
+{
+	int size = 0;
+	while ( value >= 0x80 )
+	{
+		out[size++] = ( value & 0x7f ) | 0x80;
+		value >>= 7;
+	}
+	out[size++] = value;
+	return size;
+}
+
+static int get_varint( const unsigned char* in, int* value )
+{
+	int size = 0, shift = 0;
+	*value = 0;
+	do
+	{
+		*value |= ( in[size] & 0x7f ) << shift;
+		shift += 7;
+	} while ( in[size++] & 0x80 );
+	return size;
+}
+
+// Returns the number of bytes of message that ended up in out
+static int encode_row( AdaptiveHalo* halo, int direction, const bool* row,
+                       int width, unsigned char* out )
+{
+	bool* sent_row = halo->sent_row[direction];
+	bool changed = !halo->have_sent[direction];
+
+	// Header and first cell, then one varint per run
+	int rle_size = 2;
+	int run_length = 1;
+	changed |= row[0] != sent_row[0];
+	for ( int i = 1; i < width; ++i )
+	{
+		changed |= row[i] != sent_row[i];
+		if ( row[i] != row[i - 1] )
+		{
+			rle_size += varint_size( run_length );
+			run_length = 1;
+		}
+		else
+		{
+			run_length++;
+		}
+	}
+	rle_size += varint_size( run_length );
+
+	int size;
+	if ( !changed )
+	{
+		out[0] = HALO_UNCHANGED;
+		size = 1;
+	}
+	else if ( rle_size <= 1 + packed_size( width ) )
+	{
+		out[0] = HALO_RLE;
+		out[1] = row[0];
+		size = 2;
+		run_length = 1;
+		for ( int i = 1; i < width; ++i )
+		{
+			if ( row[i] != row[i - 1] )
+			{
+				size += put_varint( out + size, run_length );
+				run_length = 1;
+			}
+			else
+			{
+				run_length++;
+			}
+		}
+		size += put_varint( out + size, run_length );
+	}
+	else
+	{
+		out[0] = HALO_BITPACKED;
+		memset( out + 1, 0, packed_size( width ) );
+		for ( int i = 0; i < width; ++i )
+		{
+			if ( row[i] )
+				out[1 + i / 8] |= 1 << ( i % 8 );
+		}
+		size = 1 + packed_size( width );
+	}
+
+	memcpy( sent_row, row, width * sizeof( bool ) );
+	halo->have_sent[direction] = true;
+	halo->encodings_used[out[0]]++;
+	halo->bytes_sent += size;
+	halo->raw_bytes += width * sizeof( bool );
+	return size;
+}
+
+static void decode_row( AdaptiveHalo* halo, int direction,
+                        const unsigned char* in, int size, bool* row,
+                        int width )
+{
+	bool* ghost_row = halo->ghost_row[direction];
+
+	// Nothing arrives from past the edge of the game field, so the ghost row
+	// keeps its dead cells
+	if ( size == 0 )
+		return;
+
+	switch ( in[0] )
+	{
+	case HALO_UNCHANGED:
+		break;
+	case HALO_RLE:
+	{
+		bool alive = in[1];
+		int cell = 0, used = 2;
+		while ( cell < width )
+		{
+			int run_length;
+			used += get_varint( in + used, &run_length );
+			for ( int i = 0; i < run_length; ++i )
+				ghost_row[cell++] = alive;
+			alive = !alive;
+		}
+		break;
+	}
+	case HALO_BITPACKED:
+		for ( int i = 0; i < width; ++i )
+			ghost_row[i] = ( in[1 + i / 8] >> ( i % 8 ) ) & 1;
+		break;
+	}
+
+	// The boards get swapped every iteration, so the ghost row always has to
+	// be copied into whichever one is current
+	memcpy( row, ghost_row, width * sizeof( bool ) );
+}
+
+static void adaptive_init( Slab* slab )
+{
+	slab_alloc_boards( slab );
+
+	AdaptiveHalo* halo = calloc( 1, sizeof( AdaptiveHalo ) );
+	int row_cells = slab->halo_depth * slab->width;
+	halo->max_message = 1 + packed_size( row_cells );
+	for ( int direction = 0; direction < NUM_DIRECTIONS; ++direction )
+	{
+		halo->send_buffer[direction] = malloc( halo->max_message );
+		halo->recv_buffer[direction] = malloc( halo->max_message );
+		halo->sent_row[direction] = calloc( row_cells, sizeof( bool ) );
+		halo->ghost_row[direction] = calloc( row_cells, sizeof( bool ) );
+	}
+	slab->transport_data = halo;
+}
+
+static void adaptive_exchange( Slab* slab )
+{
+	AdaptiveHalo* halo = slab->transport_data;
+	int depth = slab->halo_depth;
+	int row_cells = depth * slab->width;
+	bool* board = slab->last_game_state;
+	bool* top_row = board + row_cells;
+	bool* bottom_row = board + slab->num_rows * slab->width;
+	MPI_Request requests[4];
+	MPI_Status statuses[4];
+	TraceMessage messages[4];
+
+	trace_begin( &messages[0], TRACE_RECEIVE, slab->up_rank );
+	MPI_Irecv( halo->recv_buffer[UP], halo->max_message, MPI_UNSIGNED_CHAR,
+	           slab->up_rank, HALO_DOWN, slab->comm, &requests[0] );
+	trace_begin( &messages[1], TRACE_RECEIVE, slab->down_rank );
+	MPI_Irecv( halo->recv_buffer[DOWN], halo->max_message, MPI_UNSIGNED_CHAR,
+	           slab->down_rank, HALO_UP, slab->comm, &requests[1] );
+
+	int up_size = 0, down_size = 0;
+	if ( slab->up_rank != MPI_PROC_NULL )
+		up_size =
+		  encode_row( halo, UP, top_row, row_cells, halo->send_buffer[UP] );
+	if ( slab->down_rank != MPI_PROC_NULL )
+		down_size = encode_row( halo, DOWN, bottom_row, row_cells,
+		                        halo->send_buffer[DOWN] );
+
+	trace_begin( &messages[2], TRACE_SEND, slab->up_rank );
+	MPI_Isend( halo->send_buffer[UP], up_size, MPI_UNSIGNED_CHAR, slab->up_rank,
+	           HALO_UP, slab->comm, &requests[2] );
+	trace_begin( &messages[3], TRACE_SEND, slab->down_rank );
+	MPI_Isend( halo->send_buffer[DOWN], down_size, MPI_UNSIGNED_CHAR,
+	           slab->down_rank, HALO_DOWN, slab->comm, &requests[3] );
+	trace_waitall( 4, requests, messages, statuses );
+
+	int received;
+	MPI_Get_count( &statuses[0], MPI_UNSIGNED_CHAR, &received );
+	decode_row( halo, UP, halo->recv_buffer[UP], received, board, row_cells );
+	MPI_Get_count( &statuses[1], MPI_UNSIGNED_CHAR, &received );
+	decode_row( halo, DOWN, halo->recv_buffer[DOWN], received,
+	            board + ( slab->num_rows + depth ) * slab->width, row_cells );
+}
+
+static void adaptive_finalize( Slab* slab )
+{
+	AdaptiveHalo* halo = slab->transport_data;
+	int world_rank;
+	MPI_Comm_rank( slab->comm, &world_rank );
+
+	long long totals[2 + NUM_HALO_ENCODINGS];
+	long long local[2 + NUM_HALO_ENCODINGS] = { halo->bytes_sent,
+	                                            halo->raw_bytes };
+	for ( int encoding = 0; encoding < NUM_HALO_ENCODINGS; ++encoding )
+		local[2 + encoding] = halo->encodings_used[encoding];
+	MPI_Reduce( local, totals, 2 + NUM_HALO_ENCODINGS, MPI_LONG_LONG, MPI_SUM, 0,
+	            slab->comm );
+
+	if ( world_rank == 0 && totals[1] > 0 && !slab->quiet )
+	{
+		printf( "Adaptive halo: %lld of %lld bytes sent (%.1f%%), "
+		        "%lld unchanged, %lld run-length, %lld bit-packed rows\n",
+		        totals[0], totals[1], 100.0 * totals[0] / totals[1],
+		        totals[2 + HALO_UNCHANGED], totals[2 + HALO_RLE],
+		        totals[2 + HALO_BITPACKED] );
+	}
+
+	for ( int direction = 0; direction < NUM_DIRECTIONS; ++direction )
+	{
+		free( halo->send_buffer[direction] );
+		free( halo->recv_buffer[direction] );
+		free( halo->sent_row[direction] );
+		free( halo->ghost_row[direction] );
+	}
+	free( halo );
+	slab_free_boards( slab );
+}
@@ -0,0 +1,162 @@
+/* File:    halo_persistent.c
+ *
+ * Purpose: A halo transport that sets the whole exchange up once. The
+ *          processors first describe who they talk to with
+ *          MPI_Dist_graph_create_adjacent, letting MPI reorder the ranks to
+ *          suit the machine, and then take the slab that goes with their rank
+ *          in the graph communicator, so that slabs next to each other land
+ *          on ranks MPI put next to each other. Then they create persistent
+ *          sends and receives for both boards with
+ *          MPI_Send_init/MPI_Recv_init. Every iteration after
+ *          that is just an MPI_Startall and an MPI_Waitall on the requests for
+ *          whichever board is current, so no matching or setup is repeated.
+ *
+ *          Persistent neighbourhood collectives (MPI_Neighbor_alltoallw_init)
+ *          would do the same job on the graph communicator, but they only
+ *          arrived in MPI 4.0 and the cluster's OpenMPI implements MPI 3.1.
+ */
+
+#include <stdlib.h>
+
+#include "life.h"
+
+enum PersistentBoard
+{
+	LAST_BOARD,
+	NEW_BOARD,
+	NUM_BOARDS,
+};
+
+typedef struct PersistentHalo
+{
+	MPI_Comm graph_comm;
+	// The slab's ranks once it has moved to graph_comm
+	LifeComm life_comm;
+	bool* board_start[NUM_BOARDS];
+	int num_requests;
+	MPI_Request requests[NUM_BOARDS][4];
+	// What each request is, for the timeline; the same for both boards
+	TraceMessage messages[4];
+	// The board whose requests have been started early, if any
+	bool* started;
+} PersistentHalo;
+
+static void persistent_init( Slab* slab );
+static void persistent_exchange( Slab* slab );
+static void persistent_finalize( Slab* slab );
+static void persistent_start( Slab* slab, bool* board );
+
+const HaloTransport persistent_halo_transport = {
+  "persistent", persistent_init, persistent_exchange, persistent_finalize,
+  persistent_start };
+
+static void persistent_init( Slab* slab )
+{
+	PersistentHalo* halo = calloc( 1, sizeof( PersistentHalo ) );
+	int width = slab->width;
+	int depth = slab->halo_depth;
+	int count = depth * width;
+
+	// The halo graph is a chain: everyone talks to the slab above and below,
+	// and every edge carries the same number of cells each way
+	int neighbours[2], num_neighbours = 0;
+	int weights[2] = { count, count };
+	if ( slab->up_rank != MPI_PROC_NULL )
+		neighbours[num_neighbours++] = slab->up_rank;
+	if ( slab->down_rank != MPI_PROC_NULL )
+		neighbours[num_neighbours++] = slab->down_rank;
+	MPI_Dist_graph_create_adjacent( slab->comm, num_neighbours, neighbours,
+	                                weights, num_neighbours, neighbours, weights,
+	                                MPI_INFO_NULL, 1, &halo->graph_comm );
+
+	// Whatever rank MPI gave us, the slab that goes with it is ours, and its
+	// neighbours are the ranks either side of it in the graph communicator
+	comm_from_mpi( &halo->life_comm, halo->graph_comm );
+	slab_renumber( slab, &halo->life_comm );
+
+	slab_alloc_boards( slab );
+	halo->board_start[LAST_BOARD] = slab->last_game_state;
+	halo->board_start[NEW_BOARD] = slab->new_game_state;
+
+	for ( int board = 0; board < slab->num_boards; ++board )
+	{
+		bool* start = halo->board_start[board];
+		MPI_Request* requests = halo->requests[board];
+		TraceMessage* messages = halo->messages;
+		int num_requests = 0;
+		if ( slab->up_rank != MPI_PROC_NULL )
+		{
+			trace_begin( &messages[num_requests], TRACE_RECEIVE,
+			             slab->up_rank );
+			MPI_Recv_init( start, count, MPI_C_BOOL, slab->up_rank, HALO_DOWN,
+			               halo->graph_comm, &requests[num_requests++] );
+			trace_begin( &messages[num_requests], TRACE_SEND, slab->up_rank );
+			MPI_Send_init( start + count, count, MPI_C_BOOL, slab->up_rank,
+			               HALO_UP, halo->graph_comm, &requests[num_requests++] );
+		}
+		if ( slab->down_rank != MPI_PROC_NULL )
+		{
+			trace_begin( &messages[num_requests], TRACE_RECEIVE,
+			             slab->down_rank );
+			MPI_Recv_init( start + ( slab->num_rows + depth ) * width, count,
+			               MPI_C_BOOL, slab->down_rank, HALO_UP, halo->graph_comm,
+			               &requests[num_requests++] );
+			trace_begin( &messages[num_requests], TRACE_SEND,
+			             slab->down_rank );
+			MPI_Send_init( start + slab->num_rows * width, count, MPI_C_BOOL,
+			               slab->down_rank, HALO_DOWN, halo->graph_comm,
+			               &requests[num_requests++] );
+		}
+		halo->num_requests = num_requests;
+	}
+
+	slab->transport_data = halo;
+}
+
+static int board_index( PersistentHalo* halo, bool* board )
+{
+	return board == halo->board_start[LAST_BOARD] ? LAST_BOARD : NEW_BOARD;
+}
+
+static void persistent_start( Slab* slab, bool* board )
+{
+	PersistentHalo* halo = slab->transport_data;
+	for ( int request = 0; request < halo->num_requests; ++request )
+	{
+		TraceMessage* message = &halo->messages[request];
+		trace_begin( message, message->kind, message->peer );
+	}
+	MPI_Startall( halo->num_requests,
+	              halo->requests[board_index( halo, board )] );
+	halo->started = board;
+}
+
+static void persistent_exchange( Slab* slab )
+{
+	PersistentHalo* halo = slab->transport_data;
+	if ( halo->started != slab->last_game_state )
+		persistent_start( slab, slab->last_game_state );
+	trace_waitall( halo->num_requests,
+	               halo->requests[board_index( halo, slab->last_game_state )],
+	               halo->messages, MPI_STATUSES_IGNORE );
+	halo->started = NULL;
+}
+
+static void persistent_finalize( Slab* slab )
+{
+	PersistentHalo* halo = slab->transport_data;
+	if ( halo->started != NULL )
+	{
+		MPI_Waitall( halo->num_requests,
+		             halo->requests[board_index( halo, halo->started )],
+		             MPI_STATUSES_IGNORE );
+	}
+	for ( int board = 0; board < slab->num_boards; ++board )
+	{
+		for ( int request = 0; request < halo->num_requests; ++request )
+			MPI_Request_free( &halo->requests[board][request] );
+	}
+	MPI_Comm_free( &halo->graph_comm );
+	free( halo );
+	slab_free_boards( slab );
+}
@@ -0,0 +1,305 @@
+/* File:    halo_rma.c
+ *
+ * Purpose: A halo transport built on one-sided MPI instead of messages.
+ *
+ *          Processors on the same computer allocate their slabs out of one
+ *          MPI_Win_allocate_shared window. Shared windows are contiguous by
+ *          default, so if the processor above us is on the same computer its
+ *          bottom row already sits right before our top row in memory, and it
+ *          simply *is* our ghost row -- nothing gets copied at all. Only
+ *          processors whose neighbour lives on another computer (or at the
+ *          edge of the game field) keep a ghost row of their own.
+ *
+ *          Neighbours on other computers MPI_Put their boundary row straight
+ *          into that ghost row, synchronised with post/start/complete/wait
+ *          (PSCW) between just the two of them.
+ *
+ *          Since the ghost rows are our neighbours' own rows, we must never
+ *          write to them, which rules out playing more than one generation per
+ *          exchange (halo depths above one).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "life.h"
+
+enum RmaBoard
+{
+	LAST_BOARD,
+	NEW_BOARD,
+	NUM_BOARDS,
+};
+
+typedef struct RmaHalo
+{
+	MPI_Comm node_comm;
+	// Whether the neighbour shares our window and sits right next to us in it
+	bool up_shared;
+	bool down_shared;
+	// Where each board's segment starts, where the board itself starts (which
+	// may be inside our up neighbour's segment) and the windows exposing the
+	// segment to the computer (shared) and to everyone else (remote)
+	bool* segment[NUM_BOARDS];
+	bool* board_start[NUM_BOARDS];
+	MPI_Win shared_win[NUM_BOARDS];
+	MPI_Win remote_win[NUM_BOARDS];
+	// Neighbours on other computers that we put rows into (and that put rows
+	// into us), and where their ghost rows sit in their segments
+	MPI_Group remote_group;
+	int num_remote;
+	MPI_Aint up_target;
+	MPI_Aint down_target;
+} RmaHalo;
+
+static void rma_init( Slab* slab );
+static void rma_exchange( Slab* slab );
+static void rma_finalize( Slab* slab );
+
+const HaloTransport rma_halo_transport = {
+  "rma", rma_init, rma_exchange, rma_finalize, NULL, 1, true };
+
+// Whether world rank neighbour is the processor right before/after us in the
+// shared window; direction is -1 for before and 1 for after
+static bool shares_window( MPI_Comm comm, MPI_Comm node_comm, int neighbour,
+                           int direction )
+{
+	if ( neighbour == MPI_PROC_NULL )
+		return false;
+
+	MPI_Group world_group, node_group;
+	int node_rank, node_neighbour;
+	MPI_Comm_group( comm, &world_group );
+	MPI_Comm_group( node_comm, &node_group );
+	MPI_Group_translate_ranks( world_group, 1, &neighbour, node_group,
+	                           &node_neighbour );
+	MPI_Comm_rank( node_comm, &node_rank );
+	MPI_Group_free( &world_group );
+	MPI_Group_free( &node_group );
+
+	return node_neighbour != MPI_UNDEFINED &&
+	       node_neighbour == node_rank + direction;
+}
+
+static void rma_init( Slab* slab )
+{
+	RmaHalo* halo = calloc( 1, sizeof( RmaHalo ) );
+	int width = slab->width;
+	int rank;
+	MPI_Comm_rank( slab->comm, &rank );
+
+	if ( slab->halo_depth != 1 )
+	{
+		if ( rank == 0 )
+			fprintf( stderr, "The rma halo transport only supports -d 1\n" );
+		MPI_Abort( slab->comm, 1 );
+	}
+
+	// Our neighbours read our boundary rows in place while we play, which
+	// only works if the new generation goes to the other board
+	if ( slab->num_boards != NUM_BOARDS )
+	{
+		if ( rank == 0 )
+			fprintf( stderr, "The rma halo transport needs two boards\n" );
+		MPI_Abort( slab->comm, 1 );
+	}
+
+	// Keying on our rank keeps the shared window in slab order
+	MPI_Comm_split_type( slab->comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
+	                     &halo->node_comm );
+	halo->up_shared =
+	  shares_window( slab->comm, halo->node_comm, slab->up_rank, -1 );
+	halo->down_shared =
+	  shares_window( slab->comm, halo->node_comm, slab->down_rank, 1 );
+
+	// Our segment is the owned rows plus whichever ghost rows nobody else
+	// provides
+	int top_ghost = halo->up_shared ? 0 : 1;
+	int bottom_ghost = halo->down_shared ? 0 : 1;
+	MPI_Aint segment_cells =
+	  (MPI_Aint)( top_ghost + slab->num_rows + bottom_ghost ) * width;
+
+	for ( int board = 0; board < NUM_BOARDS; ++board )
+	{
+		MPI_Win_allocate_shared( segment_cells * sizeof( bool ), sizeof( bool ),
+		                         MPI_INFO_NULL, halo->node_comm,
+		                         &halo->segment[board], &halo->shared_win[board] );
+		halo->board_start[board] =
+		  halo->segment[board] - ( top_ghost ? 0 : width );
+
+		// Only our own ghost rows get cleared here -- a ghost row that is
+		// really our neighbour's boundary row is theirs to touch
+		if ( top_ghost )
+			memset( halo->segment[board], 0, width * sizeof( bool ) );
+		if ( bottom_ghost )
+		{
+			memset( halo->board_start[board] + ( slab->num_rows + 1 ) * width, 0,
+			        width * sizeof( bool ) );
+		}
+		slab_first_touch( slab, halo->board_start[board] );
+
+		// Reading the row above us in place only works if the window really is
+		// contiguous, which MPI promises unless told otherwise
+		if ( halo->up_shared )
+		{
+			MPI_Aint up_size;
+			int disp_unit;
+			bool* up_segment;
+			int node_rank;
+			MPI_Comm_rank( halo->node_comm, &node_rank );
+			MPI_Win_shared_query( halo->shared_win[board], node_rank - 1, &up_size,
+			                      &disp_unit, &up_segment );
+			if ( up_segment + up_size != halo->segment[board] )
+			{
+				fprintf( stderr, "Shared halo window is not contiguous\n" );
+				MPI_Abort( slab->comm, 1 );
+			}
+		}
+
+		// Shared neighbours read our rows whenever they like, so keep a
+		// passive epoch open for the whole game and use MPI_Win_sync to make
+		// the writes visible
+		MPI_Win_lock_all( MPI_MODE_NOCHECK, halo->shared_win[board] );
+	}
+
+	// Creating the remote windows is collective, so either everyone makes them
+	// or, when every processor fits on one computer, nobody has to
+	int any_remote;
+	int has_remote = ( !halo->up_shared && slab->up_rank != MPI_PROC_NULL ) ||
+	                 ( !halo->down_shared && slab->down_rank != MPI_PROC_NULL );
+	MPI_Allreduce( &has_remote, &any_remote, 1, MPI_INT, MPI_LOR, slab->comm );
+	for ( int board = 0; board < NUM_BOARDS; ++board )
+	{
+		halo->remote_win[board] = MPI_WIN_NULL;
+		if ( any_remote )
+		{
+			MPI_Win_create( halo->segment[board], segment_cells * sizeof( bool ),
+			                sizeof( bool ), MPI_INFO_NULL, slab->comm,
+			                &halo->remote_win[board] );
+		}
+	}
+
+	slab->last_game_state = halo->board_start[LAST_BOARD];
+	slab->new_game_state = halo->board_start[NEW_BOARD];
+
+	// Tell each remote neighbour where in our segment to put its row; it is
+	// the same offset in both boards
+	int remote_ranks[2];
+	MPI_Aint my_top = 0;
+	MPI_Aint my_bottom = (MPI_Aint)( top_ghost + slab->num_rows ) * width;
+	int up_remote = halo->up_shared ? MPI_PROC_NULL : slab->up_rank;
+	int down_remote = halo->down_shared ? MPI_PROC_NULL : slab->down_rank;
+	MPI_Sendrecv( &my_top, 1, MPI_AINT, up_remote, HALO_UP, &halo->down_target,
+	              1, MPI_AINT, down_remote, HALO_UP, slab->comm,
+	              MPI_STATUS_IGNORE );
+	MPI_Sendrecv( &my_bottom, 1, MPI_AINT, down_remote, HALO_DOWN,
+	              &halo->up_target, 1, MPI_AINT, up_remote, HALO_DOWN,
+	              slab->comm, MPI_STATUS_IGNORE );
+
+	if ( up_remote != MPI_PROC_NULL )
+		remote_ranks[halo->num_remote++] = up_remote;
+	if ( down_remote != MPI_PROC_NULL )
+		remote_ranks[halo->num_remote++] = down_remote;
+	MPI_Group world_group;
+	MPI_Comm_group( slab->comm, &world_group );
+	MPI_Group_incl( world_group, halo->num_remote, remote_ranks,
+	                &halo->remote_group );
+	MPI_Group_free( &world_group );
+
+	slab->transport_data = halo;
+}
+
+// Zero byte messages are enough to tell a shared neighbour we are done with a
+// generation, and that we saw it finish its own
+static void sync_shared_neighbours( Slab* slab, RmaHalo* halo )
+{
+	MPI_Request requests[4];
+	TraceMessage messages[4];
+	int num_requests = 0;
+	char token = 0;
+	if ( halo->up_shared )
+	{
+		trace_begin( &messages[num_requests], TRACE_RECEIVE, slab->up_rank );
+		MPI_Irecv( NULL, 0, MPI_CHAR, slab->up_rank, HALO_DOWN, slab->comm,
+		           &requests[num_requests++] );
+		trace_begin( &messages[num_requests], TRACE_SEND, slab->up_rank );
+		MPI_Isend( &token, 0, MPI_CHAR, slab->up_rank, HALO_UP, slab->comm,
+		           &requests[num_requests++] );
+	}
+	if ( halo->down_shared )
+	{
+		trace_begin( &messages[num_requests], TRACE_RECEIVE, slab->down_rank );
+		MPI_Irecv( NULL, 0, MPI_CHAR, slab->down_rank, HALO_UP, slab->comm,
+		           &requests[num_requests++] );
+		trace_begin( &messages[num_requests], TRACE_SEND, slab->down_rank );
+		MPI_Isend( &token, 0, MPI_CHAR, slab->down_rank, HALO_DOWN, slab->comm,
+		           &requests[num_requests++] );
+	}
+	trace_waitall( num_requests, requests, messages, MPI_STATUSES_IGNORE );
+}
+
+static void rma_exchange( Slab* slab )
+{
+	RmaHalo* halo = slab->transport_data;
+	int width = slab->width;
+	int board = slab->last_game_state == halo->board_start[LAST_BOARD]
+	              ? LAST_BOARD
+	              : NEW_BOARD;
+
+	// On the computer: once our neighbours have finished the last generation
+	// their rows are our ghost rows, and they have also stopped reading the
+	// board we are about to overwrite
+	MPI_Win_sync( halo->shared_win[board] );
+	sync_shared_neighbours( slab, halo );
+	MPI_Win_sync( halo->shared_win[board] );
+
+	// Off the computer: put our boundary rows into their ghost rows. On the
+	// timeline a put is a send from the start of the access epoch to its
+	// end, and a row put into us a receive over our exposure epoch.
+	if ( halo->num_remote > 0 )
+	{
+		MPI_Win win = halo->remote_win[board];
+		int up_remote = halo->up_shared ? MPI_PROC_NULL : slab->up_rank;
+		int down_remote = halo->down_shared ? MPI_PROC_NULL : slab->down_rank;
+		double posted = MPI_Wtime();
+		MPI_Win_post( halo->remote_group, 0, win );
+		double started = MPI_Wtime();
+		MPI_Win_start( halo->remote_group, 0, win );
+		if ( up_remote != MPI_PROC_NULL )
+		{
+			MPI_Put( slab->last_game_state + width, width, MPI_C_BOOL,
+			         up_remote, halo->up_target, width, MPI_C_BOOL, win );
+		}
+		if ( down_remote != MPI_PROC_NULL )
+		{
+			MPI_Put( slab->last_game_state + slab->num_rows * width, width,
+			         MPI_C_BOOL, down_remote, halo->down_target, width,
+			         MPI_C_BOOL, win );
+		}
+		MPI_Win_complete( win );
+		if ( up_remote != MPI_PROC_NULL )
+			trace_event( TRACE_SEND, started, up_remote );
+		if ( down_remote != MPI_PROC_NULL )
+			trace_event( TRACE_SEND, started, down_remote );
+		MPI_Win_wait( win );
+		if ( up_remote != MPI_PROC_NULL )
+			trace_event( TRACE_RECEIVE, posted, up_remote );
+		if ( down_remote != MPI_PROC_NULL )
+			trace_event( TRACE_RECEIVE, posted, down_remote );
+	}
+}
+
+static void rma_finalize( Slab* slab )
+{
+	RmaHalo* halo = slab->transport_data;
+	for ( int board = 0; board < NUM_BOARDS; ++board )
+	{
+		MPI_Win_unlock_all( halo->shared_win[board] );
+		if ( halo->remote_win[board] != MPI_WIN_NULL )
+			MPI_Win_free( &halo->remote_win[board] );
+		MPI_Win_free( &halo->shared_win[board] );
+	}
+	MPI_Group_free( &halo->remote_group );
+	MPI_Comm_free( &halo->node_comm );
+	free( halo );
+}
@@ -0,0 +1,118 @@
+/* File:    inplace.c
+ *
+ * Purpose: The "inplace" kernel, which plays the halo game on a single board
+ *          instead of two, so a slab takes half the memory and boards can be
+ *          twice as big before they run out of it. Each row is overwritten
+ *          with its next generation as soon as it has been played, and the
+ *          only old state kept around is a rolling window of two rows: a
+ *          copy of the row being played, and of the row above it, which has
+ *          already been overwritten by the time the row below it needs it.
+ *
+ *          Every thread plays its own band of rows from the top down. The
+ *          row above a band and the row below it belong to the neighbouring
+ *          threads' bands, so those two rows are copied before anyone starts
+ *          writing.
+ *
+ *          Only the halo game gets to use a single board; the original game
+ *          sends the new board while keeping the old one, so there it simply
+ *          plays like the static kernel.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "life.h"
+
+typedef struct InPlaceTask
+{
+	LifeStep* step;
+	bool* board;
+	ProcInfo rows;
+	// Three rows per thread: the rows above and below its band, and a spare
+	// for the window (which starts out with the row above the band)
+	bool* saved_rows;
+	// Stays all dead, for past the top and bottom of the board
+	bool* dead_row;
+} InPlaceTask;
+
+static void inplace_apply( LifeStep* step );
+static void inplace_advance( LifeStep* step, int generations );
+
+const LifeKernel inplace_kernel = { "inplace", inplace_apply, NULL,
+                                    inplace_advance, true };
+
+static void inplace_apply( LifeStep* step )
+{
+	static_kernel.apply( step );
+}
+
+static bool* thread_rows( InPlaceTask* task, int thread )
+{
+	return task->saved_rows + (size_t)thread * 3 * task->step->width;
+}
+
+static void save_edges_task( int thread, int num_threads, void* arg )
+{
+	InPlaceTask* task = arg;
+	int width = task->step->width;
+	ProcInfo band = split_cells( &task->rows, thread, num_threads );
+	bool* saved = thread_rows( task, thread );
+
+	int above = band.offset - 1;
+	int below = band.offset + band.num_cells;
+	memcpy( saved, above < 0 ? task->dead_row : task->board + above * width,
+	        width * sizeof( bool ) );
+	memcpy( saved + width,
+	        below >= task->step->height ? task->dead_row
+	                                    : task->board + below * width,
+	        width * sizeof( bool ) );
+}
+
+static void play_band_task( int thread, int num_threads, void* arg )
+{
+	InPlaceTask* task = arg;
+	int width = task->step->width;
+	ProcInfo band = split_cells( &task->rows, thread, num_threads );
+	bool* saved = thread_rows( task, thread );
+	bool* below_band = saved + width;
+	bool* above = saved;
+	bool* row = saved + 2 * width;
+
+	int end_row = band.offset + band.num_cells;
+	for ( int r = band.offset; r < end_row; ++r )
+	{
+		bool* board_row = task->board + r * width;
+		bool* below = r + 1 == end_row ? below_band : board_row + width;
+		memcpy( row, board_row, width * sizeof( bool ) );
+		apply_rules_to_row( above, row, below, board_row, width );
+
+		// The row we just played is the old row above the next one
+		bool* temp_row = above;
+		above = row;
+		row = temp_row;
+	}
+}
+
+// The cells of a round are always whole rows
+static void inplace_advance( LifeStep* step, int generations )
+{
+	int width = step->width;
+	int num_threads = worker_pool_size( step->pool );
+
+	InPlaceTask task;
+	task.step = step;
+	task.board = step->last_game_state;
+	task.rows.offset = step->cells.offset / width;
+	task.rows.num_cells = step->cells.num_cells / width;
+	task.saved_rows = malloc( (size_t)num_threads * 3 * width * sizeof( bool ) );
+	task.dead_row = calloc( width, sizeof( bool ) );
+
+	for ( int generation = 0; generation < generations; ++generation )
+	{
+		worker_pool_run( step->pool, save_edges_task, &task );
+		worker_pool_run( step->pool, play_band_task, &task );
+	}
+
+	free( task.saved_rows );
+	free( task.dead_row );
+}
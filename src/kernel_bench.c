@@ -0,0 +1,497 @@
+/* File:    kernel_bench.c
+ *
+ * Compile: make kernel_bench
+ * Run:     mpiexec -n 1 ./kernel_bench [-t threads] [-g tile_size] [-r runs]
+ *                                        [-k kernel] [-z sizes] [-s seed]
+ * Input:   -t splits the board between that many threads
+ *          -g is the tile size for the kernels that work in tiles
+ *          -r is how many timed runs every kernel gets on every board (5 by
+ *             default)
+ *          -k only plays the named kernel instead of all of them
+ *          -z only plays the first this many board sizes (of 7)
+ *          -s seeds the random boards
+ * Output:  For every board size, board and kernel, whether the kernel gave
+ *          the same board as the reference, whether its boundary rows were
+ *          done when it said so, and how many cells per second it updated
+ *          (mean and standard deviation over the runs)
+ *
+ * Purpose: Checks every kernel against apply_rules and times it, on the same
+ *          boards for all of them, so a new kernel can be compared with the
+ *          old ones and caught if it gets any cell wrong. The boards are
+ *          random soups of a few densities, a field of still lifes (which
+ *          should never change), a field of glider guns, and boards that are
+ *          all dead and all alive. Each is played at seven sizes: three small
+ *          odd shapes (odd, not a multiple of 8 and not square, to catch the
+ *          edges of tiles and bit-packed words), two boards filling half of
+ *          the L1, L2 and L3 caches, and two boards twice the size of the L3
+ *          cache, so they have to come from memory.
+ *
+ *          The boards are laid out like a slab of the halo game on one
+ *          processor, with dead ghost rows above and below, and the kernels
+ *          play DEPTH generations a round the way the halo game does with
+ *          -d. The reference plays one generation at a time on one thread.
+ *          Every run is checked against it bit for bit. After the timed runs
+ *          every kernel also plays a few rounds of one generation with a
+ *          boundary_done callback, as the halo game does when it starts the
+ *          exchange early, which checks that the first and last DEPTH rows
+ *          already match the reference whenever it is called.
+ */
+
+#include <math.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "life.h"
+
+// Generations per round, and so the ghost rows above and below the board
+#define DEPTH 8
+// Roughly how many cell updates a run makes, so small boards play longer
+#define UPDATES_PER_RUN ( 1 << 22 )
+#define NUM_SIZES 7
+#define NUM_BOARDS 7
+// One-generation rounds played with boundary_done checked
+#define BOUNDARY_ROUNDS 4
+
+typedef enum BoardKind
+{
+	SOUP,
+	STILL_LIFES,
+	GLIDER_GUNS,
+	ALL_DEAD,
+	ALL_ALIVE
+} BoardKind;
+
+typedef struct BenchBoard
+{
+	const char* name;
+	BoardKind kind;
+	// Percent alive, for the soups
+	int density;
+} BenchBoard;
+
+static const BenchBoard boards[NUM_BOARDS] = {
+  { "soup 10%", SOUP, 10 },         { "soup 30%", SOUP, 30 },
+  { "soup 50%", SOUP, 50 },         { "still lifes", STILL_LIFES, 0 },
+  { "glider guns", GLIDER_GUNS, 0 }, { "all dead", ALL_DEAD, 0 },
+  { "all alive", ALL_ALIVE, 0 } };
+
+// Block, beehive, loaf and boat, each stamped into an 8 x 8 square so they
+// never touch
+static const char* still_lifes[][4] = { { "OO", "OO", "", "" },
+                                        { ".OO.", "O..O", ".OO.", "" },
+                                        { ".OO.", "O..O", ".O.O", "..O." },
+                                        { "OO.", "O.O", ".O.", "" } };
+#define STILL_LIFE_EDGE 8
+
+// Gosper's glider gun, one to every 64 x 32 cells
+static const char* glider_gun[] = {
+  "........................O...........",
+  "......................O.O...........",
+  "............OO......OO............OO",
+  "...........O...O....OO............OO",
+  "OO........O.....O...OO..............",
+  "OO........O...O.OO....O.O...........",
+  "..........O.....O.......O...........",
+  "...........O...O....................",
+  "............OO......................" };
+#define GUN_WIDTH 64
+#define GUN_HEIGHT 32
+
+typedef struct BenchSize
+{
+	const char* name;
+	int width;
+	int height;
+} BenchSize;
+
+typedef struct BenchOptions
+{
+	int threads;
+	int tile_size;
+	int runs;
+	const char* kernel;
+	int num_sizes;
+	long seed;
+} BenchOptions;
+
+// What boundary_done checks the kernel's boundary rows against
+typedef struct BoundaryCheck
+{
+	LifeStep* step;
+	bool in_place;
+	// The reference board of the generation being played
+	const bool* reference;
+	int calls;
+	bool wrong;
+} BoundaryCheck;
+
+void read_args_bench( int argc, char* argv[], BenchOptions* options );
+
+// Stamps a pattern of rows ('O' alive) onto the board at row, col, if it fits
+static void stamp( bool* board, int width, int height, int row, int col,
+                   const char* const* pattern, int pattern_rows )
+{
+	for ( int r = 0; r < pattern_rows; ++r )
+	{
+		int length = strlen( pattern[r] );
+		if ( row + r >= height || col + length > width )
+			return;
+		for ( int c = 0; c < length; ++c )
+			board[( row + r ) * width + col + c] = pattern[r][c] == 'O';
+	}
+}
+
+static void fill_board( bool* board, const BenchBoard* kind, int width,
+                        int height, long seed )
+{
+	memset( board, kind->kind == ALL_ALIVE, (size_t)width * height );
+	switch ( kind->kind )
+	{
+	case SOUP:
+		fill_game_field( board, width, height,
+		                 (long long)width * height * kind->density / 100, seed );
+		break;
+	case STILL_LIFES:
+		for ( int row = 0; row + STILL_LIFE_EDGE <= height;
+		      row += STILL_LIFE_EDGE )
+		{
+			for ( int col = 0; col + STILL_LIFE_EDGE <= width;
+			      col += STILL_LIFE_EDGE )
+			{
+				int which = ( row / STILL_LIFE_EDGE + col / STILL_LIFE_EDGE ) % 4;
+				stamp( board, width, height, row + 1, col + 1, still_lifes[which],
+				       4 );
+			}
+		}
+		break;
+	case GLIDER_GUNS:
+		for ( int row = 0; row < height; row += GUN_HEIGHT )
+		{
+			for ( int col = 0; col < width; col += GUN_WIDTH )
+				stamp( board, width, height, row + 1, col + 1, glider_gun, 9 );
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+// Square boards, two of which take up bytes, in whole tiles of the packed
+// kernel
+static BenchSize size_for( const char* name, long bytes )
+{
+	int edge = (int)sqrt( bytes / 2.0 ) / 8 * 8;
+	if ( edge < 16 )
+		edge = 16;
+	BenchSize size = { name, edge, edge };
+	return size;
+}
+
+static long cache_size( int name, long fallback )
+{
+	long bytes = sysconf( name );
+	return bytes > 0 ? bytes : fallback;
+}
+
+// Plays generations with the kernel, a round of DEPTH at a time; returns the
+// board the last one ended up in
+static bool* play( const LifeKernel* kernel, LifeStep* step, int generations )
+{
+	for ( int played = 0; played < generations; played += DEPTH )
+	{
+		int round = generations - played < DEPTH ? generations - played : DEPTH;
+		advance_generations( kernel, step, round );
+	}
+	return step->last_game_state;
+}
+
+static bool* play_reference( LifeStep* step, int generations )
+{
+	for ( int generation = 0; generation < generations; ++generation )
+	{
+		apply_rules( &step->cells, step->last_game_state, step->new_game_state, 0,
+		             step->adjacency_offsets, step->width, step->height );
+		bool* temp_game_state = step->last_game_state;
+		step->last_game_state = step->new_game_state;
+		step->new_game_state = temp_game_state;
+	}
+	return step->last_game_state;
+}
+
+// The kernel says the first and last boundary_rows rows of the cells are
+// done, so they have to match the reference already
+static void check_boundary( void* arg )
+{
+	BoundaryCheck* check = arg;
+	LifeStep* step = check->step;
+	const bool* board =
+	  check->in_place ? step->last_game_state : step->new_game_state;
+	int rows = step->boundary_rows * step->width;
+	if ( rows > step->cells.num_cells )
+		rows = step->cells.num_cells;
+	int first = step->cells.offset;
+	int last = step->cells.offset + step->cells.num_cells - rows;
+	if ( memcmp( board + first, check->reference + first, rows ) != 0 ||
+	     memcmp( board + last, check->reference + last, rows ) != 0 )
+		check->wrong = true;
+	check->calls++;
+}
+
+// Index of the first cell the boards disagree on, or -1
+static long long first_difference( const bool* board, const bool* reference,
+                                   long long num_cells )
+{
+	if ( memcmp( board, reference, num_cells ) == 0 )
+		return -1;
+	long long cell = 0;
+	while ( board[cell] == reference[cell] )
+		++cell;
+	return cell;
+}
+
+// Plays BOUNDARY_ROUNDS rounds of one generation from initial with
+// boundary_done checking the boundary rows, and the whole board checked after
+// each round. Returns "ok", "WRONG", or "unused" if the kernel never called
+// boundary_done (the halo game then just starts the exchange later).
+static const char* check_boundary_rounds( const LifeKernel* kernel,
+                                          LifeStep* step, const bool* initial,
+                                          bool* game_boards[2],
+                                          bool* reference_boards[2] )
+{
+	size_t first = (size_t)DEPTH * step->width;
+	long long num_cells = step->cells.num_cells;
+	LifeStep reference = *step;
+	memcpy( reference_boards[0] + first, initial, num_cells );
+	memcpy( game_boards[0] + first, initial, num_cells );
+	reference.last_game_state = reference_boards[0];
+	reference.new_game_state = reference_boards[1];
+	step->last_game_state = game_boards[0];
+	step->new_game_state = game_boards[1];
+
+	BoundaryCheck check = { step, kernel->in_place, NULL, 0, false };
+	step->boundary_done = check_boundary;
+	step->boundary_arg = &check;
+	step->boundary_rows = DEPTH;
+	for ( int round = 0; round < BOUNDARY_ROUNDS; ++round )
+	{
+		check.reference = play_reference( &reference, 1 );
+		bool* result = play( kernel, step, 1 );
+		if ( first_difference( result + first, check.reference + first,
+		                       num_cells ) >= 0 )
+			check.wrong = true;
+	}
+	step->boundary_done = NULL;
+
+	if ( check.wrong || check.calls > BOUNDARY_ROUNDS )
+		return "WRONG";
+	return check.calls == 0 ? "unused" : "ok";
+}
+
+// Plays every board at one size; returns how many kernels got one wrong
+static int bench_size( BenchSize* size, BenchOptions* options,
+                       WorkerPool* pool )
+{
+	int width = size->width, height = size->height;
+	long long num_cells = (long long)width * height;
+	int generations = UPDATES_PER_RUN / num_cells;
+	if ( generations < 1 )
+		generations = 1;
+	printf( "%s: %d x %d (%.0f KiB for two boards), %d generations per run\n",
+	        size->name, width, height, 2.0 * num_cells / 1024, generations );
+	printf( "  %-12s %-10s %-5s %-8s %16s %10s %7s\n", "board", "kernel",
+	        "check", "boundary", "cells/s (mean)", "sd", "cv" );
+
+	// Dead ghost rows above and below, which are never written
+	size_t padded_cells = (size_t)width * ( height + 2 * DEPTH );
+	bool* initial = malloc( num_cells );
+	bool* reference_boards[2] = { calloc( padded_cells, 1 ),
+	                              calloc( padded_cells, 1 ) };
+	bool* game_boards[2] = { calloc( padded_cells, 1 ),
+	                         calloc( padded_cells, 1 ) };
+	// The reference again, one generation at a time for the boundary check
+	bool* boundary_boards[2] = { calloc( padded_cells, 1 ),
+	                             calloc( padded_cells, 1 ) };
+	double* rates = malloc( options->runs * sizeof( double ) );
+	int adjacency_offsets[] = {
+	  -( width + 1 ), -width, -( width - 1 ), -1, 1,
+	  width - 1,      width,  width + 1 };
+	ProcInfo owned = { DEPTH * width, num_cells };
+	size_t first = (size_t)DEPTH * width;
+
+	int mismatches = 0;
+	for ( int b = 0; b < NUM_BOARDS; ++b )
+	{
+		fill_board( initial, &boards[b], width, height, options->seed );
+
+		LifeStep step = { owned,     NULL,   NULL, adjacency_offsets,
+		                  width,     height + 2 * DEPTH, pool,
+		                  options->tile_size, NULL, NULL };
+		memcpy( reference_boards[0] + first, initial, num_cells );
+		step.last_game_state = reference_boards[0];
+		step.new_game_state = reference_boards[1];
+		double started = MPI_Wtime();
+		bool* reference = play_reference( &step, generations ) + first;
+		double seconds = MPI_Wtime() - started;
+		printf( "  %-12s %-10s %-5s %-8s %16.4g\n", boards[b].name,
+		        "reference", "", "", num_cells * generations / seconds );
+
+		for ( int k = 0; k < num_kernels(); ++k )
+		{
+			const LifeKernel* kernel = get_kernel( k );
+			if ( options->kernel != NULL &&
+			     strcmp( kernel->name, options->kernel ) != 0 )
+				continue;
+
+			long long wrong_cell = -1;
+			double mean = 0;
+			for ( int run = 0; run < options->runs; ++run )
+			{
+				memcpy( game_boards[0] + first, initial, num_cells );
+				step.last_game_state = game_boards[0];
+				step.new_game_state = game_boards[1];
+				started = MPI_Wtime();
+				bool* result = play( kernel, &step, generations ) + first;
+				seconds = MPI_Wtime() - started;
+				rates[run] = num_cells * generations / seconds;
+				mean += rates[run] / options->runs;
+				if ( wrong_cell < 0 )
+					wrong_cell = first_difference( result, reference, num_cells );
+			}
+
+			const char* boundary = check_boundary_rounds(
+			  kernel, &step, initial, game_boards, boundary_boards );
+
+			double variance = 0;
+			for ( int run = 0; run < options->runs; ++run )
+				variance += ( rates[run] - mean ) * ( rates[run] - mean );
+			double deviation =
+			  options->runs > 1 ? sqrt( variance / ( options->runs - 1 ) ) : 0;
+			printf( "  %-12s %-10s %-5s %-8s %16.4g %10.3g %6.1f%%\n",
+			        boards[b].name, kernel->name, wrong_cell < 0 ? "ok" : "WRONG",
+			        boundary, mean, deviation, 100 * deviation / mean );
+			if ( wrong_cell >= 0 )
+			{
+				printf( "    first wrong cell at row %lld, column %lld\n",
+				        wrong_cell / width, wrong_cell % width );
+				++mismatches;
+			}
+			if ( strcmp( boundary, "WRONG" ) == 0 )
+				++mismatches;
+			fflush( stdout );
+		}
+	}
+
+	free( rates );
+	free( initial );
+	for ( int i = 0; i < 2; ++i )
+	{
+		free( reference_boards[i] );
+		free( game_boards[i] );
+		free( boundary_boards[i] );
+	}
+	return mismatches;
+}
+
+int main( int argc, char* argv[] )
+{
+	int thread_support;
+	MPI_Init_thread( &argc, &argv, MPI_THREAD_FUNNELED, &thread_support );
+
+	BenchOptions options;
+	read_args_bench( argc, argv, &options );
+	WorkerPool* pool =
+	  options.threads > 1 ? worker_pool_create( options.threads ) : NULL;
+
+	// The odd shapes come first, as they take no time at all
+	long l3 = cache_size( _SC_LEVEL3_CACHE_SIZE, 32L << 20 );
+	BenchSize sizes[NUM_SIZES] = {
+	  { "odd", 37, 23 },
+	  { "tall", 13, 101 },
+	  { "wide", 203, 11 },
+	  size_for( "L1", cache_size( _SC_LEVEL1_DCACHE_SIZE, 32L << 10 ) / 2 ),
+	  size_for( "L2", cache_size( _SC_LEVEL2_CACHE_SIZE, 1L << 20 ) / 2 ),
+	  size_for( "L3", l3 / 2 ), size_for( "DRAM", 2 * l3 ) };
+
+	printf( "Kernel benchmark: %d threads, tile size %d, %d runs, seed %ld\n",
+	        options.threads, options.tile_size, options.runs, options.seed );
+	int mismatches = 0;
+	for ( int s = 0; s < options.num_sizes; ++s )
+		mismatches += bench_size( &sizes[s], &options, pool );
+	if ( mismatches == 0 )
+		printf( "Every kernel matched the reference\n" );
+	else
+		printf( "%d kernel runs did not match the reference\n", mismatches );
+
+	worker_pool_destroy( pool );
+	MPI_Finalize();
+	return mismatches == 0 ? 0 : 1;
+}
+
+void read_args_bench( int argc, char* argv[], BenchOptions* options )
+{
+	options->threads = 1;
+	options->tile_size = 64;
+	options->runs = 5;
+	options->kernel = NULL;
+	options->num_sizes = NUM_SIZES;
+	options->seed = 1;
+
+	int world_size;
+	MPI_Comm_size( MPI_COMM_WORLD, &world_size );
+
+	int opt;
+	bool bad_option = world_size != 1;
+	while ( ( opt = getopt( argc, argv, "t:g:r:k:z:s:" ) ) != -1 )
+	{
+		switch ( opt )
+		{
+		case 't':
+			options->threads = strtol( optarg, NULL, 10 );
+			bad_option |= options->threads < 1;
+			break;
+		case 'g':
+			options->tile_size = strtol( optarg, NULL, 10 );
+			bad_option |= options->tile_size < 1;
+			break;
+		case 'r':
+			options->runs = strtol( optarg, NULL, 10 );
+			bad_option |= options->runs < 1;
+			break;
+		case 'k':
+			options->kernel = optarg;
+			bad_option |= find_kernel( optarg ) == NULL;
+			break;
+		case 'z':
+			options->num_sizes = strtol( optarg, NULL, 10 );
+			bad_option |=
+			  options->num_sizes < 1 || options->num_sizes > NUM_SIZES;
+			break;
+		case 's':
+			options->seed = strtol( optarg, NULL, 10 );
+			break;
+		default:
+			bad_option = true;
+			break;
+		}
+	}
+
+	if ( bad_option || optind != argc )
+	{
+		fprintf( stderr,
+		         "USAGE: mpiexec -n 1 ./%s [-t threads] [-g tile_size] [-r runs]\n"
+		         "\t[-k kernel] [-z sizes] [-s seed]\n"
+		         "\t-t is the number of threads\n"
+		         "\t-g is the tile size for tiled kernels\n"
+		         "\t-r is the number of timed runs of each kernel\n"
+		         "\t-k only plays this kernel (",
+		         argv[0] );
+		list_kernels( stderr );
+		fprintf( stderr, ")\n"
+		                 "\t-z only plays the first this many sizes (of 7)\n"
+		                 "\t-s seeds the random boards\n" );
+		MPI_Abort( MPI_COMM_WORLD, 1 );
+	}
+}
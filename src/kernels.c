@@ -0,0 +1,86 @@
+/* File:    kernels.c
+ *
+ * Purpose: The table of kernels that can apply the rules for a generation,
+ *          picked by name at run time with -k. Every kernel has to give the
+ *          exact same board as apply_rules; they only differ in how the work
+ *          is split up and scheduled.
+ */
+
+#include <string.h>
+
+#include "life.h"
+
+static void static_apply( LifeStep* step );
+
+// The default: every thread gets an equal, fixed share of the cells
+const LifeKernel static_kernel = { "static", static_apply, NULL };
+
+static const LifeKernel* const kernels[] = {
+  &static_kernel,
+  &steal_kernel,
+  &dataflow_kernel,
+  &skewed_kernel,
+  &packed_kernel,
+  &inplace_kernel,
+};
+
+#define NUM_KERNELS ( sizeof( kernels ) / sizeof( kernels[0] ) )
+
+const LifeKernel* find_kernel( const char* name )
+{
+	for ( size_t i = 0; i < NUM_KERNELS; ++i )
+	{
+		if ( strcmp( kernels[i]->name, name ) == 0 )
+			return kernels[i];
+	}
+	return NULL;
+}
+
+int num_kernels( void )
+{
+	return NUM_KERNELS;
+}
+
+const LifeKernel* get_kernel( int index )
+{
+	return kernels[index];
+}
+
+void list_kernels( FILE* stream )
+{
+	for ( size_t i = 0; i < NUM_KERNELS; ++i )
+		fprintf( stream, "%s%s", i == 0 ? "" : ", ", kernels[i]->name );
+}
+
+static void static_task( int thread, int num_threads, void* arg )
+{
+	LifeStep* step = arg;
+	ProcInfo share = split_cells( &step->cells, thread, num_threads );
+	apply_rules( &share, step->last_game_state, step->new_game_state, 0,
+	             step->adjacency_offsets, step->width, step->height );
+}
+
+static void static_apply( LifeStep* step )
+{
+	worker_pool_run( step->pool, static_task, step );
+	if ( step->boundary_done != NULL )
+		step->boundary_done( step->boundary_arg );
+}
+
+void advance_generations( const LifeKernel* kernel, LifeStep* step,
+                          int generations )
+{
+	if ( kernel->advance != NULL )
+	{
+		kernel->advance( step, generations );
+		return;
+	}
+
+	for ( int generation = 0; generation < generations; ++generation )
+	{
+		kernel->apply( step );
+		bool* temp_game_state = step->last_game_state;
+		step->last_game_state = step->new_game_state;
+		step->new_game_state = temp_game_state;
+	}
+}
@@ -1,13 +1,57 @@
 /* File:    life.c
  *
- * Compile: mpicc -g -Wall -o life life.c -lm
- * Run:     mpiexec -n p ./life i j k m n
+ * Compile: make life
+ * Run:     mpiexec -n p ./life [-x transport] [-s seed] [-t threads]
+ *                                 [-k kernel] [-g tile_size] [-d depth]
+ *                                 [-c] [-o file] [-u] [-e] [-b jobs]
+ *                                 [-l socket] [-p period] [-r rounds] [-m]
+ *                                 [-T file] [-S] [-A file] [-P] [-L ranks]
+ *                                 i j k m n
  * Input:   p is the number of computers/processors to use
  *          i is the number of live cells
  *          j is the number of iterations of the game of life
  *          k is how often to print the game state (eg every kth iteration)
  *          m is the game width
  *          n is the game height
+ *          -x plays the halo version of the game with the named transport
+ *             (see halo.c) instead of sending the whole board every iteration
+ *          -s seeds the random game field so runs can be repeated
+ *          -t splits each processor's part of the board between that many
+ *             threads (see threads.c)
+ *          -k picks the kernel that applies the rules (see kernels.c)
+ *          -g is the tile size for the kernels that work in tiles
+ *          -d is the number of ghost rows in the halo game, which is how
+ *             many generations get played between exchanges
+ *          -c counts the cycles, instructions, branch and cache misses of
+ *             the kernel (see counters.c)
+ *          -o plays the board kept in the file, streaming it through memory
+ *             instead of holding it there (see stream.c)
+ *          -u plays on a universe without edges (see unbounded.c)
+ *          -e plays 64 separate boards on every processor at once (see
+ *             ensemble.c)
+ *          -b plays every game listed in the jobs file, handing them out to
+ *             the processors, instead of i (see batch.c)
+ *          -l takes requests for games on the UNIX socket until told to
+ *             quit, instead of playing one (see server.c)
+ *          -p looks for the halo game repeating itself with a period up to
+ *             this long, and skips ahead once it does (see cycles.c)
+ *          -r is how many rounds go by between looking
+ *          -m times each phase of the game (see timers.c)
+ *          -T writes a timeline of the game to the file (see trace.c)
+ *          -S times the halo game (with -x's transport, or plain) on 1, 2,
+ *             4 ... processors, on an m x n board and on an m x n board per
+ *             processor, and prints the results as CSV (see scaling.c)
+ *          -A plays the halo game with the kernel, tile size, depth and
+ *             transport that were fastest for this computer and board in
+ *             the tuning file, timing them first if it has none (see
+ *             tuning.c)
+ *          -P predicts how long a generation of the halo game takes on 1,
+ *             2, 4 ... processors and how many to use, then plays it and
+ *             says how far off the prediction was (see predict.c)
+ *          -L plays the original game (or the halo game with -x comm) on
+ *             that many ranks, each a thread of this one process, instead
+ *             of on the MPI processors; run it without mpiexec (see
+ *             comm_threads.c)
  * Output:  Each game state at iterations that are a multiple of k
  */
 
@@ -17,33 +61,45 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
+#include <unistd.h>
 
-enum MessageTag
-{
-	UPDATE_WORLD,
-	PROC_DATA,
-	BUILT_GAME_STATE,
-};
+#include "life.h"
 
-typedef struct ProcInfo
+// Everything the original and halo games need, which can be played over
+// either backend
+typedef struct GameSetup
 {
-	int offset;
-	int num_cells;
-} ProcInfo;
+	int live_cells;
+	int iterations;
+	int print_modulo;
+	int width;
+	int height;
+	long seed;
+	// NULL for the original game
+	const char* transport;
+	int halo_depth;
+	const LifeKernel* kernel;
+	LifeStep* step;
+} GameSetup;
 
-void apply_rules( ProcInfo* proc_data, bool* last_game_state,
-                  bool* new_game_state, int world_rank, int* adjacency_offsets,
-                  int width, int height );
+void play_setup( LifeComm* comm, GameSetup* game, bool* last_game_state,
+                 bool* new_game_state, ProcInfo* proc_data, LifeStep* step );
+void play_local_rank( LifeComm* comm, void* arg );
+void play_game( LifeComm* comm, bool* last_game_state, bool* new_game_state,
+                ProcInfo* proc_data, int live_cells, int iterations,
+                int print_modulo, int width, int height, long seed,
+                const LifeKernel* kernel, LifeStep* step );
 void read_args( int argc, char* argv[], int* live_cells, int* iterations,
-                int* print_modulo, int* width, int* height, int proc_id );
-void fill_game_field( bool* field, int width, int height, int live_cells );
-void print_game( bool* game_field, int width, int height );
+                int* print_modulo, int* width, int* height,
+                LifeOptions* options, int proc_id );
 
 int main( int argc, char* argv[] )
 {
-	// Fixes our args so that they match if we were running a "normal" program
-	MPI_Init( &argc, &argv );
+	// Fixes our args so that they match if we were running a "normal" program.
+	// Worker threads never call MPI themselves, so funneled is all we need.
+	int thread_support;
+	MPI_Init_thread( &argc, &argv, MPI_THREAD_FUNNELED, &thread_support );
 
 	int world_rank, world_size;
 	MPI_Comm_rank( MPI_COMM_WORLD, &world_rank );
@@ -52,21 +108,191 @@ int main( int argc, char* argv[] )
 	// Read in our args -- easiest to just populate them in the function call.
 	// The world_rank is used to only print the usage statement once
 	int live_cells, iterations, print_modulo, width, height;
+	LifeOptions options;
 	read_args( argc, argv, &live_cells, &iterations, &print_modulo, &width,
-	           &height, world_rank );
+	           &height, &options, world_rank );
+
+	if ( options.threads > 1 && thread_support < MPI_THREAD_FUNNELED )
+	{
+		if ( world_rank == 0 )
+			fprintf( stderr, "MPI has no thread support, using one thread\n" );
+		options.threads = 1;
+	}
+	WorkerPool* pool =
+	  options.threads > 1 ? worker_pool_create( options.threads ) : NULL;
+	if ( options.use_counters )
+		counters_open( pool );
+	if ( options.max_period > 0 )
+		cycles_open( options.max_period, options.check_every, pool );
+	if ( options.tuning_file != NULL )
+	{
+		autotune( options.tuning_file, &options, live_cells, width, height,
+		          pool );
+	}
 
-	// Game and related information allocation
-	bool* last_game_state = calloc( width * height, sizeof( bool ) );
-	bool* new_game_state = calloc( width * height, sizeof( bool ) );
+	// Game and related information allocation; the out-of-core game never
+	// holds the whole board
+	size_t board_cells = options.stream_file == NULL && !options.ensemble &&
+	                         options.batch_file == NULL &&
+	                         options.socket_path == NULL && !options.scaling &&
+	                         options.local_ranks == 0
+	                       ? (size_t)width * height
+	                       : 0;
+	bool* last_game_state = calloc( board_cells, sizeof( bool ) );
+	bool* new_game_state = calloc( board_cells, sizeof( bool ) );
 	ProcInfo* proc_data = calloc( world_size, sizeof( ProcInfo ) );
 
 	// Adjacency offsets makes it easier to count cells nearby; we don't include
 	// the offset of zero since the current cell's status is only used to
 	// determine what rule to use
-	const int adjacency_offsets[] = {
+	int adjacency_offsets[] = {
 	  -( width + 1 ), -width, -( width - 1 ), -1, 1,
 	  width - 1,      width,  width + 1 };
 
+	// Everything the kernel needs that stays the same from one generation to
+	// the next; the rest is filled in by whichever game gets played
+	const LifeKernel* kernel = find_kernel( options.kernel );
+	LifeStep step = { { 0, 0 }, NULL, NULL, adjacency_offsets, width, height,
+	                  pool, options.tile_size, NULL, NULL };
+
+	if ( options.predict )
+		predict_open( &options, live_cells, width, height, kernel, &step );
+	if ( options.time_phases )
+		timers_open();
+	if ( options.trace_file != NULL )
+		trace_open( options.trace_file, MPI_COMM_WORLD );
+
+	// The original and halo games can play over either backend
+	GameSetup game = { live_cells,        iterations,         print_modulo,
+	                   width,             height,             options.seed,
+	                   options.transport, options.halo_depth, kernel,
+	                   &step };
+
+	if ( options.local_ranks > 0 )
+	{
+		// Every rank is a thread, with boards of its own (see comm_threads.c)
+		comm_run_threads( options.local_ranks, play_local_rank, &game );
+	}
+	else if ( options.stream_file != NULL )
+	{
+		play_stream_game( options.stream_file, live_cells, iterations,
+		                  print_modulo, width, height, options.halo_depth,
+		                  options.seed );
+	}
+	else if ( options.socket_path != NULL )
+	{
+		play_server_game( options.socket_path, pool );
+	}
+	else if ( options.batch_file != NULL )
+	{
+		play_batch_game( options.batch_file, iterations, print_modulo, width,
+		                 height, pool );
+	}
+	else if ( options.ensemble )
+	{
+		play_ensemble_game( live_cells, iterations, print_modulo, width, height,
+		                    options.seed, pool );
+	}
+	else if ( options.unbounded )
+	{
+		// The starting board is the only thing with a size
+		if ( world_rank == 0 )
+		{
+			fill_game_field( last_game_state, width, height, live_cells,
+			                 options.seed );
+		}
+		play_unbounded_game( last_game_state, width, height, iterations,
+		                     print_modulo, pool );
+	}
+	else if ( options.scaling )
+	{
+		play_scaling_game( live_cells, iterations, width, height, options.seed,
+		                   options.halo_depth,
+		                   find_halo_transport( options.transport != NULL
+		                                          ? options.transport
+		                                          : "plain" ),
+		                   kernel, &step );
+	}
+	else
+	{
+		LifeComm world;
+		comm_from_mpi( &world, MPI_COMM_WORLD );
+		play_setup( &world, &game, last_game_state, new_game_state, proc_data,
+		            &step );
+	}
+
+	predict_close( iterations );
+	if ( kernel->report != NULL )
+		kernel->report( MPI_COMM_WORLD );
+	counters_report( MPI_COMM_WORLD );
+	timers_report( MPI_COMM_WORLD );
+	trace_close( MPI_COMM_WORLD );
+	cycles_close();
+
+	// Don't forget to clean up
+	free( last_game_state );
+	free( new_game_state );
+	free( proc_data );
+	worker_pool_destroy( pool );
+
+	MPI_Finalize();
+}
+
+// Plays the halo game if there is a transport, the original game if not
+void play_setup( LifeComm* comm, GameSetup* game, bool* last_game_state,
+                 bool* new_game_state, ProcInfo* proc_data, LifeStep* step )
+{
+	if ( game->transport != NULL )
+	{
+		// The halo game only ever needs the full board on the controller
+		if ( comm->rank == 0 )
+		{
+			fill_game_field( last_game_state, game->width, game->height,
+			                 game->live_cells, game->seed );
+		}
+		play_halo_game( comm, last_game_state, game->width, game->height,
+		                game->iterations, game->print_modulo, game->halo_depth,
+		                find_halo_transport( game->transport ), game->kernel,
+		                step );
+	}
+	else
+	{
+		play_game( comm, last_game_state, new_game_state, proc_data,
+		           game->live_cells, game->iterations, game->print_modulo,
+		           game->width, game->height, game->seed, game->kernel, step );
+	}
+}
+
+// One rank of a game on the threads backend (-L). The ranks share the
+// process, so each one allocates what a processor would have had to itself;
+// the adjacency offsets in the step are only ever read.
+void play_local_rank( LifeComm* comm, void* arg )
+{
+	GameSetup* game = arg;
+	size_t board_cells = (size_t)game->width * game->height;
+	bool* last_game_state = calloc( board_cells, sizeof( bool ) );
+	bool* new_game_state = calloc( board_cells, sizeof( bool ) );
+	ProcInfo* proc_data = calloc( comm->size, sizeof( ProcInfo ) );
+	LifeStep step = *game->step;
+
+	play_setup( comm, game, last_game_state, new_game_state, proc_data, &step );
+
+	free( last_game_state );
+	free( new_game_state );
+	free( proc_data );
+}
+
+// The original game: the controller sends the whole board to every processor
+// on every iteration and collects each one's share of the new board
+void play_game( LifeComm* comm, bool* last_game_state, bool* new_game_state,
+                ProcInfo* proc_data, int live_cells, int iterations,
+                int print_modulo, int width, int height, long seed,
+                const LifeKernel* kernel, LifeStep* step )
+{
+	int world_rank = comm->rank;
+	int world_size = comm->size;
+	const CommBackend* backend = comm->backend;
+
 	// Processor with id 0 will be our controller -- the remaining processors
 	// will just be used to do work. Once they all finish their jobs for an
 	// iteration, we only need to collect them in the controller and apply the
@@ -74,7 +300,7 @@ int main( int argc, char* argv[] )
 	if ( world_rank == 0 )
 	{
 		// Fill up our game field if we are on the "master" processor
-		fill_game_field( last_game_state, width, height, live_cells );
+		fill_game_field( last_game_state, width, height, live_cells, seed );
 
 		// Calculate each processor's offset and number of cells
 		int normal_num_cells = floor( (double)width * height / world_size );
@@ -96,55 +322,72 @@ int main( int argc, char* argv[] )
 		{
 			// While we could go through the headache of making a custom type for
 			// MPI, we know that our ProcInfo struct is stored in memory as just
-			// two ints; this means that we effectively are just sending an array
-			// of 2 * world_size ints. Once it gets received, the compiler knows
-			// that the data we got is of the same struct type (because that is
-			// the type of the variable it is stored in). This means that we can
-			// avoid this extra step.
+			// two ints; this means that we can just send the array's bytes
+			// (which is all either backend sends anyway). Once it gets received,
+			// the compiler knows that the data we got is of the same struct type
+			// (because that is the type of the variable it is stored in). This
+			// means that we can avoid this extra step.
 			//
 			// If we were using two variables of different types/sizes, we would
 			// need to go through the process of defining a separate type for MPI
-			MPI_Send( proc_data, 2 * world_size, MPI_INT, proc, PROC_DATA,
-			          MPI_COMM_WORLD );
+			backend->send( comm, proc_data, world_size * sizeof( ProcInfo ), proc,
+			               PROC_DATA );
 		}
 	}
 	else
 	{
-		MPI_Recv( proc_data, 2 * world_size, MPI_INT, 0, PROC_DATA, MPI_COMM_WORLD,
-		          MPI_STATUS_IGNORE );
+		backend->recv( comm, proc_data, world_size * sizeof( ProcInfo ), 0,
+		               PROC_DATA );
 	}
 
-	MPI_Barrier( MPI_COMM_WORLD );
+	backend->barrier( comm );
+	step->cells = proc_data[world_rank];
 
 	// Now for the actual loop
 	// We use iterations + 1 since we are not including the base state
 	for ( int iteration = 0; iteration < iterations + 1; ++iteration )
 	{
+		trace_iteration( iteration );
 		if ( world_rank == 0 )
 		{
 			// Only print on every nth iteration, which mod makes easy
 			if ( iteration % print_modulo == 0 )
 			{
+				timer_start( TIMER_PRINT );
 				printf( "Game state on iteration %d:\n", iteration );
 				print_game( last_game_state, width, height );
+				timer_stop( TIMER_PRINT );
 			}
 
 			// Send the last iteration's game state to all of the other processors
+			timer_start( TIMER_DISTRIBUTE );
 			for ( int proc = 1; proc < world_size; proc++ )
 			{
-				MPI_Send( last_game_state, width * height, MPI_C_BOOL, proc,
-				          UPDATE_WORLD, MPI_COMM_WORLD );
+				double sent = MPI_Wtime();
+				backend->send( comm, last_game_state, width * height, proc,
+				               UPDATE_WORLD );
+				trace_event( TRACE_SEND, sent, proc );
 			}
+			timer_stop( TIMER_DISTRIBUTE );
 
-			apply_rules( proc_data, last_game_state, new_game_state, world_rank,
-			             adjacency_offsets, width, height );
+			step->last_game_state = last_game_state;
+			step->new_game_state = new_game_state;
+			timer_start( TIMER_COMPUTE );
+			counters_start();
+			kernel->apply( step );
+			counters_stop( step->cells.num_cells );
+			timer_stop( TIMER_COMPUTE );
+			timers_add_updates( step->cells.num_cells );
 
+			timer_start( TIMER_GATHER );
 			for ( int proc = 1; proc < world_size; ++proc )
 			{
-				MPI_Recv( new_game_state + proc_data[proc].offset,
-				          proc_data[proc].num_cells, MPI_C_BOOL, proc, BUILT_GAME_STATE,
-				          MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+				double waited = MPI_Wtime();
+				backend->recv( comm, new_game_state + proc_data[proc].offset,
+				               proc_data[proc].num_cells, proc, BUILT_GAME_STATE );
+				trace_event( TRACE_RECEIVE, waited, proc );
 			}
+			timer_stop( TIMER_GATHER );
 
 			// Easiest to just swap the pointers on every iteration since we have to
 			// give each processor the newly updated game state anyways
@@ -155,134 +398,244 @@ int main( int argc, char* argv[] )
 		else
 		{
 			// Receive our game state
-			MPI_Recv( last_game_state, width * height, MPI_C_BOOL, 0, UPDATE_WORLD,
-			          MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+			timer_start( TIMER_DISTRIBUTE );
+			double waited = MPI_Wtime();
+			backend->recv( comm, last_game_state, width * height, 0,
+			               UPDATE_WORLD );
+			trace_event( TRACE_RECEIVE, waited, 0 );
+			timer_stop( TIMER_DISTRIBUTE );
 
-			apply_rules( proc_data, last_game_state, new_game_state, world_rank,
-			             adjacency_offsets, width, height );
+			step->last_game_state = last_game_state;
+			step->new_game_state = new_game_state;
+			timer_start( TIMER_COMPUTE );
+			counters_start();
+			kernel->apply( step );
+			counters_stop( step->cells.num_cells );
+			timer_stop( TIMER_COMPUTE );
+			timers_add_updates( step->cells.num_cells );
 
-			MPI_Send( new_game_state + proc_data[world_rank].offset,
-			          proc_data[world_rank].num_cells, MPI_C_BOOL, 0,
-			          BUILT_GAME_STATE, MPI_COMM_WORLD );
+			timer_start( TIMER_GATHER );
+			double sent = MPI_Wtime();
+			backend->send( comm, new_game_state + proc_data[world_rank].offset,
+			               proc_data[world_rank].num_cells, 0, BUILT_GAME_STATE );
+			trace_event( TRACE_SEND, sent, 0 );
+			timer_stop( TIMER_GATHER );
 		}
-		MPI_Barrier( MPI_COMM_WORLD );
+		timer_start( TIMER_BARRIER );
+		backend->barrier( comm );
+		timer_stop( TIMER_BARRIER );
 	}
-
-	// Don't forget to clean up
-	free( last_game_state );
-	free( new_game_state );
-	free( proc_data );
-
-	MPI_Finalize();
 }
 
-void apply_rules( ProcInfo* proc_data, bool* last_game_state,
-                  bool* new_game_state, int world_rank, int* adjacency_offsets,
-                  int width, int height )
+void read_args( int argc, char* argv[], int* live_cells, int* iterations,
+                int* print_modulo, int* width, int* height,
+                LifeOptions* options, int proc_id )
 {
-	for ( int idx = 0; idx < proc_data[world_rank].num_cells; ++idx )
-	{
-		int curr_cell_index = proc_data[world_rank].offset + idx;
-		int alive_adj_cells = 0;
-		for ( int adj_ind = 0; adj_ind < 8; ++adj_ind )
-		{
-			int offset = adjacency_offsets[adj_ind];
-			// Check the following:
-			//     Current adjacent cell is not off the top or bottom edges
-			//     Current adjacent cell is not off the left or right edges
-			//     Current adjacent cell is alive
-			//
-			//      Top Edge
-			if ( curr_cell_index + offset >= 0 &&
-			     // Bottom edge
-			     curr_cell_index + offset < width * height &&
-			     // Left and Right edges
-			     // If the left/right adjacent cells overflow to another
-			     // row, then the differnce between their column numbers
-			     // is greater than 1 -- otherwise it is 1 or 0
-			     abs( ( curr_cell_index % width ) -
-			          ( ( curr_cell_index + offset ) % width ) ) <= 1 &&
-			     // Currently checked adjacent cell is alive
-			     last_game_state[curr_cell_index + offset] )
-			{
-				alive_adj_cells++;
-			}
-		}
+	options->transport = NULL;
+	options->seed = -1;
+	options->threads = 1;
+	options->kernel = "static";
+	options->tile_size = 64;
+	options->halo_depth = 1;
+	options->use_counters = false;
+	options->stream_file = NULL;
+	options->unbounded = false;
+	options->ensemble = false;
+	options->batch_file = NULL;
+	options->socket_path = NULL;
+	options->max_period = 0;
+	options->check_every = 8;
+	options->time_phases = false;
+	options->trace_file = NULL;
+	options->scaling = false;
+	options->tuning_file = NULL;
+	options->predict = false;
+	options->local_ranks = 0;
 
-		if ( last_game_state[curr_cell_index] )
-		{
-			if ( alive_adj_cells == 2 || alive_adj_cells == 3 )
-				new_game_state[curr_cell_index] = true;
-			else
-				new_game_state[curr_cell_index] = false;
-		}
-		else
-		{
-			if ( alive_adj_cells == 3 )
-				new_game_state[curr_cell_index] = true;
-			else
-				new_game_state[curr_cell_index] = false;
-		}
-	}
-}
-
-void print_game( bool* game_field, int width, int height )
-{
-	for ( int i = 0; i < height; ++i )
+	int opt;
+	bool bad_option = false;
+	while ( ( opt = getopt( argc, argv,
+	                        "x:s:t:k:g:d:co:ueb:l:p:r:mT:SA:PL:" ) ) != -1 )
 	{
-		for ( int j = 0; j < width; ++j )
+		switch ( opt )
 		{
-			if ( game_field[i * width + j] )
+		case 'x':
+			options->transport = optarg;
+			if ( find_halo_transport( optarg ) == NULL )
 			{
-				printf( "█" );
+				if ( proc_id == 0 )
+				{
+					fprintf( stderr, "Unknown halo transport '%s' (have: ", optarg );
+					list_halo_transports( stderr );
+					fprintf( stderr, ")\n" );
+				}
+				bad_option = true;
 			}
-			else
+			break;
+		case 's':
+			options->seed = strtol( optarg, NULL, 10 );
+			break;
+		case 't':
+			options->threads = strtol( optarg, NULL, 10 );
+			bad_option |= options->threads < 1;
+			break;
+		case 'k':
+			options->kernel = optarg;
+			if ( find_kernel( optarg ) == NULL )
 			{
-				printf( "." );
+				if ( proc_id == 0 )
+				{
+					fprintf( stderr, "Unknown kernel '%s' (have: ", optarg );
+					list_kernels( stderr );
+					fprintf( stderr, ")\n" );
+				}
+				bad_option = true;
 			}
+			break;
+		case 'g':
+			options->tile_size = strtol( optarg, NULL, 10 );
+			bad_option |= options->tile_size < 1;
+			break;
+		case 'd':
+			options->halo_depth = strtol( optarg, NULL, 10 );
+			bad_option |= options->halo_depth < 1;
+			break;
+		case 'c':
+			options->use_counters = true;
+			break;
+		case 'o':
+			options->stream_file = optarg;
+			break;
+		case 'u':
+			options->unbounded = true;
+			break;
+		case 'e':
+			options->ensemble = true;
+			break;
+		case 'b':
+			options->batch_file = optarg;
+			break;
+		case 'l':
+			options->socket_path = optarg;
+			break;
+		case 'p':
+			options->max_period = strtol( optarg, NULL, 10 );
+			bad_option |= options->max_period < 1;
+			break;
+		case 'r':
+			options->check_every = strtol( optarg, NULL, 10 );
+			bad_option |= options->check_every < 1;
+			break;
+		case 'm':
+			options->time_phases = true;
+			break;
+		case 'T':
+			options->trace_file = optarg;
+			break;
+		case 'S':
+			options->scaling = true;
+			break;
+		case 'A':
+			options->tuning_file = optarg;
+			break;
+		case 'P':
+			options->predict = true;
+			break;
+		case 'L':
+			options->local_ranks = strtol( optarg, NULL, 10 );
+			bad_option |= options->local_ranks < 1;
+			break;
+		default:
+			bad_option = true;
+			break;
 		}
-		printf( "\n" );
 	}
-}
 
-void fill_game_field( bool* field, int width, int height, int live_cells )
-{
-	int cells_to_generate = live_cells;
-	srand( time( NULL ) );
-	for ( int i = 0; i < width * height; ++i )
+	// Only one of the games that are not the original can be played (the
+	// scaling game plays the halo game, so it can pick the transport, and the
+	// tuner picks the transport for either)
+	bool halo_game = options->transport != NULL || options->tuning_file != NULL;
+	bad_option |= ( options->stream_file != NULL ) + options->unbounded +
+	                options->ensemble + ( options->batch_file != NULL ) +
+	                ( options->socket_path != NULL ) +
+	                ( halo_game || options->scaling ) >
+	              1;
+	bad_option |= options->transport != NULL && options->tuning_file != NULL;
+	// Only the halo game looks for periods
+	bad_option |= options->max_period > 0 && ( !halo_game || options->scaling );
+	// Only the halo game is predicted
+	bad_option |= options->predict && ( !halo_game || options->scaling );
+	// The ranks on the threads backend share the process, so they can only
+	// play the original game or the halo game over the comm transport, with
+	// nothing that keeps totals for the process or talks MPI on the side
+	if ( options->local_ranks > 0 )
 	{
-		// Fill the cell if we have to fill the rest of the cells
-		// or we can generate it randomly
-		if ( cells_to_generate > 0 &&
-		     ( width * height - ( i + 1 ) == cells_to_generate ||
-		       rand() % ( width * height ) < live_cells ) )
-		{
-			field[i] = true;
-			cells_to_generate--;
-		}
+		int world_size;
+		MPI_Comm_size( MPI_COMM_WORLD, &world_size );
+		const LifeKernel* kernel = find_kernel( options->kernel );
+		bad_option |=
+		  world_size > 1 ||
+		  ( options->transport != NULL &&
+		    strcmp( options->transport, "comm" ) != 0 ) ||
+		  options->stream_file != NULL || options->unbounded ||
+		  options->ensemble || options->batch_file != NULL ||
+		  options->socket_path != NULL || options->scaling ||
+		  options->tuning_file != NULL || options->predict ||
+		  options->max_period > 0 || options->use_counters ||
+		  options->time_phases || options->trace_file != NULL ||
+		  options->threads > 1 || ( kernel != NULL && kernel->report != NULL );
 	}
-}
 
-void read_args( int argc, char* argv[], int* live_cells, int* iterations,
-                int* print_modulo, int* width, int* height, int proc_id )
-{
-	if ( argc != 6 && proc_id == 0 )
+	if ( bad_option || argc - optind != 5 )
 	{
-		fprintf(
-		  stderr,
-		  "USAGE: ./%s i j k m n\n"
-		  "\ti is the number of live cells\n"
-		  "\tj is the number of iterations of the game of life\n"
-		  "\tk is how often to print the game state (eg every kth iteration)\n"
-		  "\tm is the game width\n"
-		  "\tn is the game height\n",
-		  argv[0] );
+		if ( proc_id == 0 )
+		{
+			fprintf(
+			  stderr,
+			  "USAGE: ./%s [-x transport] [-s seed] [-t threads] [-k kernel]\n"
+			  "\t[-g tile_size] [-d depth] [-c] [-o file] [-u] [-e]\n"
+			  "\t[-b jobs] [-l socket] [-p period] [-r rounds] [-m]\n"
+			  "\t[-T file] [-S] [-A file] [-P] [-L ranks] i j k m n\n"
+			  "\ti is the number of live cells\n"
+			  "\tj is the number of iterations of the game of life\n"
+			  "\tk is how often to print the game state (eg every kth iteration)\n"
+			  "\tm is the game width\n"
+			  "\tn is the game height\n"
+			  "\t-x plays the halo game with the given transport (",
+			  argv[0] );
+			list_halo_transports( stderr );
+			fprintf( stderr, ")\n"
+			                 "\t-s seeds the random game field\n"
+			                 "\t-t is the number of threads per processor\n"
+			                 "\t-k picks the kernel that applies the rules (" );
+			list_kernels( stderr );
+			fprintf( stderr, ")\n"
+			                 "\t-g is the tile size for tiled kernels\n"
+			                 "\t-d is the number of ghost rows in the halo game\n"
+			                 "\t-c counts what the kernel costs in hardware events\n"
+			                 "\t-o streams the board kept in the file\n"
+			                 "\t-u plays on a universe without edges\n"
+			                 "\t-e plays 64 separate boards per processor\n"
+			                 "\t-b plays the games listed in the jobs file\n"
+			                 "\t-l serves games asked for on the UNIX socket\n"
+			                 "\t-p skips ahead once the halo game repeats\n"
+			                 "\t   with a period up to this long\n"
+			                 "\t-r is how many rounds go by between looking\n"
+			                 "\t-m times each phase of the game\n"
+			                 "\t-T writes a timeline of the game to the file\n"
+			                 "\t-S times the halo game on 1, 2, 4 ... processors\n"
+			                 "\t-A tunes the halo game, keeping the results\n"
+			                 "\t   in the file\n"
+			                 "\t-P predicts the halo game on 1, 2, 4 ... processors\n"
+			                 "\t-L plays on that many threads of one process instead\n"
+			                 "\t   of MPI processors (only -x comm, no mpiexec)\n" );
+		}
 		MPI_Abort( MPI_COMM_WORLD, 1 );
 	}
 
-	*live_cells = strtol( argv[1], NULL, 10 );
-	*iterations = strtol( argv[2], NULL, 10 );
-	*print_modulo = strtol( argv[3], NULL, 10 );
-	*width = strtol( argv[4], NULL, 10 );
-	*height = strtol( argv[5], NULL, 10 );
+	*live_cells = strtol( argv[optind], NULL, 10 );
+	*iterations = strtol( argv[optind + 1], NULL, 10 );
+	*print_modulo = strtol( argv[optind + 2], NULL, 10 );
+	*width = strtol( argv[optind + 3], NULL, 10 );
+	*height = strtol( argv[optind + 4], NULL, 10 );
 }
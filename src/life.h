@@ -0,0 +1,461 @@
+/* File:    life.h
+ *
+ * Shared types and declarations for the Game of Life program. Everything that
+ * more than one of the source files in src/ needs lives in here.
+ */
+
+#ifndef LIFE_H
+#define LIFE_H
+
+#include <mpi.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum MessageTag
+{
+	UPDATE_WORLD,
+	PROC_DATA,
+	BUILT_GAME_STATE,
+	HALO_UP,
+	HALO_DOWN,
+	BATCH_JOB,
+	BATCH_RESULT,
+	TRACE_CLOCK,
+};
+
+typedef struct ProcInfo
+{
+	int offset;
+	int num_cells;
+} ProcInfo;
+
+// Optional settings given as flags before the positional arguments
+typedef struct LifeOptions
+{
+	// Name of the halo transport to use, or NULL for the original
+	// master/worker game where the whole board is sent every iteration
+	const char* transport;
+	// Seed for the random board; negative means seed from the clock
+	long seed;
+	// Worker threads each processor splits its part of the board between
+	int threads;
+	// Name of the kernel that applies the rules, and the edge length of the
+	// square tiles for the kernels that work in tiles
+	const char* kernel;
+	int tile_size;
+	// Ghost rows kept on each side in the halo game, which is also how many
+	// generations can be played between exchanges
+	int halo_depth;
+	// Play on a universe without edges, starting from the m x n board
+	bool unbounded;
+	// Play 64 separate m x n boards on every processor, a bit each
+	bool ensemble;
+	// File listing the separate games to play in the batch game, or NULL
+	const char* batch_file;
+	// UNIX socket the server game takes requests on, or NULL
+	const char* socket_path;
+	// File the board is kept in for the out-of-core game, or NULL
+	const char* stream_file;
+	// Count the cycles, instructions, branch and cache misses of the kernel
+	// with the hardware counters
+	bool use_counters;
+	// Longest period the halo game looks for once it has settled (0 to not
+	// look), and how many rounds go by between adding up the board hashes
+	int max_period;
+	int check_every;
+	// Time the phases of the main loop
+	bool time_phases;
+	// File to write a timeline of the game to, or NULL
+	const char* trace_file;
+	// Time the halo game on more and more processors instead of playing it
+	bool scaling;
+	// File of tuned setups for the halo game, or NULL to not tune
+	const char* tuning_file;
+	// Predict how long the halo game takes on more and more processors before
+	// playing it, and how far off that was after
+	bool predict;
+	// Play the original or halo game on this many ranks, each a thread of
+	// this one process, instead of on the MPI processors (0 to use MPI)
+	int local_ranks;
+} LifeOptions;
+
+// The ranks the original and halo games play over, and how they talk. Sizes
+// are in bytes (which for a board is cells), tags are the MessageTags, and
+// COMM_NONE as a rank sends or receives nothing. The MPI backend (comm.c)
+// wraps an MPI communicator; the threads backend (comm_threads.c) plays
+// every rank as a thread of one process.
+#define COMM_NONE MPI_PROC_NULL
+
+typedef struct LifeComm LifeComm;
+
+typedef struct CommBackend
+{
+	const char* name;
+	void ( *send )( LifeComm* comm, const void* buffer, int bytes, int dest,
+	                int tag );
+	void ( *recv )( LifeComm* comm, void* buffer, int bytes, int source,
+	                int tag );
+	void ( *sendrecv )( LifeComm* comm, const void* send_buffer, int send_bytes,
+	                    int dest, void* recv_buffer, int recv_bytes, int source,
+	                    int tag );
+	void ( *barrier )( LifeComm* comm );
+	void ( *bcast )( LifeComm* comm, void* buffer, int bytes, int root );
+	void ( *scatterv )( LifeComm* comm, const void* send_buffer,
+	                    const int* counts, const int* displs, void* recv_buffer,
+	                    int recv_bytes, int root );
+	void ( *gatherv )( LifeComm* comm, const void* send_buffer, int send_bytes,
+	                   void* recv_buffer, const int* counts, const int* displs,
+	                   int root );
+	void ( *abort )( LifeComm* comm, int code );
+} CommBackend;
+
+struct LifeComm
+{
+	const CommBackend* backend;
+	int rank;
+	int size;
+	// The communicator under the MPI backend, MPI_COMM_NULL otherwise
+	MPI_Comm mpi;
+	// Whatever the backend shares between the ranks
+	void* data;
+};
+
+typedef void ( *CommRankMain )( LifeComm* comm, void* arg );
+
+// The phases of the main loop that -m times (timers.c)
+typedef enum TimerPhase
+{
+	TIMER_DISTRIBUTE,
+	TIMER_EXCHANGE,
+	TIMER_COMPUTE,
+	TIMER_GATHER,
+	TIMER_BARRIER,
+	TIMER_PRINT,
+	NUM_TIMER_PHASES
+} TimerPhase;
+
+// What the timeline of -T records: the timed phases and these (trace.c)
+typedef enum TraceKind
+{
+	TRACE_SEND = NUM_TIMER_PHASES,
+	TRACE_RECEIVE,
+	TRACE_WAIT,
+	TRACE_IO,
+	NUM_TRACE_KINDS
+} TraceKind;
+
+// A halo message in flight, which goes on the timeline as a send or receive
+// event once it is done (trace.c)
+typedef struct TraceMessage
+{
+	TraceKind kind;
+	int peer;
+	double begin;
+} TraceMessage;
+
+// Worker threads that share a processor's part of the board (threads.c). A
+// NULL pool stands for just the calling thread.
+typedef struct WorkerPool WorkerPool;
+typedef void ( *WorkerTask )( int thread, int num_threads, void* arg );
+
+// One generation of work for a kernel: apply the rules to cells of
+// new_game_state, reading last_game_state (a width x height board)
+typedef struct LifeStep
+{
+	ProcInfo cells;
+	bool* last_game_state;
+	bool* new_game_state;
+	int* adjacency_offsets;
+	int width;
+	int height;
+	WorkerPool* pool;
+	int tile_size;
+	// If set, called on the main thread as soon as the first and last
+	// boundary_rows rows of cells are done (the kernel may call it at the very
+	// end)
+	void ( *boundary_done )( void* arg );
+	void* boundary_arg;
+	int boundary_rows;
+	// For kernels that keep the board in a layout of their own from one call
+	// to the next (packed): the cells of last_game_state nobody but the kernel
+	// has written since its last call handed the board back, and the cells
+	// the caller will not look at before the next call, which may be left
+	// unwritten. hidden_cells may only be set if the next call plays the
+	// same cells with them among its kept_cells.
+	ProcInfo kept_cells;
+	ProcInfo hidden_cells;
+} LifeStep;
+
+// Square tiles covering a range of cells, numbered row by row
+typedef struct TileGrid
+{
+	int width;
+	int start_cell;
+	int end_cell;
+	int first_row;
+	int tile_size;
+	int tile_rows;
+	int tile_cols;
+	int num_tiles;
+	// The tile rows in between the ones holding any of the first or last
+	// boundary rows, [inside_first_row, inside_end_row)
+	int inside_first_row;
+	int inside_end_row;
+} TileGrid;
+
+// One of the small, separate games of the batch and server games
+typedef struct BatchJob
+{
+	// -1 tells a worker there is nothing left to do
+	int index;
+	long seed;
+	int live_cells;
+	int width;
+	int height;
+	int iterations;
+	// In B/S notation, like "B3/S23"
+	char rule[32];
+	// Send the board on the last iteration back after the result
+	bool want_board;
+} BatchJob;
+
+typedef struct BatchResult
+{
+	int index;
+	long long population;
+	// 0 if the game never settled, and -1 if it never died out
+	int period;
+	int died_on;
+	// Generations actually played, less than asked for if it settled
+	int generations;
+} BatchResult;
+
+// The different ways of applying the rules, picked by name at run time
+typedef struct LifeKernel
+{
+	const char* name;
+	void ( *apply )( LifeStep* step );
+	// Prints anything the kernel kept track of; collective, may be NULL
+	void ( *report )( MPI_Comm comm );
+	// Plays several generations in one go, leaving the last one in
+	// step->last_game_state; may be NULL for kernels that go one at a time
+	void ( *advance )( LifeStep* step, int generations );
+	// Set if advance never touches step->new_game_state, so the halo game
+	// can get by with a single board
+	bool in_place;
+	// Set if the kernel works in tiles of step->tile_size, so the tile size
+	// is worth tuning
+	bool tiled;
+} LifeKernel;
+
+// A horizontal band of whole rows owned by one processor. Both boards hold
+// num_rows + 2 * halo_depth rows: the first and last halo_depth rows are
+// ghost rows that mirror the neighbouring processors' boundary rows (or stay
+// dead at the edges of the game field), and the owned rows sit in between.
+typedef struct Slab
+{
+	int width;
+	int height;
+	int first_row;
+	int num_rows;
+	int halo_depth;
+	// Neighbouring ranks, COMM_NONE (MPI_PROC_NULL) at the top/bottom edge
+	int up_rank;
+	int down_rank;
+	// The ranks the slab is one of, which a transport may swap for its own
+	// (slab_renumber); transports other than comm talk MPI straight over
+	// comm, so they only work under the MPI backend
+	LifeComm* life_comm;
+	MPI_Comm comm;
+	// Threads that apply the rules to (and so first touch) the owned rows
+	WorkerPool* pool;
+	// 2, or 1 if the kernel plays in place, in which case new_game_state is
+	// left NULL
+	int num_boards;
+	bool* last_game_state;
+	bool* new_game_state;
+	// Whatever the transport needs to keep between exchanges
+	void* transport_data;
+	// Set for games nobody watches, so the transport keeps its report to
+	// itself
+	bool quiet;
+} Slab;
+
+// A halo transport owns the slab's boards (some need them allocated in a
+// special way) and fills in the ghost rows of last_game_state on exchange.
+typedef struct HaloTransport
+{
+	const char* name;
+	void ( *init )( Slab* slab );
+	void ( *exchange )( Slab* slab );
+	void ( *finalize )( Slab* slab );
+	// Optional: starts sending board's boundary rows as soon as they are
+	// done, before the rest of the board is; the next exchange finishes it
+	void ( *start )( Slab* slab, bool* board );
+	// The deepest halo it can exchange (0 for any), and whether it needs two
+	// boards, so kernels that play in place can't use it
+	int max_depth;
+	bool needs_two_boards;
+} HaloTransport;
+
+// rules.c
+void apply_rules( ProcInfo* proc_data, bool* last_game_state,
+                  bool* new_game_state, int world_rank, int* adjacency_offsets,
+                  int width, int height );
+void apply_rules_to_row( const bool* above, const bool* row, const bool* below,
+                         bool* new_row, int width );
+uint64_t apply_rules_to_bits( const uint64_t neighbours[8], uint64_t alive );
+void print_game( bool* game_field, int width, int height );
+void fill_game_field( bool* field, int width, int height, int live_cells,
+                      long seed );
+void fill_game_cells( bool* cells, long long first_cell, long long num_cells,
+                      long long total_cells, int live_cells,
+                      int* cells_to_generate );
+
+// threads.c
+WorkerPool* worker_pool_create( int num_threads );
+int worker_pool_size( WorkerPool* pool );
+void worker_pool_run( WorkerPool* pool, WorkerTask task, void* arg );
+void worker_pool_destroy( WorkerPool* pool );
+void worker_pool_first_touch( WorkerPool* pool, bool* board, ProcInfo* cells );
+ProcInfo split_cells( ProcInfo* cells, int thread, int num_threads );
+double thread_clock( void );
+
+// kernels.c
+extern const LifeKernel static_kernel;
+const LifeKernel* find_kernel( const char* name );
+int num_kernels( void );
+const LifeKernel* get_kernel( int index );
+void list_kernels( FILE* stream );
+void advance_generations( const LifeKernel* kernel, LifeStep* step,
+                          int generations );
+
+// tiles.c
+extern const LifeKernel steal_kernel;
+void tile_grid_init( TileGrid* grid, ProcInfo* cells, int width,
+                     int tile_size, int boundary_rows );
+bool is_boundary_tile( TileGrid* grid, int tile );
+void apply_rules_to_tile( TileGrid* grid, int tile, LifeStep* step,
+                          bool* last_game_state, bool* new_game_state );
+
+// dataflow.c
+extern const LifeKernel dataflow_kernel;
+
+// skewed.c
+extern const LifeKernel skewed_kernel;
+
+// packed.c
+extern const LifeKernel packed_kernel;
+
+// inplace.c
+extern const LifeKernel inplace_kernel;
+
+// timers.c
+void timers_open( void );
+void timer_start( TimerPhase phase );
+void timer_stop( TimerPhase phase );
+void timers_add_updates( long long cell_updates );
+void timers_report( MPI_Comm comm );
+
+// trace.c
+void trace_open( const char* path, MPI_Comm comm );
+bool trace_enabled( void );
+void trace_iteration( int iteration );
+void trace_event( TraceKind kind, double begin, int peer );
+void trace_begin( TraceMessage* message, TraceKind kind, int peer );
+void trace_waitall( int count, MPI_Request* requests, TraceMessage* messages,
+                    MPI_Status* statuses );
+void trace_close( MPI_Comm comm );
+
+// cycles.c
+void cycles_open( int max_period, int check_every, WorkerPool* pool );
+int cycles_skip( const bool* cells, long long first_cell, int num_cells,
+                 int iteration, int iterations, MPI_Comm comm );
+bool cycles_enabled( void );
+void cycles_close( void );
+
+// unbounded.c
+void play_unbounded_game( bool* game_field, int width, int height,
+                          int iterations, int print_modulo, WorkerPool* pool );
+
+// ensemble.c
+void play_ensemble_game( int live_cells, int iterations, int print_modulo,
+                         int width, int height, long seed, WorkerPool* pool );
+
+// batch.c
+void play_batch_game( const char* jobs_path, int iterations, int print_modulo,
+                      int width, int height, WorkerPool* pool );
+bool parse_life_rule( const char* rule, bool next_state[2][9] );
+BatchResult play_batch_job( BatchJob* job, WorkerPool* pool,
+                            bool* final_board );
+void batch_types_create( MPI_Datatype* job_type, MPI_Datatype* result_type );
+
+// server.c
+void play_server_game( const char* path, WorkerPool* pool );
+
+// tuning.c
+void autotune( const char* path, LifeOptions* options, int live_cells,
+               int width, int height, WorkerPool* pool );
+
+// predict.c
+void predict_open( LifeOptions* options, int live_cells, int width,
+                   int height, const LifeKernel* kernel, LifeStep* step );
+void predict_close( int iterations );
+
+// scaling.c
+double time_halo_game( MPI_Comm comm, int live_cells, int iterations,
+                       int width, int height, long seed, int halo_depth,
+                       const HaloTransport* transport,
+                       const LifeKernel* kernel, LifeStep* step );
+void play_scaling_game( int live_cells, int iterations, int width, int height,
+                        long seed, int halo_depth,
+                        const HaloTransport* transport,
+                        const LifeKernel* kernel, LifeStep* step );
+
+// stream.c
+void play_stream_game( const char* path, int live_cells, int iterations,
+                       int print_modulo, int width, int height,
+                       int generations_per_pass, long seed );
+
+// counters.c
+void counters_open( WorkerPool* pool );
+void counters_start( void );
+void counters_stop( long long cell_updates );
+void counters_report( MPI_Comm comm );
+
+// halo.c
+const HaloTransport* find_halo_transport( const char* name );
+int num_halo_transports( void );
+const HaloTransport* get_halo_transport( int index );
+void list_halo_transports( FILE* stream );
+void play_halo_game( LifeComm* comm, bool* game_field, int width, int height,
+                     int iterations, int print_modulo, int halo_depth,
+                     const HaloTransport* transport, const LifeKernel* kernel,
+                     LifeStep* step );
+void slab_decompose( Slab* slab, LifeComm* comm, int width, int height,
+                     int halo_depth );
+void slab_renumber( Slab* slab, LifeComm* comm );
+void slab_alloc_boards( Slab* slab );
+void slab_first_touch( Slab* slab, bool* board );
+void slab_free_boards( Slab* slab );
+ProcInfo slab_round_cells( Slab* slab, int generations );
+
+// halo_adaptive.c
+extern const HaloTransport adaptive_halo_transport;
+
+// halo_rma.c
+extern const HaloTransport rma_halo_transport;
+
+// halo_persistent.c
+extern const HaloTransport persistent_halo_transport;
+
+// comm.c
+extern const CommBackend mpi_comm_backend;
+void comm_from_mpi( LifeComm* comm, MPI_Comm mpi );
+
+// comm_threads.c
+extern const CommBackend threads_comm_backend;
+void comm_run_threads( int size, CommRankMain rank_main, void* arg );
+
+#endif
@@ -0,0 +1,438 @@
+/* File:    life3d.c
+ *
+ * Compile: make life3d
+ * Run:     mpiexec -n p ./life3d [-r rule] [-s seed] [-p percent] [-t threads]
+ *                                   j k x y z
+ * Input:   p is the number of computers/processors to use
+ *          j is the number of iterations to play
+ *          k is how often to report the game state (eg every kth iteration)
+ *          x, y and z are the size of the game field
+ *          -r is the rule as four numbers, survival low and high then birth
+ *             low and high (Bays' notation, "4555" by default; use commas,
+ *             like "5,7,6,6", for numbers above 9)
+ *          -s seeds the random game field so runs can be repeated
+ *          -p is how many percent of the cells start out alive (20 by
+ *             default)
+ *          -t splits each processor's block between that many threads
+ * Output:  The number of live cells at iterations that are a multiple of k,
+ *          and how fast the cells were updated
+ *
+ * Purpose: Life in three dimensions, where every cell has 26 neighbours. The
+ *          field is cut into blocks over a 3D Cartesian communicator, and
+ *          each block keeps a layer of ghost cells on all six sides. The ghost
+ *          layers are exchanged one dimension at a time straight out of and
+ *          into the blocks with subarray datatypes (no packing): x first,
+ *          then y including the x ghosts, then z including both, which also
+ *          fills in the edges and corners without ever talking to the
+ *          diagonal neighbours.
+ *
+ *          Neighbours are counted by first adding up the 3 x 3 columns of
+ *          cells under every cell of a row, then three of those sums, with
+ *          plain loops over bytes that the compiler can vectorise.
+ */
+
+#include <mpi.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "life.h"
+
+typedef struct LifeRule
+{
+	int survive_low;
+	int survive_high;
+	int birth_low;
+	int birth_high;
+} LifeRule;
+
+// One processor's block, with a ghost layer on every side
+typedef struct Block
+{
+	// Cells we own in each dimension, in x, y, z order, and where they start
+	int size[3];
+	int start[3];
+	// Ranks below and above us in each dimension
+	int lower[3];
+	int upper[3];
+	MPI_Comm cart;
+	// Ghost layers to receive and boundary layers to send, per dimension
+	MPI_Datatype recv_lower[3];
+	MPI_Datatype recv_upper[3];
+	MPI_Datatype send_lower[3];
+	MPI_Datatype send_upper[3];
+	uint8_t* last_game_state;
+	uint8_t* new_game_state;
+	// The next cell state for every count of live neighbours, dead and alive
+	uint8_t next_state[2][27];
+} Block;
+
+typedef struct PlaneTask
+{
+	Block* block;
+} PlaneTask;
+
+void read_args_3d( int argc, char* argv[], int* iterations, int* print_modulo,
+                   int size[3], LifeRule* rule, long* seed, int* percent,
+                   int* threads, int proc_id );
+
+static size_t cell_index( Block* block, int x, int y, int z )
+{
+	return ( (size_t)z * ( block->size[1] + 2 ) + y ) * ( block->size[0] + 2 ) +
+	       x;
+}
+
+// Same split as everywhere else: equal shares, remainder to the last one
+static void split_dimension( int cells, int parts, int part, int* start,
+                             int* size )
+{
+	*size = cells / parts;
+	*start = part * *size;
+	if ( part == parts - 1 )
+		*size += cells % parts;
+}
+
+// A layer one cell thick across the block, at the given position in dim;
+// dimensions before it (exchanged earlier) include their ghost cells
+static MPI_Datatype layer_type( Block* block, int dim, int position )
+{
+	// Subarrays are in C order, so z, y, x
+	int sizes[3], subsizes[3], starts[3];
+	for ( int d = 0; d < 3; ++d )
+	{
+		int c = 2 - d;
+		sizes[c] = block->size[d] + 2;
+		if ( d == dim )
+		{
+			subsizes[c] = 1;
+			starts[c] = position;
+		}
+		else if ( d < dim )
+		{
+			subsizes[c] = block->size[d] + 2;
+			starts[c] = 0;
+		}
+		else
+		{
+			subsizes[c] = block->size[d];
+			starts[c] = 1;
+		}
+	}
+
+	MPI_Datatype type;
+	MPI_Type_create_subarray( 3, sizes, subsizes, starts, MPI_ORDER_C,
+	                          MPI_UINT8_T, &type );
+	MPI_Type_commit( &type );
+	return type;
+}
+
+static void exchange_ghosts( Block* block )
+{
+	for ( int dim = 0; dim < 3; ++dim )
+	{
+		MPI_Sendrecv( block->last_game_state, 1, block->send_upper[dim],
+		              block->upper[dim], HALO_DOWN, block->last_game_state, 1,
+		              block->recv_lower[dim], block->lower[dim], HALO_DOWN,
+		              block->cart, MPI_STATUS_IGNORE );
+		MPI_Sendrecv( block->last_game_state, 1, block->send_lower[dim],
+		              block->lower[dim], HALO_UP, block->last_game_state, 1,
+		              block->recv_upper[dim], block->upper[dim], HALO_UP,
+		              block->cart, MPI_STATUS_IGNORE );
+	}
+}
+
+static void play_planes_task( int thread, int num_threads, void* arg )
+{
+	PlaneTask* task = arg;
+	Block* block = task->block;
+	int width = block->size[0] + 2;
+	ProcInfo planes = { 1, block->size[2] };
+	ProcInfo share = split_cells( &planes, thread, num_threads );
+	uint8_t* columns = malloc( width );
+
+	for ( int z = share.offset; z < share.offset + share.num_cells; ++z )
+	{
+		for ( int y = 1; y <= block->size[1]; ++y )
+		{
+			// Live cells in the 3 x 3 column under each cell of the row
+			memset( columns, 0, width );
+			for ( int dz = -1; dz <= 1; ++dz )
+			{
+				for ( int dy = -1; dy <= 1; ++dy )
+				{
+					const uint8_t* row =
+					  block->last_game_state + cell_index( block, 0, y + dy, z + dz );
+					for ( int x = 0; x < width; ++x )
+						columns[x] += row[x];
+				}
+			}
+
+			const uint8_t* old_row =
+			  block->last_game_state + cell_index( block, 0, y, z );
+			uint8_t* new_row = block->new_game_state + cell_index( block, 0, y, z );
+			for ( int x = 1; x <= block->size[0]; ++x )
+			{
+				int alive = old_row[x];
+				int count = columns[x - 1] + columns[x] + columns[x + 1] - alive;
+				new_row[x] = block->next_state[alive][count];
+			}
+		}
+	}
+	free( columns );
+}
+
+// A cheap hash of the cell's place in the whole field, so the field comes out
+// the same however it is split up
+static bool random_cell( long seed, long long cell, int percent )
+{
+	uint64_t bits = (uint64_t)seed * 0x9e3779b97f4a7c15ULL + (uint64_t)cell;
+	bits = ( bits ^ ( bits >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+	bits = ( bits ^ ( bits >> 27 ) ) * 0x94d049bb133111ebULL;
+	bits ^= bits >> 31;
+	return bits % 100 < (uint64_t)percent;
+}
+
+static long long count_live( Block* block )
+{
+	long long live = 0;
+	for ( int z = 1; z <= block->size[2]; ++z )
+	{
+		for ( int y = 1; y <= block->size[1]; ++y )
+		{
+			const uint8_t* row =
+			  block->last_game_state + cell_index( block, 0, y, z );
+			for ( int x = 1; x <= block->size[0]; ++x )
+				live += row[x];
+		}
+	}
+	return live;
+}
+
+int main( int argc, char* argv[] )
+{
+	int thread_support;
+	MPI_Init_thread( &argc, &argv, MPI_THREAD_FUNNELED, &thread_support );
+
+	int world_rank, world_size;
+	MPI_Comm_rank( MPI_COMM_WORLD, &world_rank );
+	MPI_Comm_size( MPI_COMM_WORLD, &world_size );
+
+	int iterations, print_modulo, field_size[3], percent, threads;
+	LifeRule rule;
+	long seed;
+	read_args_3d( argc, argv, &iterations, &print_modulo, field_size, &rule,
+	              &seed, &percent, &threads, world_rank );
+	if ( threads > 1 && thread_support < MPI_THREAD_FUNNELED )
+		threads = 1;
+	WorkerPool* pool = threads > 1 ? worker_pool_create( threads ) : NULL;
+
+	// Dimensions are given to MPI in z, y, x order so x (contiguous in
+	// memory) is split the least
+	Block block;
+	int dims[3] = { 0, 0, 0 }, periods[3] = { 0, 0, 0 }, coords[3];
+	MPI_Dims_create( world_size, 3, dims );
+	MPI_Cart_create( MPI_COMM_WORLD, 3, dims, periods, 1, &block.cart );
+	int cart_rank;
+	MPI_Comm_rank( block.cart, &cart_rank );
+	MPI_Cart_coords( block.cart, cart_rank, 3, coords );
+	for ( int d = 0; d < 3; ++d )
+	{
+		int c = 2 - d;
+		split_dimension( field_size[d], dims[c], coords[c], &block.start[d],
+		                 &block.size[d] );
+		MPI_Cart_shift( block.cart, c, 1, &block.lower[d], &block.upper[d] );
+	}
+	for ( int d = 0; d < 3; ++d )
+	{
+		if ( block.size[d] < 1 )
+		{
+			if ( world_rank == 0 )
+				fprintf( stderr, "Too many processors for the field\n" );
+			MPI_Abort( MPI_COMM_WORLD, 1 );
+		}
+		block.recv_lower[d] = layer_type( &block, d, 0 );
+		block.send_lower[d] = layer_type( &block, d, 1 );
+		block.send_upper[d] = layer_type( &block, d, block.size[d] );
+		block.recv_upper[d] = layer_type( &block, d, block.size[d] + 1 );
+	}
+
+	for ( int count = 0; count < 27; ++count )
+	{
+		block.next_state[0][count] =
+		  count >= rule.birth_low && count <= rule.birth_high;
+		block.next_state[1][count] =
+		  count >= rule.survive_low && count <= rule.survive_high;
+	}
+
+	// The ghost layers at the edges of the field are never written, so they
+	// stay dead
+	size_t cells = (size_t)( block.size[0] + 2 ) * ( block.size[1] + 2 ) *
+	               ( block.size[2] + 2 );
+	block.last_game_state = calloc( cells, 1 );
+	block.new_game_state = calloc( cells, 1 );
+	for ( int z = 1; z <= block.size[2]; ++z )
+	{
+		for ( int y = 1; y <= block.size[1]; ++y )
+		{
+			for ( int x = 1; x <= block.size[0]; ++x )
+			{
+				long long cell =
+				  ( (long long)( block.start[2] + z - 1 ) * field_size[1] +
+				    block.start[1] + y - 1 ) *
+				    field_size[0] +
+				  block.start[0] + x - 1;
+				block.last_game_state[cell_index( &block, x, y, z )] =
+				  random_cell( seed, cell, percent );
+			}
+		}
+	}
+
+	PlaneTask task = { &block };
+	double compute_time = 0;
+	for ( int iteration = 0; iteration <= iterations; ++iteration )
+	{
+		if ( iteration % print_modulo == 0 )
+		{
+			long long live = count_live( &block ), total_live;
+			MPI_Reduce( &live, &total_live, 1, MPI_LONG_LONG, MPI_SUM, 0,
+			            MPI_COMM_WORLD );
+			if ( world_rank == 0 )
+				printf( "Live cells on iteration %d: %lld\n", iteration, total_live );
+		}
+		if ( iteration == iterations )
+			break;
+
+		exchange_ghosts( &block );
+		double start = MPI_Wtime();
+		worker_pool_run( pool, play_planes_task, &task );
+		compute_time += MPI_Wtime() - start;
+
+		uint8_t* temp_game_state = block.last_game_state;
+		block.last_game_state = block.new_game_state;
+		block.new_game_state = temp_game_state;
+	}
+
+	double slowest;
+	MPI_Reduce( &compute_time, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0,
+	            MPI_COMM_WORLD );
+	if ( world_rank == 0 && iterations > 0 && slowest > 0 )
+	{
+		double updates = (double)field_size[0] * field_size[1] * field_size[2] *
+		                 iterations;
+		printf( "Rule %d%d%d%d on %d x %d x %d (%d x %d x %d blocks): "
+		        "%.1f million cell updates per second\n",
+		        rule.survive_low, rule.survive_high, rule.birth_low,
+		        rule.birth_high, field_size[0], field_size[1], field_size[2],
+		        dims[2], dims[1], dims[0], updates / slowest / 1e6 );
+	}
+
+	for ( int d = 0; d < 3; ++d )
+	{
+		MPI_Type_free( &block.recv_lower[d] );
+		MPI_Type_free( &block.send_lower[d] );
+		MPI_Type_free( &block.send_upper[d] );
+		MPI_Type_free( &block.recv_upper[d] );
+	}
+	free( block.last_game_state );
+	free( block.new_game_state );
+	MPI_Comm_free( &block.cart );
+	worker_pool_destroy( pool );
+
+	MPI_Finalize();
+}
+
+static bool parse_rule( const char* text, LifeRule* rule )
+{
+	int values[4];
+	if ( strchr( text, ',' ) != NULL )
+	{
+		if ( sscanf( text, "%d,%d,%d,%d", &values[0], &values[1], &values[2],
+		             &values[3] ) != 4 )
+			return false;
+	}
+	else
+	{
+		if ( strlen( text ) != 4 )
+			return false;
+		for ( int i = 0; i < 4; ++i )
+		{
+			if ( text[i] < '0' || text[i] > '9' )
+				return false;
+			values[i] = text[i] - '0';
+		}
+	}
+
+	rule->survive_low = values[0];
+	rule->survive_high = values[1];
+	rule->birth_low = values[2];
+	rule->birth_high = values[3];
+	for ( int i = 0; i < 4; ++i )
+	{
+		if ( values[i] < 0 || values[i] > 26 )
+			return false;
+	}
+	return true;
+}
+
+void read_args_3d( int argc, char* argv[], int* iterations, int* print_modulo,
+                   int size[3], LifeRule* rule, long* seed, int* percent,
+                   int* threads, int proc_id )
+{
+	parse_rule( "4555", rule );
+	*seed = 0;
+	*percent = 20;
+	*threads = 1;
+
+	int opt;
+	bool bad_option = false;
+	while ( ( opt = getopt( argc, argv, "r:s:p:t:" ) ) != -1 )
+	{
+		switch ( opt )
+		{
+		case 'r':
+			bad_option |= !parse_rule( optarg, rule );
+			break;
+		case 's':
+			*seed = strtol( optarg, NULL, 10 );
+			break;
+		case 'p':
+			*percent = strtol( optarg, NULL, 10 );
+			bad_option |= *percent < 0 || *percent > 100;
+			break;
+		case 't':
+			*threads = strtol( optarg, NULL, 10 );
+			bad_option |= *threads < 1;
+			break;
+		default:
+			bad_option = true;
+			break;
+		}
+	}
+
+	if ( bad_option || argc - optind != 5 )
+	{
+		if ( proc_id == 0 )
+		{
+			fprintf( stderr,
+			         "USAGE: ./%s [-r rule] [-s seed] [-p percent] [-t threads]\n"
+			         "\tj k x y z\n"
+			         "\tj is the number of iterations\n"
+			         "\tk is how often to report the live cells\n"
+			         "\tx, y and z are the size of the game field\n"
+			         "\t-r is the rule, survival low/high then birth low/high\n"
+			         "\t   (4555 by default, or with commas like 5,7,6,6)\n"
+			         "\t-s seeds the random game field\n"
+			         "\t-p is the percentage of cells alive at the start\n"
+			         "\t-t is the number of threads per processor\n",
+			         argv[0] );
+		}
+		MPI_Abort( MPI_COMM_WORLD, 1 );
+	}
+
+	*iterations = strtol( argv[optind], NULL, 10 );
+	*print_modulo = strtol( argv[optind + 1], NULL, 10 );
+	for ( int d = 0; d < 3; ++d )
+		size[d] = strtol( argv[optind + 2 + d], NULL, 10 );
+}
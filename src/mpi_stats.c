@@ -0,0 +1,557 @@
+/* File:    mpi_stats.c
+ *
+ * Purpose: Counts the messages a program sends, without touching its code.
+ *          Built as libmpi_stats.so and loaded ahead of MPI with LD_PRELOAD,
+ *          it stands in for the point to point calls (persistent ones and
+ *          MPI_Put too, so every halo transport shows up), the waits, the
+ *          barrier and the collectives, notes what each one moved and how long
+ *          it took, and hands over to the real call through its PMPI_ name.
+ *
+ *          For every call it keeps the number of calls, the bytes handed in
+ *          and the seconds spent inside. Every message sent is also counted
+ *          against the processor it went to (as its rank in MPI_COMM_WORLD,
+ *          whatever communicator it went over) and against its size, in
+ *          power of two steps. At MPI_Finalize the counts are added up on
+ *          rank 0, which prints them with the messages and bytes between
+ *          every pair of processors.
+ *
+ *          The wrappers keep no locks, so only one thread may call MPI at a
+ *          time, which is how life and ping_pong use it.
+ */
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Sizes of 0 bytes, then [1, 2), [2, 4) ... and everything from 2^30 up
+#define SIZE_BUCKETS 32
+
+typedef enum MpiCall
+{
+	CALL_SEND,
+	CALL_RECV,
+	CALL_ISEND,
+	CALL_IRECV,
+	CALL_WAIT,
+	CALL_WAITALL,
+	CALL_SENDRECV,
+	CALL_START,
+	CALL_STARTALL,
+	CALL_PUT,
+	CALL_BARRIER,
+	CALL_BCAST,
+	CALL_REDUCE,
+	CALL_ALLREDUCE,
+	CALL_GATHER,
+	CALL_GATHERV,
+	CALL_SCATTER,
+	CALL_SCATTERV,
+	CALL_ALLGATHER,
+	CALL_ALLTOALL,
+	CALL_ALLTOALLV,
+	NUM_CALLS
+} MpiCall;
+
+static const char* call_names[NUM_CALLS] = {
+  "MPI_Send",      "MPI_Recv",      "MPI_Isend",     "MPI_Irecv",
+  "MPI_Wait",      "MPI_Waitall",   "MPI_Sendrecv",  "MPI_Start",
+  "MPI_Startall",  "MPI_Put",       "MPI_Barrier",
+  "MPI_Bcast",     "MPI_Reduce",    "MPI_Allreduce", "MPI_Gather",
+  "MPI_Gatherv",   "MPI_Scatter",   "MPI_Scatterv",  "MPI_Allgather",
+  "MPI_Alltoall",  "MPI_Alltoallv" };
+
+// A persistent send, which only goes anywhere when it is started
+typedef struct PersistentSend
+{
+	MPI_Request request;
+	int peer;
+	long long bytes;
+} PersistentSend;
+
+typedef struct MpiStats
+{
+	int rank;
+	int size;
+	// Calls and bytes as doubles, so all three add up in one reduction
+	double calls[NUM_CALLS];
+	double bytes[NUM_CALLS];
+	double seconds[NUM_CALLS];
+	double sizes[SIZE_BUCKETS];
+	// Messages and bytes sent to each processor, side by side
+	double* sent;
+	PersistentSend* persistent;
+	int num_persistent;
+} MpiStats;
+
+static MpiStats stats;
+
+// Sets up on the first call, since MPI_Init itself is left alone
+static void stats_start( void )
+{
+	if ( stats.sent != NULL )
+		return;
+	PMPI_Comm_rank( MPI_COMM_WORLD, &stats.rank );
+	PMPI_Comm_size( MPI_COMM_WORLD, &stats.size );
+	stats.sent = calloc( 2 * stats.size, sizeof( double ) );
+}
+
+static long long type_bytes( int count, MPI_Datatype datatype )
+{
+	int type_size;
+	PMPI_Type_size( datatype, &type_size );
+	return (long long)count * type_size;
+}
+
+static void record_call( MpiCall call, long long bytes, double started )
+{
+	stats_start();
+	stats.calls[call]++;
+	stats.bytes[call] += bytes;
+	stats.seconds[call] += PMPI_Wtime() - started;
+}
+
+// The rank in MPI_COMM_WORLD of a rank in the group (which it frees)
+static int world_rank( int rank, MPI_Group group )
+{
+	int peer;
+	MPI_Group world_group;
+	PMPI_Comm_group( MPI_COMM_WORLD, &world_group );
+	PMPI_Group_translate_ranks( group, 1, &rank, world_group, &peer );
+	PMPI_Group_free( &group );
+	PMPI_Group_free( &world_group );
+	return peer;
+}
+
+// The rank in MPI_COMM_WORLD of a message's destination, or MPI_PROC_NULL
+static int message_peer( int dest, MPI_Comm comm )
+{
+	if ( dest == MPI_PROC_NULL || comm == MPI_COMM_WORLD )
+		return dest;
+	MPI_Group group;
+	PMPI_Comm_group( comm, &group );
+	int peer = world_rank( dest, group );
+	return peer == MPI_UNDEFINED ? MPI_PROC_NULL : peer;
+}
+
+// Counts one message against the processor it goes to and its size
+static void record_message( int peer, long long bytes )
+{
+	if ( peer == MPI_PROC_NULL )
+		return;
+	stats_start();
+
+	stats.sent[2 * peer]++;
+	stats.sent[2 * peer + 1] += bytes;
+
+	int bucket = 0;
+	while ( bucket < SIZE_BUCKETS - 1 && ( 1LL << bucket ) <= bytes )
+		++bucket;
+	stats.sizes[bucket]++;
+}
+
+int MPI_Send( const void* buf, int count, MPI_Datatype datatype, int dest,
+              int tag, MPI_Comm comm )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Send( buf, count, datatype, dest, tag, comm );
+	long long bytes = type_bytes( count, datatype );
+	record_call( CALL_SEND, bytes, started );
+	record_message( message_peer( dest, comm ), bytes );
+	return result;
+}
+
+int MPI_Recv( void* buf, int count, MPI_Datatype datatype, int source,
+              int tag, MPI_Comm comm, MPI_Status* status )
+{
+	// The size is only known once it arrives
+	MPI_Status own_status;
+	if ( status == MPI_STATUS_IGNORE )
+		status = &own_status;
+	double started = PMPI_Wtime();
+	int result = PMPI_Recv( buf, count, datatype, source, tag, comm, status );
+	int received = 0;
+	PMPI_Get_count( status, MPI_BYTE, &received );
+	record_call( CALL_RECV, received, started );
+	return result;
+}
+
+int MPI_Isend( const void* buf, int count, MPI_Datatype datatype, int dest,
+               int tag, MPI_Comm comm, MPI_Request* request )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Isend( buf, count, datatype, dest, tag, comm, request );
+	long long bytes = type_bytes( count, datatype );
+	record_call( CALL_ISEND, bytes, started );
+	record_message( message_peer( dest, comm ), bytes );
+	return result;
+}
+
+int MPI_Irecv( void* buf, int count, MPI_Datatype datatype, int source,
+               int tag, MPI_Comm comm, MPI_Request* request )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Irecv( buf, count, datatype, source, tag, comm, request );
+	// The room given for it, as what arrives is only known at the wait
+	record_call( CALL_IRECV, type_bytes( count, datatype ), started );
+	return result;
+}
+
+int MPI_Wait( MPI_Request* request, MPI_Status* status )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Wait( request, status );
+	record_call( CALL_WAIT, 0, started );
+	return result;
+}
+
+int MPI_Waitall( int count, MPI_Request array_of_requests[],
+                 MPI_Status array_of_statuses[] )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Waitall( count, array_of_requests, array_of_statuses );
+	record_call( CALL_WAITALL, 0, started );
+	return result;
+}
+
+int MPI_Sendrecv( const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                  int dest, int sendtag, void* recvbuf, int recvcount,
+                  MPI_Datatype recvtype, int source, int recvtag,
+                  MPI_Comm comm, MPI_Status* status )
+{
+	double started = PMPI_Wtime();
+	int result =
+	  PMPI_Sendrecv( sendbuf, sendcount, sendtype, dest, sendtag, recvbuf,
+	                 recvcount, recvtype, source, recvtag, comm, status );
+	long long bytes = type_bytes( sendcount, sendtype );
+	record_call( CALL_SENDRECV, bytes, started );
+	record_message( message_peer( dest, comm ), bytes );
+	return result;
+}
+
+int MPI_Send_init( const void* buf, int count, MPI_Datatype datatype, int dest,
+                   int tag, MPI_Comm comm, MPI_Request* request )
+{
+	int result =
+	  PMPI_Send_init( buf, count, datatype, dest, tag, comm, request );
+	// Only counted once started, so just remembered for now
+	stats.persistent =
+	  realloc( stats.persistent,
+	           ( stats.num_persistent + 1 ) * sizeof( PersistentSend ) );
+	PersistentSend* send = &stats.persistent[stats.num_persistent++];
+	send->request = *request;
+	send->peer = message_peer( dest, comm );
+	send->bytes = type_bytes( count, datatype );
+	return result;
+}
+
+// Counts a started request if it is a persistent send; returns its bytes
+static long long record_start( MPI_Request request )
+{
+	for ( int i = 0; i < stats.num_persistent; ++i )
+	{
+		if ( stats.persistent[i].request == request )
+		{
+			record_message( stats.persistent[i].peer, stats.persistent[i].bytes );
+			return stats.persistent[i].bytes;
+		}
+	}
+	return 0;
+}
+
+int MPI_Start( MPI_Request* request )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Start( request );
+	long long bytes = record_start( *request );
+	record_call( CALL_START, bytes, started );
+	return result;
+}
+
+int MPI_Startall( int count, MPI_Request array_of_requests[] )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Startall( count, array_of_requests );
+	long long bytes = 0;
+	for ( int i = 0; i < count; ++i )
+		bytes += record_start( array_of_requests[i] );
+	record_call( CALL_STARTALL, bytes, started );
+	return result;
+}
+
+int MPI_Request_free( MPI_Request* request )
+{
+	// Forget it first, since freeing resets the handle
+	for ( int i = 0; i < stats.num_persistent; ++i )
+	{
+		if ( stats.persistent[i].request == *request )
+		{
+			stats.persistent[i] = stats.persistent[--stats.num_persistent];
+			break;
+		}
+	}
+	return PMPI_Request_free( request );
+}
+
+int MPI_Put( const void* origin_addr, int origin_count,
+             MPI_Datatype origin_datatype, int target_rank,
+             MPI_Aint target_disp, int target_count,
+             MPI_Datatype target_datatype, MPI_Win win )
+{
+	double started = PMPI_Wtime();
+	int result =
+	  PMPI_Put( origin_addr, origin_count, origin_datatype, target_rank,
+	            target_disp, target_count, target_datatype, win );
+	long long bytes = type_bytes( origin_count, origin_datatype );
+	record_call( CALL_PUT, bytes, started );
+	if ( target_rank != MPI_PROC_NULL )
+	{
+		MPI_Group group;
+		PMPI_Win_get_group( win, &group );
+		int peer = world_rank( target_rank, group );
+		record_message( peer == MPI_UNDEFINED ? MPI_PROC_NULL : peer, bytes );
+	}
+	return result;
+}
+
+int MPI_Barrier( MPI_Comm comm )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Barrier( comm );
+	record_call( CALL_BARRIER, 0, started );
+	return result;
+}
+
+// The collectives count what this processor hands in, not what goes between
+// the processors inside them, which is up to the MPI library
+
+int MPI_Bcast( void* buffer, int count, MPI_Datatype datatype, int root,
+               MPI_Comm comm )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Bcast( buffer, count, datatype, root, comm );
+	record_call( CALL_BCAST, type_bytes( count, datatype ), started );
+	return result;
+}
+
+int MPI_Reduce( const void* sendbuf, void* recvbuf, int count,
+                MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Reduce( sendbuf, recvbuf, count, datatype, op, root, comm );
+	record_call( CALL_REDUCE, type_bytes( count, datatype ), started );
+	return result;
+}
+
+int MPI_Allreduce( const void* sendbuf, void* recvbuf, int count,
+                   MPI_Datatype datatype, MPI_Op op, MPI_Comm comm )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Allreduce( sendbuf, recvbuf, count, datatype, op, comm );
+	record_call( CALL_ALLREDUCE, type_bytes( count, datatype ), started );
+	return result;
+}
+
+int MPI_Gather( const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                void* recvbuf, int recvcount, MPI_Datatype recvtype, int root,
+                MPI_Comm comm )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Gather( sendbuf, sendcount, sendtype, recvbuf, recvcount,
+	                          recvtype, root, comm );
+	record_call( CALL_GATHER, type_bytes( sendcount, sendtype ), started );
+	return result;
+}
+
+int MPI_Gatherv( const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                 void* recvbuf, const int recvcounts[], const int displs[],
+                 MPI_Datatype recvtype, int root, MPI_Comm comm )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Gatherv( sendbuf, sendcount, sendtype, recvbuf,
+	                           recvcounts, displs, recvtype, root, comm );
+	record_call( CALL_GATHERV, type_bytes( sendcount, sendtype ), started );
+	return result;
+}
+
+int MPI_Scatter( const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                 void* recvbuf, int recvcount, MPI_Datatype recvtype, int root,
+                 MPI_Comm comm )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Scatter( sendbuf, sendcount, sendtype, recvbuf,
+	                           recvcount, recvtype, root, comm );
+	// Only the root hands anything in
+	int rank, size;
+	PMPI_Comm_rank( comm, &rank );
+	PMPI_Comm_size( comm, &size );
+	long long bytes =
+	  rank == root ? type_bytes( sendcount, sendtype ) * size : 0;
+	record_call( CALL_SCATTER, bytes, started );
+	return result;
+}
+
+int MPI_Scatterv( const void* sendbuf, const int sendcounts[],
+                  const int displs[], MPI_Datatype sendtype, void* recvbuf,
+                  int recvcount, MPI_Datatype recvtype, int root,
+                  MPI_Comm comm )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Scatterv( sendbuf, sendcounts, displs, sendtype, recvbuf,
+	                            recvcount, recvtype, root, comm );
+	int rank, size;
+	PMPI_Comm_rank( comm, &rank );
+	PMPI_Comm_size( comm, &size );
+	long long bytes = 0;
+	for ( int proc = 0; rank == root && proc < size; ++proc )
+		bytes += type_bytes( sendcounts[proc], sendtype );
+	record_call( CALL_SCATTERV, bytes, started );
+	return result;
+}
+
+int MPI_Allgather( const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                   void* recvbuf, int recvcount, MPI_Datatype recvtype,
+                   MPI_Comm comm )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Allgather( sendbuf, sendcount, sendtype, recvbuf,
+	                             recvcount, recvtype, comm );
+	record_call( CALL_ALLGATHER, type_bytes( sendcount, sendtype ), started );
+	return result;
+}
+
+int MPI_Alltoall( const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                  void* recvbuf, int recvcount, MPI_Datatype recvtype,
+                  MPI_Comm comm )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Alltoall( sendbuf, sendcount, sendtype, recvbuf,
+	                            recvcount, recvtype, comm );
+	int size;
+	PMPI_Comm_size( comm, &size );
+	record_call( CALL_ALLTOALL, type_bytes( sendcount, sendtype ) * size,
+	             started );
+	return result;
+}
+
+int MPI_Alltoallv( const void* sendbuf, const int sendcounts[],
+                   const int sdispls[], MPI_Datatype sendtype, void* recvbuf,
+                   const int recvcounts[], const int rdispls[],
+                   MPI_Datatype recvtype, MPI_Comm comm )
+{
+	double started = PMPI_Wtime();
+	int result = PMPI_Alltoallv( sendbuf, sendcounts, sdispls, sendtype,
+	                             recvbuf, recvcounts, rdispls, recvtype, comm );
+	int size;
+	PMPI_Comm_size( comm, &size );
+	long long bytes = 0;
+	for ( int proc = 0; proc < size; ++proc )
+		bytes += type_bytes( sendcounts[proc], sendtype );
+	record_call( CALL_ALLTOALLV, bytes, started );
+	return result;
+}
+
+// Prints a whole number of bytes with a unit that keeps it short
+static void print_bytes( double bytes, int width )
+{
+	const char* units[] = { "B", "K", "M", "G", "T" };
+	int unit = 0;
+	while ( bytes >= 1024 && unit < 4 )
+	{
+		bytes /= 1024;
+		++unit;
+	}
+	if ( unit == 0 )
+		printf( " %*.0f%s", width - 1, bytes, units[unit] );
+	else
+		printf( " %*.1f%s", width - 1, bytes, units[unit] );
+}
+
+static void print_matrix( const double* all_sent, int size, int column )
+{
+	printf( "  %5s", "from" );
+	for ( int to = 0; to < size; ++to )
+		printf( " %7d", to );
+	printf( "\n" );
+	for ( int from = 0; from < size; ++from )
+	{
+		printf( "  %5d", from );
+		for ( int to = 0; to < size; ++to )
+		{
+			double value = all_sent[2 * ( from * size + to ) + column];
+			if ( column == 0 )
+				printf( " %7.0f", value );
+			else
+				print_bytes( value, 7 );
+		}
+		printf( "\n" );
+	}
+}
+
+int MPI_Finalize( void )
+{
+	stats_start();
+
+	// Everything but the matrix adds up in one go
+	double local[3 * NUM_CALLS + SIZE_BUCKETS];
+	double total[3 * NUM_CALLS + SIZE_BUCKETS];
+	for ( int call = 0; call < NUM_CALLS; ++call )
+	{
+		local[call] = stats.calls[call];
+		local[NUM_CALLS + call] = stats.bytes[call];
+		local[2 * NUM_CALLS + call] = stats.seconds[call];
+	}
+	for ( int bucket = 0; bucket < SIZE_BUCKETS; ++bucket )
+		local[3 * NUM_CALLS + bucket] = stats.sizes[bucket];
+	PMPI_Reduce( local, total, 3 * NUM_CALLS + SIZE_BUCKETS, MPI_DOUBLE, MPI_SUM,
+	             0, MPI_COMM_WORLD );
+
+	double* all_sent = stats.rank == 0
+	                     ? malloc( 2 * stats.size * stats.size * sizeof( double ) )
+	                     : NULL;
+	PMPI_Gather( stats.sent, 2 * stats.size, MPI_DOUBLE, all_sent,
+	             2 * stats.size, MPI_DOUBLE, 0, MPI_COMM_WORLD );
+
+	if ( stats.rank == 0 )
+	{
+		printf( "MPI calls over %d processors (calls, bytes handed in, "
+		        "seconds):\n",
+		        stats.size );
+		for ( int call = 0; call < NUM_CALLS; ++call )
+		{
+			// Calls nobody made are left out
+			if ( total[call] == 0 )
+				continue;
+			printf( "  %-14s %10.0f", call_names[call], total[call] );
+			print_bytes( total[NUM_CALLS + call], 9 );
+			printf( " %12.6f\n", total[2 * NUM_CALLS + call] );
+		}
+
+		printf( "Messages sent by size (bytes: messages):\n" );
+		for ( int bucket = 0; bucket < SIZE_BUCKETS; ++bucket )
+		{
+			double messages = total[3 * NUM_CALLS + bucket];
+			if ( messages == 0 )
+				continue;
+			if ( bucket == 0 )
+				printf( "  %23s: %.0f\n", "0", messages );
+			else if ( bucket == SIZE_BUCKETS - 1 )
+				printf( "  %10lld and larger: %.0f\n", 1LL << ( bucket - 1 ),
+				        messages );
+			else
+				printf( "  %10lld to %10lld: %.0f\n", 1LL << ( bucket - 1 ),
+				        ( 1LL << bucket ) - 1, messages );
+		}
+
+		printf( "Messages sent between processors (from row to column):\n" );
+		print_matrix( all_sent, stats.size, 0 );
+		printf( "Bytes sent between processors (from row to column):\n" );
+		print_matrix( all_sent, stats.size, 1 );
+		fflush( stdout );
+	}
+
+	free( all_sent );
+	free( stats.sent );
+	free( stats.persistent );
+	stats.sent = NULL;
+	return PMPI_Finalize();
+}
@@ -0,0 +1,384 @@
+/* File:    packed.c
+ *
+ * Purpose: The "packed" kernel, which plays in a layout of its own instead of
+ *          the row-major bool boards: square tiles of 8 x 8 cells, each
+ *          packed into the bits of a uint64_t (bit 8 * row + col), with the
+ *          tiles stored in Morton (Z) order. A tile's neighbours above and
+ *          below are then usually close by in memory rather than a whole
+ *          board row away, and all 64 cells of a tile are updated at once by
+ *          adding up their eight neighbours with bitwise operations.
+ *
+ *          The bool boards are only packed at the start of a round and
+ *          unpacked at the end, when the rows are wanted for an exchange or
+ *          for printing, so with a deep halo (-d) every generation in between
+ *          stays in the packed layout. The packed board itself, Morton order
+ *          and all, is only built when the cells being played change, and is
+ *          kept from one round to the next: the halo game tells us which rows
+ *          nobody else has written since (kept_cells), which are left as they
+ *          are, and which rows it will not look at before the next round
+ *          (hidden_cells), which are left packed. Between rounds only the
+ *          ghost rows then go in and the boundary rows out. The original game
+ *          hands the whole board around every iteration, so there it packs
+ *          every generation.
+ */
+
+#include <stdlib.h>
+
+#include "life.h"
+
+#define TILE_EDGE 8
+
+// Columns 0 and 7 of a tile
+#define WEST_COLUMN 0x0101010101010101ULL
+#define EAST_COLUMN 0x8080808080808080ULL
+
+typedef struct PackedBoard
+{
+	// What the board was built for
+	ProcInfo cells;
+	int width;
+	int height;
+	// Board row of the top of the first row of tiles
+	int first_row;
+	int tile_rows;
+	int tile_cols;
+	int num_tiles;
+	// Morton order position of the tile at tile_row * tile_cols + tile_col,
+	// and the tile at each position
+	int* position;
+	int* tile_at;
+	// The cells of each tile (by position) that are being played
+	uint64_t* played;
+	uint64_t* tiles[2];
+	// The tiles the last round ended in, and the bool board it returned
+	int current;
+	bool* returned;
+} PackedBoard;
+
+typedef struct PackedTask
+{
+	PackedBoard* board;
+	ProcInfo* cells;
+	bool* game_state;
+	int generation;
+	// Cells left alone by the packing and unpacking respectively
+	ProcInfo kept;
+	ProcInfo hidden;
+} PackedTask;
+
+typedef struct MortonTile
+{
+	uint64_t code;
+	int tile;
+} MortonTile;
+
+static void packed_apply( LifeStep* step );
+static void packed_advance( LifeStep* step, int generations );
+
+// The board of the last round played on this thread; -L plays every rank of
+// the game on a thread of its own
+static _Thread_local PackedBoard packed_board;
+
+const LifeKernel packed_kernel = { "packed", packed_apply, NULL,
+                                   packed_advance };
+
+// Spreads the bits of value out to every other bit
+static uint64_t spread_bits( uint32_t value )
+{
+	uint64_t bits = value;
+	bits = ( bits | ( bits << 16 ) ) & 0x0000ffff0000ffffULL;
+	bits = ( bits | ( bits << 8 ) ) & 0x00ff00ff00ff00ffULL;
+	bits = ( bits | ( bits << 4 ) ) & 0x0f0f0f0f0f0f0f0fULL;
+	bits = ( bits | ( bits << 2 ) ) & 0x3333333333333333ULL;
+	bits = ( bits | ( bits << 1 ) ) & 0x5555555555555555ULL;
+	return bits;
+}
+
+static int compare_morton( const void* a, const void* b )
+{
+	uint64_t code_a = ( (const MortonTile*)a )->code;
+	uint64_t code_b = ( (const MortonTile*)b )->code;
+	return ( code_a > code_b ) - ( code_a < code_b );
+}
+
+// Each cell gets the cell to its west, with column 0 coming from the tile to
+// the west, and so on for the other directions
+static uint64_t from_west( uint64_t tile, uint64_t west )
+{
+	return ( ( tile << 1 ) & ~WEST_COLUMN ) | ( ( west >> 7 ) & WEST_COLUMN );
+}
+
+static uint64_t from_east( uint64_t tile, uint64_t east )
+{
+	return ( ( tile >> 1 ) & ~EAST_COLUMN ) | ( ( east << 7 ) & EAST_COLUMN );
+}
+
+static uint64_t from_north( uint64_t tile, uint64_t north )
+{
+	return ( tile << 8 ) | ( north >> 56 );
+}
+
+static uint64_t from_south( uint64_t tile, uint64_t south )
+{
+	return ( tile >> 8 ) | ( south << 56 );
+}
+
+// Plays a tile given it and its neighbours, 3 x 3 row by row
+static uint64_t play_tile( const uint64_t around[9] )
+{
+	uint64_t tile = around[4];
+	uint64_t west = from_west( tile, around[3] );
+	uint64_t east = from_east( tile, around[5] );
+	uint64_t neighbours[8] = {
+	  from_north( west, from_west( around[1], around[0] ) ),
+	  from_north( tile, around[1] ),
+	  from_north( east, from_east( around[1], around[2] ) ),
+	  west,
+	  east,
+	  from_south( west, from_west( around[7], around[6] ) ),
+	  from_south( tile, around[7] ),
+	  from_south( east, from_east( around[7], around[8] ) ),
+	};
+	return apply_rules_to_bits( neighbours, tile );
+}
+
+static uint64_t tile_or_dead( PackedBoard* board, uint64_t* tiles, int tile_row,
+                              int tile_col )
+{
+	if ( tile_row < 0 || tile_row >= board->tile_rows || tile_col < 0 ||
+	     tile_col >= board->tile_cols )
+		return 0;
+	return tiles[board->position[tile_row * board->tile_cols + tile_col]];
+}
+
+static bool inside( const ProcInfo* range, int cell )
+{
+	return cell >= range->offset && cell < range->offset + range->num_cells;
+}
+
+// Packs the cells of the game state outside the kept ones, which are still
+// in the tiles (and may be out of date in the game state). Cells that are not
+// played are the same in both tile arrays.
+static void pack_task( int thread, int num_threads, void* arg )
+{
+	PackedTask* task = arg;
+	PackedBoard* board = task->board;
+	uint64_t* tiles = board->tiles[board->current];
+	ProcInfo all = { 0, board->num_tiles };
+	ProcInfo share = split_cells( &all, thread, num_threads );
+
+	for ( int pos = share.offset; pos < share.offset + share.num_cells; ++pos )
+	{
+		int tile = board->tile_at[pos];
+		int top = board->first_row + ( tile / board->tile_cols ) * TILE_EDGE;
+		int left = ( tile % board->tile_cols ) * TILE_EDGE;
+		int bottom = top + TILE_EDGE < board->height ? top + TILE_EDGE
+		                                             : board->height;
+		if ( inside( &task->kept, top * board->width ) &&
+		     inside( &task->kept, bottom * board->width - 1 ) )
+			continue;
+
+		uint64_t cells = 0;
+		for ( int r = 0; top + r < bottom; ++r )
+		{
+			for ( int c = 0; c < TILE_EDGE && left + c < board->width; ++c )
+			{
+				int index = ( top + r ) * board->width + left + c;
+				uint64_t bit = 1ULL << ( r * TILE_EDGE + c );
+				if ( inside( &task->kept, index ) ? tiles[pos] & bit
+				                                  : task->game_state[index] )
+					cells |= bit;
+			}
+		}
+		board->tiles[0][pos] = cells;
+		board->tiles[1][pos] = cells;
+	}
+}
+
+static void unpack_task( int thread, int num_threads, void* arg )
+{
+	PackedTask* task = arg;
+	PackedBoard* board = task->board;
+	uint64_t* tiles = board->tiles[board->current];
+	ProcInfo all = { 0, board->num_tiles };
+	ProcInfo share = split_cells( &all, thread, num_threads );
+
+	for ( int pos = share.offset; pos < share.offset + share.num_cells; ++pos )
+	{
+		int tile = board->tile_at[pos];
+		int top = board->first_row + ( tile / board->tile_cols ) * TILE_EDGE;
+		int left = ( tile % board->tile_cols ) * TILE_EDGE;
+		for ( int bit = 0; bit < TILE_EDGE * TILE_EDGE; ++bit )
+		{
+			int index = ( top + bit / TILE_EDGE ) * board->width + left +
+			            bit % TILE_EDGE;
+			if ( ( board->played[pos] >> bit & 1 ) &&
+			     !inside( &task->hidden, index ) )
+				task->game_state[index] = tiles[pos] >> bit & 1;
+		}
+	}
+}
+
+// Plays one generation of every tile in our share of the Morton order, which
+// is a compact block of the board
+static void generation_task( int thread, int num_threads, void* arg )
+{
+	PackedTask* task = arg;
+	PackedBoard* board = task->board;
+	uint64_t* last_tiles =
+	  board->tiles[( board->current + task->generation ) % 2];
+	uint64_t* new_tiles =
+	  board->tiles[( board->current + task->generation + 1 ) % 2];
+	ProcInfo all = { 0, board->num_tiles };
+	ProcInfo share = split_cells( &all, thread, num_threads );
+
+	for ( int pos = share.offset; pos < share.offset + share.num_cells; ++pos )
+	{
+		uint64_t played = board->played[pos];
+		if ( played == 0 )
+			continue;
+
+		int tile_row = board->tile_at[pos] / board->tile_cols;
+		int tile_col = board->tile_at[pos] % board->tile_cols;
+		uint64_t around[9];
+		for ( int i = 0; i < 9; ++i )
+			around[i] = tile_or_dead( board, last_tiles, tile_row + i / 3 - 1,
+			                          tile_col + i % 3 - 1 );
+
+		// Cells that are not being played keep whatever they had, which for
+		// the edges of the game field is dead
+		new_tiles[pos] = ( play_tile( around ) & played ) |
+		                 ( new_tiles[pos] & ~played );
+	}
+}
+
+// Covers the cells and the rows either side of them that they read
+static void packed_board_init( PackedBoard* board, LifeStep* step )
+{
+	int width = step->width;
+	int first_row = step->cells.offset / width - 1;
+	int last_row = ( step->cells.offset + step->cells.num_cells - 1 ) / width + 1;
+	if ( first_row < 0 )
+		first_row = 0;
+	if ( last_row > step->height - 1 )
+		last_row = step->height - 1;
+
+	board->cells = step->cells;
+	board->width = width;
+	board->height = step->height;
+	board->first_row = first_row - first_row % TILE_EDGE;
+	board->tile_rows = ( last_row - board->first_row ) / TILE_EDGE + 1;
+	board->tile_cols = ( width + TILE_EDGE - 1 ) / TILE_EDGE;
+	board->num_tiles = board->tile_rows * board->tile_cols;
+
+	int num_tiles = board->num_tiles;
+	MortonTile* order = malloc( num_tiles * sizeof( MortonTile ) );
+	for ( int tile = 0; tile < num_tiles; ++tile )
+	{
+		order[tile].code = spread_bits( tile / board->tile_cols ) << 1 |
+		                   spread_bits( tile % board->tile_cols );
+		order[tile].tile = tile;
+	}
+	qsort( order, num_tiles, sizeof( MortonTile ), compare_morton );
+
+	board->position = malloc( num_tiles * sizeof( int ) );
+	board->tile_at = malloc( num_tiles * sizeof( int ) );
+	for ( int pos = 0; pos < num_tiles; ++pos )
+	{
+		board->tile_at[pos] = order[pos].tile;
+		board->position[order[pos].tile] = pos;
+	}
+	free( order );
+
+	// Which cells of each tile get played
+	int start_cell = step->cells.offset;
+	int end_cell = start_cell + step->cells.num_cells;
+	board->played = malloc( num_tiles * sizeof( uint64_t ) );
+	for ( int pos = 0; pos < num_tiles; ++pos )
+	{
+		int tile = board->tile_at[pos];
+		int top = board->first_row + ( tile / board->tile_cols ) * TILE_EDGE;
+		int left = ( tile % board->tile_cols ) * TILE_EDGE;
+		uint64_t played = 0;
+		for ( int r = 0; r < TILE_EDGE && top + r < board->height; ++r )
+		{
+			for ( int c = 0; c < TILE_EDGE && left + c < width; ++c )
+			{
+				int index = ( top + r ) * width + left + c;
+				if ( index >= start_cell && index < end_cell )
+					played |= 1ULL << ( r * TILE_EDGE + c );
+			}
+		}
+		board->played[pos] = played;
+	}
+
+	board->tiles[0] = malloc( num_tiles * sizeof( uint64_t ) );
+	board->tiles[1] = malloc( num_tiles * sizeof( uint64_t ) );
+	board->current = 0;
+	board->returned = NULL;
+}
+
+static bool packed_board_fits( PackedBoard* board, LifeStep* step )
+{
+	return board->tiles[0] != NULL && board->width == step->width &&
+	       board->height == step->height &&
+	       board->cells.offset == step->cells.offset &&
+	       board->cells.num_cells == step->cells.num_cells;
+}
+
+static void packed_board_free( PackedBoard* board )
+{
+	free( board->position );
+	free( board->tile_at );
+	free( board->played );
+	free( board->tiles[0] );
+	free( board->tiles[1] );
+}
+
+// Plays the generations, leaving the last one in the cells of
+// last_game_state if there was an even number of them, new_game_state if odd
+static void packed_run( LifeStep* step, int generations )
+{
+	PackedBoard* board = &packed_board;
+	ProcInfo none = { 0, 0 };
+	PackedTask task = { board, &step->cells, step->last_game_state, 0, none,
+	                    step->hidden_cells };
+
+	// The kept cells are only still in the tiles if the last round played the
+	// same cells and handed back the board we start from
+	if ( !packed_board_fits( board, step ) )
+	{
+		packed_board_free( board );
+		packed_board_init( board, step );
+	}
+	else if ( step->last_game_state == board->returned )
+		task.kept = step->kept_cells;
+
+	worker_pool_run( step->pool, pack_task, &task );
+	for ( task.generation = 0; task.generation < generations; ++task.generation )
+		worker_pool_run( step->pool, generation_task, &task );
+	board->current = ( board->current + generations ) % 2;
+
+	task.game_state = generations % 2 == 0 ? step->last_game_state
+	                                        : step->new_game_state;
+	worker_pool_run( step->pool, unpack_task, &task );
+	board->returned = task.game_state;
+}
+
+static void packed_apply( LifeStep* step )
+{
+	packed_run( step, 1 );
+	if ( step->boundary_done != NULL )
+		step->boundary_done( step->boundary_arg );
+}
+
+static void packed_advance( LifeStep* step, int generations )
+{
+	packed_run( step, generations );
+	if ( generations % 2 == 1 )
+	{
+		bool* temp_game_state = step->last_game_state;
+		step->last_game_state = step->new_game_state;
+		step->new_game_state = temp_game_state;
+	}
+}
@@ -0,0 +1,301 @@
+/* File:    predict.c
+ *
+ * Purpose: Predicts how long a generation of the halo game takes on 1, 2,
+ *          4 ... processors before playing it (-P), and recommends how many
+ *          to ask for. Three things are measured first:
+ *
+ *          - the kernel's cell updates per second, with every processor
+ *            playing its own rows on its own (no messages), the slowest of
+ *            them counting;
+ *          - the latency lambda and bandwidth B of messages between
+ *            processors 0 and 1, by ping pong at a range of sizes, fitted to
+ *            lambda + n / B by least squares;
+ *          - nothing for the geometry, which follows from the board: with p
+ *            processors each owns height / p rows (the last one the rest
+ *            too), plays depth - 1 more rows on either side that has a
+ *            neighbour, and once a round swaps depth x width cells with each
+ *            neighbour, both ways at once.
+ *
+ *          A generation then takes the slowest processor's cells over the
+ *          kernel's rate, plus lambda + the cells it sends over B, all over
+ *          the depth. The recommendation is the fastest number of processors
+ *          that is still at least half efficient. The model assumes every
+ *          processor gets a core of its own and that every pair talks as fast
+ *          as processors 0 and 1 did.
+ *
+ *          Once the game is over, the time it took per generation is set
+ *          against the prediction for the number of processors it was played
+ *          on. Printing the board is part of that time but not of the model,
+ *          so the prediction is only fair when k is large.
+ */
+
+#include <stdlib.h>
+
+#include "life.h"
+
+// Every processor plays at least this many cell updates to time the kernel,
+// in whole rounds
+#define PREDICT_UPDATES ( 1 << 20 )
+#define PREDICT_RUNS 2
+// Round trips per message size, the fastest of which counts
+#define PING_PONGS 20
+#define PING_PONG_SIZES 7
+#define MAX_PREDICTED_PROCESSORS 4096
+#define MIN_RECOMMENDED_EFFICIENCY 0.5
+
+typedef struct Prediction
+{
+	int width;
+	int height;
+	int halo_depth;
+	double cell_updates_per_second;
+	// Seconds; bandwidth in bytes (cells) per second, 0 for free
+	double latency;
+	double bandwidth;
+	// What was predicted for the game about to be played
+	double seconds_per_generation;
+	double started;
+} Prediction;
+
+static Prediction prediction;
+
+// Times the kernel on this processor's rows, with no neighbours to wait on
+static double measure_kernel( LifeOptions* options, int live_cells,
+                              int width, int height, const LifeKernel* kernel,
+                              LifeStep* step )
+{
+	int world_rank, world_size;
+	MPI_Comm_rank( MPI_COMM_WORLD, &world_rank );
+	MPI_Comm_size( MPI_COMM_WORLD, &world_size );
+
+	int num_rows = height / world_size;
+	if ( world_rank == world_size - 1 )
+		num_rows += height % world_size;
+	int depth = options->halo_depth;
+	int generations = PREDICT_UPDATES / ( (long long)width * num_rows );
+	generations = ( generations / depth + 1 ) * depth;
+
+	double fastest = 0;
+	for ( int run = 0; run < PREDICT_RUNS; ++run )
+	{
+		double seconds = time_halo_game(
+		  MPI_COMM_SELF, (long long)live_cells * num_rows / height, generations,
+		  width, num_rows, options->seed < 0 ? options->seed
+		                                     : options->seed + world_rank,
+		  depth, get_halo_transport( 0 ), kernel, step );
+		if ( run == 0 || seconds < fastest )
+			fastest = seconds;
+	}
+	double rate = (double)width * num_rows * generations / fastest;
+	double slowest;
+	MPI_Allreduce( &rate, &slowest, 1, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD );
+	return slowest;
+}
+
+// Ping pongs between processors 0 and 1 and fits lambda + n / B to the
+// fastest one-way time at each size
+static void measure_network( void )
+{
+	int world_rank, world_size;
+	MPI_Comm_rank( MPI_COMM_WORLD, &world_rank );
+	MPI_Comm_size( MPI_COMM_WORLD, &world_size );
+
+	prediction.latency = 0;
+	prediction.bandwidth = 0;
+	if ( world_size < 2 )
+		return;
+
+	// 8 bytes to 2 MB, which covers every halo message worth predicting
+	int sizes[PING_PONG_SIZES];
+	double times[PING_PONG_SIZES];
+	sizes[0] = 8;
+	for ( int s = 1; s < PING_PONG_SIZES; ++s )
+		sizes[s] = sizes[s - 1] * 8;
+	char* buffer = calloc( sizes[PING_PONG_SIZES - 1], 1 );
+
+	MPI_Barrier( MPI_COMM_WORLD );
+	for ( int s = 0; s < PING_PONG_SIZES; ++s )
+	{
+		times[s] = 0;
+		for ( int trip = 0; trip < PING_PONGS && world_rank < 2; ++trip )
+		{
+			double started = MPI_Wtime();
+			if ( world_rank == 0 )
+			{
+				MPI_Send( buffer, sizes[s], MPI_CHAR, 1, 0, MPI_COMM_WORLD );
+				MPI_Recv( buffer, sizes[s], MPI_CHAR, 1, 0, MPI_COMM_WORLD,
+				          MPI_STATUS_IGNORE );
+			}
+			else
+			{
+				MPI_Recv( buffer, sizes[s], MPI_CHAR, 0, 0, MPI_COMM_WORLD,
+				          MPI_STATUS_IGNORE );
+				MPI_Send( buffer, sizes[s], MPI_CHAR, 0, 0, MPI_COMM_WORLD );
+			}
+			double one_way = ( MPI_Wtime() - started ) / 2;
+			if ( trip == 0 || one_way < times[s] )
+				times[s] = one_way;
+		}
+	}
+	free( buffer );
+
+	// Least squares line through (n, t), weighted by 1 / t^2 so the small
+	// messages count as much as the big ones: the intercept is lambda and the
+	// slope 1 / B
+	double weights = 0, mean_size = 0, mean_time = 0;
+	for ( int s = 0; s < PING_PONG_SIZES; ++s )
+	{
+		double weight = 1 / ( times[s] * times[s] );
+		weights += weight;
+		mean_size += weight * sizes[s];
+		mean_time += weight * times[s];
+	}
+	mean_size /= weights;
+	mean_time /= weights;
+	double covariance = 0, variance = 0;
+	for ( int s = 0; s < PING_PONG_SIZES; ++s )
+	{
+		double weight = 1 / ( times[s] * times[s] );
+		covariance +=
+		  weight * ( sizes[s] - mean_size ) * ( times[s] - mean_time );
+		variance += weight * ( sizes[s] - mean_size ) * ( sizes[s] - mean_size );
+	}
+	double slope = covariance / variance;
+	double fit[2] = { mean_time - slope * mean_size,
+	                  slope > 0 ? 1 / slope : 0 };
+	if ( fit[0] < 0 )
+		fit[0] = 0;
+	MPI_Bcast( fit, 2, MPI_DOUBLE, 0, MPI_COMM_WORLD );
+	prediction.latency = fit[0];
+	prediction.bandwidth = fit[1];
+}
+
+// Seconds per generation on p processors, split into computing and
+// exchanging, for whichever processor is slowest
+static void predict_generation( int processors, double* computing,
+                                double* exchanging )
+{
+	int width = prediction.width;
+	int depth = prediction.halo_depth;
+	int extra_rows = depth - 1;
+	int normal_rows = prediction.height / processors;
+	int last_rows = normal_rows + prediction.height % processors;
+
+	// The last processor has the spare rows but only one neighbour; the ones
+	// in the middle (if any) have two
+	double played_rows = last_rows + ( processors > 1 ? extra_rows : 0 );
+	if ( processors > 2 && normal_rows + 2 * extra_rows > played_rows )
+		played_rows = normal_rows + 2 * extra_rows;
+	int neighbours = processors > 2 ? 2 : processors - 1;
+
+	*computing = played_rows * width / prediction.cell_updates_per_second;
+	*exchanging = 0;
+	if ( neighbours > 0 )
+	{
+		*exchanging = prediction.latency;
+		if ( prediction.bandwidth > 0 )
+		{
+			*exchanging +=
+			  (double)neighbours * depth * width / prediction.bandwidth;
+		}
+		*exchanging /= depth;
+	}
+}
+
+void predict_open( LifeOptions* options, int live_cells, int width,
+                   int height, const LifeKernel* kernel, LifeStep* step )
+{
+	int world_rank, world_size;
+	MPI_Comm_rank( MPI_COMM_WORLD, &world_rank );
+	MPI_Comm_size( MPI_COMM_WORLD, &world_size );
+
+	// Too few rows for the depth; the game will say so itself
+	if ( height / world_size < options->halo_depth )
+		return;
+
+	prediction.width = width;
+	prediction.height = height;
+	prediction.halo_depth = options->halo_depth;
+	prediction.cell_updates_per_second =
+	  measure_kernel( options, live_cells, width, height, kernel, step );
+	measure_network();
+
+	double computing, exchanging;
+	predict_generation( 1, &computing, &exchanging );
+	double single = computing + exchanging;
+	predict_generation( world_size, &computing, &exchanging );
+	prediction.seconds_per_generation = computing + exchanging;
+
+	if ( world_rank == 0 )
+	{
+		printf( "Prediction for the halo game (%d x %d, kernel %s, depth %d, "
+		        "transport %s):\n",
+		        width, height, kernel->name, options->halo_depth,
+		        options->transport );
+		printf( "  kernel:  %.4g cell updates per second per processor\n",
+		        prediction.cell_updates_per_second );
+		if ( world_size < 2 )
+			printf( "  network: not measured on one processor, taken as free\n" );
+		else
+		{
+			printf( "  network: %.3g us latency, %.4g MB/s bandwidth (processors "
+			        "0 and 1)\n",
+			        prediction.latency * 1e6, prediction.bandwidth / 1e6 );
+		}
+		printf( "  %10s %22s %12s %12s %10s\n", "processors",
+		        "seconds per generation", "computing", "exchanging",
+		        "efficiency" );
+
+		// Powers of two for as long as every processor gets depth rows, with
+		// the processors this game is played on in between
+		int recommended = 1;
+		double recommended_seconds = single;
+		int last = 0;
+		for ( int power = 1; last < MAX_PREDICTED_PROCESSORS; power *= 2 )
+		{
+			int p = last < world_size && world_size < power ? world_size : power;
+			if ( height / p < options->halo_depth )
+				break;
+			predict_generation( p, &computing, &exchanging );
+			double seconds = computing + exchanging;
+			double efficiency = single / ( seconds * p );
+			printf( "  %10d %22.6g %12.6g %12.6g %10.4f%s\n", p, seconds,
+			        computing, exchanging, efficiency,
+			        p == world_size ? " (this game)" : "" );
+			if ( efficiency >= MIN_RECOMMENDED_EFFICIENCY &&
+			     seconds < recommended_seconds )
+			{
+				recommended = p;
+				recommended_seconds = seconds;
+			}
+			if ( p != power )
+				power /= 2;
+			last = p;
+		}
+		printf( "Recommended: %d processor(s), %.6g seconds per generation\n",
+		        recommended, recommended_seconds );
+		fflush( stdout );
+	}
+
+	MPI_Barrier( MPI_COMM_WORLD );
+	prediction.started = MPI_Wtime();
+}
+
+void predict_close( int iterations )
+{
+	if ( prediction.started == 0 )
+		return;
+
+	MPI_Barrier( MPI_COMM_WORLD );
+	int world_rank;
+	MPI_Comm_rank( MPI_COMM_WORLD, &world_rank );
+	if ( world_rank == 0 && iterations > 0 )
+	{
+		double measured = ( MPI_Wtime() - prediction.started ) / iterations;
+		printf( "Predicted %.6g seconds per generation, took %.6g (error "
+		        "%+.1f%%)\n",
+		        prediction.seconds_per_generation, measured,
+		        100 * ( prediction.seconds_per_generation - measured ) / measured );
+	}
+	prediction.started = 0;
+}
@@ -0,0 +1,151 @@
+/* File:    rules.c
+ *
+ * Purpose: The rules of the game, played a cell, a row or 64 cells at a
+ *          time, and filling and printing game fields. Every version of the
+ *          game and every kernel builds on these, and so does the kernel
+ *          benchmark, which is why they are kept apart from life.c's main.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "life.h"
+
+void apply_rules( ProcInfo* proc_data, bool* last_game_state,
+                  bool* new_game_state, int world_rank, int* adjacency_offsets,
+                  int width, int height )
+{
+	for ( int idx = 0; idx < proc_data[world_rank].num_cells; ++idx )
+	{
+		int curr_cell_index = proc_data[world_rank].offset + idx;
+		int alive_adj_cells = 0;
+		for ( int adj_ind = 0; adj_ind < 8; ++adj_ind )
+		{
+			int offset = adjacency_offsets[adj_ind];
+			// Check the following:
+			//     Current adjacent cell is not off the top or bottom edges
+			//     Current adjacent cell is not off the left or right edges
+			//     Current adjacent cell is alive
+			//
+			//      Top Edge
+			if ( curr_cell_index + offset >= 0 &&
+			     // Bottom edge
+			     curr_cell_index + offset < width * height &&
+			     // Left and Right edges
+			     // If the left/right adjacent cells overflow to another
+			     // row, then the differnce between their column numbers
+			     // is greater than 1 -- otherwise it is 1 or 0
+			     abs( ( curr_cell_index % width ) -
+			          ( ( curr_cell_index + offset ) % width ) ) <= 1 &&
+			     // Currently checked adjacent cell is alive
+			     last_game_state[curr_cell_index + offset] )
+			{
+				alive_adj_cells++;
+			}
+		}
+
+		if ( last_game_state[curr_cell_index] )
+		{
+			if ( alive_adj_cells == 2 || alive_adj_cells == 3 )
+				new_game_state[curr_cell_index] = true;
+			else
+				new_game_state[curr_cell_index] = false;
+		}
+		else
+		{
+			if ( alive_adj_cells == 3 )
+				new_game_state[curr_cell_index] = true;
+			else
+				new_game_state[curr_cell_index] = false;
+		}
+	}
+}
+
+// Plays one row into new_row, given the old state of it and the rows above
+// and below it (dead rows past the edges), for when the rows are not all in
+// one board
+void apply_rules_to_row( const bool* above, const bool* row, const bool* below,
+                         bool* new_row, int width )
+{
+	for ( int col = 0; col < width; ++col )
+	{
+		int alive_adj_cells = above[col] + below[col];
+		if ( col > 0 )
+			alive_adj_cells += above[col - 1] + row[col - 1] + below[col - 1];
+		if ( col < width - 1 )
+			alive_adj_cells += above[col + 1] + row[col + 1] + below[col + 1];
+
+		if ( row[col] )
+			new_row[col] = alive_adj_cells == 2 || alive_adj_cells == 3;
+		else
+			new_row[col] = alive_adj_cells == 3;
+	}
+}
+
+// Plays 64 cells at once, one to a bit: neighbours[i] holds the i-th
+// neighbour of every cell, lined up with the cells in alive
+uint64_t apply_rules_to_bits( const uint64_t neighbours[8], uint64_t alive )
+{
+	// Count the live neighbours of every cell at once, modulo 8 (eight live
+	// neighbours come out as none, which is just as dead)
+	uint64_t ones = 0, twos = 0, fours = 0;
+	for ( int i = 0; i < 8; ++i )
+	{
+		uint64_t carry = ones & neighbours[i];
+		ones ^= neighbours[i];
+		fours ^= twos & carry;
+		twos ^= carry;
+	}
+
+	// Alive with two or three live neighbours, or dead with three
+	return twos & ~fours & ( ones | alive );
+}
+
+void print_game( bool* game_field, int width, int height )
+{
+	for ( int i = 0; i < height; ++i )
+	{
+		for ( int j = 0; j < width; ++j )
+		{
+			if ( game_field[i * width + j] )
+			{
+				printf( "█" );
+			}
+			else
+			{
+				printf( "." );
+			}
+		}
+		printf( "\n" );
+	}
+}
+
+void fill_game_field( bool* field, int width, int height, int live_cells,
+                      long seed )
+{
+	int cells_to_generate = live_cells;
+	srand( seed < 0 ? time( NULL ) : seed );
+	fill_game_cells( field, 0, (long long)width * height,
+	                 (long long)width * height, live_cells, &cells_to_generate );
+}
+
+// Fills the next num_cells cells (starting at first_cell) of a field that is
+// being filled in order, so one too big for memory can be filled in pieces
+void fill_game_cells( bool* cells, long long first_cell, long long num_cells,
+                      long long total_cells, int live_cells,
+                      int* cells_to_generate )
+{
+	for ( long long i = first_cell; i < first_cell + num_cells; ++i )
+	{
+		// Fill the cell if we have to fill the rest of the cells
+		// or we can generate it randomly
+		if ( *cells_to_generate > 0 &&
+		     ( total_cells - ( i + 1 ) == *cells_to_generate ||
+		       rand() % total_cells < live_cells ) )
+		{
+			cells[i - first_cell] = true;
+			( *cells_to_generate )--;
+		}
+	}
+}
@@ -0,0 +1,125 @@
+/* File:    scaling.c
+ *
+ * Purpose: Measures how the halo game scales (-S), in one mpiexec. The game
+ *          is played on 1, 2, 4 ... processors (and all of them, if that is
+ *          not a power of two), each time over a communicator of just the
+ *          first that many processors while the rest wait. Every size plays
+ *          twice: once on the same m x n board (strong scaling), and once on
+ *          an m x n board per processor (weak scaling). Nothing is printed
+ *          along the way and the board is never gathered, so only the rules
+ *          and the halo exchanges are timed.
+ *
+ *          The results are printed as CSV, one line per game, with the cell
+ *          updates per second and the parallel efficiency: the time on one
+ *          processor over the time on p of them times p for strong scaling,
+ *          and over the time on p of them for weak scaling.
+ */
+
+#include <stdlib.h>
+
+#include "life.h"
+
+// Plays the halo game headless on comm; returns the seconds it took, from
+// the first processor to start to the last to finish. The autotuner times
+// its setups with it too.
+double time_halo_game( MPI_Comm comm, int live_cells, int iterations,
+                       int width, int height, long seed, int halo_depth,
+                       const HaloTransport* transport,
+                       const LifeKernel* kernel, LifeStep* step )
+{
+	LifeComm ranks;
+	comm_from_mpi( &ranks, comm );
+	int rank = ranks.rank;
+
+	Slab slab;
+	slab_decompose( &slab, &ranks, width, height, halo_depth );
+	slab.pool = step->pool;
+	slab.num_boards = kernel->in_place ? 1 : 2;
+	slab.quiet = true;
+	transport->init( &slab );
+
+	// Every processor fills its own rows with its share of the live cells
+	fill_game_field( slab.last_game_state + halo_depth * width, width,
+	                 slab.num_rows,
+	                 (long long)live_cells * slab.num_rows / height,
+	                 seed < 0 ? seed : seed + rank );
+	step->height = slab.num_rows + 2 * halo_depth;
+	step->boundary_done = NULL;
+
+	MPI_Barrier( comm );
+	double started = MPI_Wtime();
+	for ( int iteration = 0; iteration < iterations; )
+	{
+		int generations = halo_depth;
+		if ( generations > iterations - iteration )
+			generations = iterations - iteration;
+
+		transport->exchange( &slab );
+		step->cells = slab_round_cells( &slab, generations );
+		step->last_game_state = slab.last_game_state;
+		step->new_game_state = slab.new_game_state;
+		advance_generations( kernel, step, generations );
+		slab.last_game_state = step->last_game_state;
+		slab.new_game_state = step->new_game_state;
+		iteration += generations;
+	}
+	MPI_Barrier( comm );
+	double seconds = MPI_Wtime() - started;
+
+	transport->finalize( &slab );
+	return seconds;
+}
+
+void play_scaling_game( int live_cells, int iterations, int width, int height,
+                        long seed, int halo_depth,
+                        const HaloTransport* transport,
+                        const LifeKernel* kernel, LifeStep* step )
+{
+	int world_rank, world_size;
+	MPI_Comm_rank( MPI_COMM_WORLD, &world_rank );
+	MPI_Comm_size( MPI_COMM_WORLD, &world_size );
+
+	if ( world_rank == 0 )
+	{
+		printf( "scaling,processors,width,height,iterations,seconds,"
+		        "cell_updates_per_second,speedup,efficiency\n" );
+	}
+
+	// Times on one processor, strong then weak
+	double single[2] = { 0, 0 };
+	for ( int size = 1;; size = size * 2 > world_size ? world_size : size * 2 )
+	{
+		MPI_Comm comm;
+		MPI_Comm_split( MPI_COMM_WORLD, world_rank < size ? 0 : MPI_UNDEFINED,
+		                world_rank, &comm );
+		if ( comm != MPI_COMM_NULL )
+		{
+			for ( int weak = 0; weak < 2; ++weak )
+			{
+				int game_height = weak ? height * size : height;
+				int game_cells = weak ? live_cells * size : live_cells;
+				double seconds =
+				  time_halo_game( comm, game_cells, iterations, width, game_height,
+				                  seed, halo_depth, transport, kernel, step );
+				if ( size == 1 )
+					single[weak] = seconds;
+
+				if ( world_rank == 0 )
+				{
+					double speedup = single[weak] / seconds;
+					if ( weak )
+						speedup *= size;
+					printf( "%s,%d,%d,%d,%d,%.6f,%.6g,%.4f,%.4f\n",
+					        weak ? "weak" : "strong", size, width, game_height,
+					        iterations, seconds,
+					        (double)width * game_height * iterations / seconds,
+					        speedup, speedup / size );
+					fflush( stdout );
+				}
+			}
+			MPI_Comm_free( &comm );
+		}
+		if ( size == world_size )
+			break;
+	}
+}
@@ -0,0 +1,555 @@
+/* File:    server.c
+ *
+ * Purpose: The server game (-l), which starts MPI once and then plays games
+ *          asked for over a UNIX socket until told to quit, so short games
+ *          don't each pay for starting mpiexec. Every line sent to the socket
+ *          is a request:
+ *
+ *              seed live_cells width height iterations [rule] [board]
+ *
+ *          with the rule in B/S notation (B3/S23 if left out), and "board"
+ *          to have the board on the last iteration sent back as well as the
+ *          numbers. The answer starts with the request's number on its
+ *          connection, then the final population, the period the game
+ *          settled into and the iteration it died out on, as in the batch
+ *          game (batch.c), which plays the games. "stats" answers with the
+ *          latency percentiles so far, and "quit" finishes whatever is still
+ *          being played and stops the server.
+ *
+ *          The controller does all the talking: it waits on the socket and
+ *          its connections with poll, hands each request to an idle worker
+ *          (or plays it itself with a single processor), and sends the
+ *          answer back once the worker's result comes in. Requests wait in a
+ *          queue while every worker is busy. The latency of a request is from
+ *          the moment its line is read to the moment its answer is written.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "life.h"
+
+#define SERVER_MAX_CLIENTS 64
+#define SERVER_LINE_LENGTH 256
+// Largest board a request may ask for: 4096 x 4096. A worker holds the
+// whole board, and the games count their cells in an int
+#define SERVER_MAX_CELLS ( 1 << 24 )
+
+typedef struct Client
+{
+	// -1 if the slot is free
+	int fd;
+	char line[SERVER_LINE_LENGTH];
+	int line_length;
+	// Set once the line being read has run past the end of line
+	bool line_too_long;
+	// Requests read on this connection, and those not answered yet
+	int num_requests;
+	int pending;
+	// Cleared once the client has sent everything it is going to
+	bool reading;
+} Client;
+
+typedef struct Request
+{
+	BatchJob job;
+	int client;
+	int number;
+	double arrived;
+} Request;
+
+typedef struct LifeServer
+{
+	int world_size;
+	WorkerPool* pool;
+	MPI_Datatype job_type;
+	MPI_Datatype result_type;
+	int listen_fd;
+	Client clients[SERVER_MAX_CLIENTS];
+	// Waiting requests, first in first out
+	Request* queue;
+	int queue_start;
+	int queue_length;
+	int queue_capacity;
+	// What each worker rank is playing, and how many are playing something
+	Request* running;
+	bool* worker_busy;
+	int num_busy;
+	// Seconds from reading each request to answering it
+	double* latencies;
+	int num_latencies;
+	int max_latencies;
+	bool quitting;
+} LifeServer;
+
+static void send_text( LifeServer* server, int client, const char* text,
+                       size_t length )
+{
+	Client* c = &server->clients[client];
+	while ( length > 0 && c->fd >= 0 )
+	{
+		ssize_t sent = send( c->fd, text, length, MSG_NOSIGNAL );
+		if ( sent < 0 && errno == EINTR )
+			continue;
+		if ( sent <= 0 )
+		{
+			// Gone; the rest of its answers are dropped
+			c->reading = false;
+			break;
+		}
+		text += sent;
+		length -= sent;
+	}
+}
+
+static void close_finished_client( LifeServer* server, int client )
+{
+	Client* c = &server->clients[client];
+	if ( c->fd >= 0 && !c->reading && c->pending == 0 )
+	{
+		close( c->fd );
+		c->fd = -1;
+	}
+}
+
+// Nearest rank, so p99 of fewer than 100 requests is the slowest one
+static double percentile( double* sorted, int count, double p )
+{
+	int rank = (int)ceil( p / 100 * count );
+	return sorted[rank < 1 ? 0 : rank - 1];
+}
+
+static int compare_doubles( const void* a, const void* b )
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return ( x > y ) - ( x < y );
+}
+
+static void format_stats( LifeServer* server, char* text, size_t size )
+{
+	int count = server->num_latencies;
+	if ( count == 0 )
+	{
+		snprintf( text, size, "0 requests\n" );
+		return;
+	}
+
+	double* sorted = malloc( count * sizeof( double ) );
+	memcpy( sorted, server->latencies, count * sizeof( double ) );
+	qsort( sorted, count, sizeof( double ), compare_doubles );
+	snprintf( text, size,
+	          "%d requests, latency p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, "
+	          "max %.3f ms\n",
+	          count, percentile( sorted, count, 50 ) * 1e3,
+	          percentile( sorted, count, 90 ) * 1e3,
+	          percentile( sorted, count, 99 ) * 1e3, sorted[count - 1] * 1e3 );
+	free( sorted );
+}
+
+static void answer( LifeServer* server, Request* request, BatchResult* result,
+                    bool* board )
+{
+	char text[SERVER_LINE_LENGTH];
+	int length = snprintf( text, sizeof( text ), "%d %lld %d %d %d\n",
+	                       request->number, result->population, result->period,
+	                       result->died_on, result->generations );
+	send_text( server, request->client, text, length );
+
+	if ( board != NULL )
+	{
+		// Same characters as print_game
+		int width = request->job.width;
+		char* row = malloc( (size_t)width * 3 + 1 );
+		for ( int y = 0; y < request->job.height; ++y )
+		{
+			char* c = row;
+			for ( int x = 0; x < width; ++x )
+			{
+				const char* cell = board[(size_t)y * width + x] ? "█" : ".";
+				size_t cell_length = strlen( cell );
+				memcpy( c, cell, cell_length );
+				c += cell_length;
+			}
+			*c++ = '\n';
+			send_text( server, request->client, row, c - row );
+		}
+		free( row );
+	}
+
+	if ( server->num_latencies == server->max_latencies )
+	{
+		server->max_latencies *= 2;
+		server->latencies =
+		  realloc( server->latencies, server->max_latencies * sizeof( double ) );
+	}
+	server->latencies[server->num_latencies++] = MPI_Wtime() - request->arrived;
+
+	server->clients[request->client].pending--;
+	close_finished_client( server, request->client );
+}
+
+static bool* board_for( BatchJob* job )
+{
+	return job->want_board
+	         ? malloc( (size_t)job->width * job->height * sizeof( bool ) )
+	         : NULL;
+}
+
+// Turns a line from a client into a request, or answers it straight away
+static void handle_line( LifeServer* server, int client, char* line )
+{
+	Client* c = &server->clients[client];
+	char first[16];
+	if ( sscanf( line, " %15s", first ) != 1 )
+		return;
+	if ( strcmp( first, "quit" ) == 0 )
+	{
+		server->quitting = true;
+		return;
+	}
+	if ( strcmp( first, "stats" ) == 0 )
+	{
+		char text[SERVER_LINE_LENGTH];
+		format_stats( server, text, sizeof( text ) );
+		send_text( server, client, text, strlen( text ) );
+		return;
+	}
+
+	Request request;
+	BatchJob* job = &request.job;
+	memset( job, 0, sizeof( *job ) );
+	strcpy( job->rule, "B3/S23" );
+	char extra[2][32];
+	int fields = sscanf( line, "%ld %d %d %d %d %31s %31s", &job->seed,
+	                     &job->live_cells, &job->width, &job->height,
+	                     &job->iterations, extra[0], extra[1] );
+	long long cells = (long long)job->width * job->height;
+	bool valid = fields >= 5 && job->width > 0 && job->height > 0 &&
+	             job->iterations >= 0 && job->live_cells >= 0 &&
+	             job->live_cells <= cells;
+	for ( int i = 0; valid && i < fields - 5; ++i )
+	{
+		bool next_state[2][9];
+		if ( strcmp( extra[i], "board" ) == 0 )
+			job->want_board = true;
+		else if ( parse_life_rule( extra[i], next_state ) )
+			strcpy( job->rule, extra[i] );
+		else
+			valid = false;
+	}
+	if ( !valid )
+	{
+		const char* usage =
+		  "error: expected \"seed live_cells width height iterations [rule] "
+		  "[board]\", \"stats\" or \"quit\"\n";
+		send_text( server, client, usage, strlen( usage ) );
+		return;
+	}
+	if ( cells > SERVER_MAX_CELLS )
+	{
+		char text[SERVER_LINE_LENGTH];
+		snprintf( text, sizeof( text ),
+		          "error: boards can have at most %d cells\n",
+		          SERVER_MAX_CELLS );
+		send_text( server, client, text, strlen( text ) );
+		return;
+	}
+
+	request.client = client;
+	request.number = ++c->num_requests;
+	request.arrived = MPI_Wtime();
+	c->pending++;
+
+	if ( server->queue_length == server->queue_capacity )
+	{
+		// Grow, straightening the ring out as we go
+		Request* queue =
+		  malloc( 2 * server->queue_capacity * sizeof( Request ) );
+		for ( int i = 0; i < server->queue_length; ++i )
+		{
+			queue[i] =
+			  server->queue[( server->queue_start + i ) % server->queue_capacity];
+		}
+		free( server->queue );
+		server->queue = queue;
+		server->queue_start = 0;
+		server->queue_capacity *= 2;
+	}
+	server->queue[( server->queue_start + server->queue_length ) %
+	              server->queue_capacity] = request;
+	server->queue_length++;
+}
+
+static void read_client( LifeServer* server, int client )
+{
+	Client* c = &server->clients[client];
+	char buffer[4096];
+	ssize_t length = recv( c->fd, buffer, sizeof( buffer ), 0 );
+	if ( length < 0 && errno == EINTR )
+		return;
+	if ( length <= 0 )
+	{
+		c->reading = false;
+		close_finished_client( server, client );
+		return;
+	}
+
+	for ( ssize_t i = 0; i < length; ++i )
+	{
+		if ( buffer[i] == '\n' )
+		{
+			c->line[c->line_length] = '\0';
+			if ( c->line_too_long )
+			{
+				char text[SERVER_LINE_LENGTH];
+				snprintf( text, sizeof( text ),
+				          "error: lines can be at most %d characters long\n",
+				          SERVER_LINE_LENGTH - 1 );
+				send_text( server, client, text, strlen( text ) );
+			}
+			else
+				handle_line( server, client, c->line );
+			c->line_length = 0;
+			c->line_too_long = false;
+		}
+		// Whatever fits of a line that long would be misread, so the whole
+		// line gets turned down when it ends
+		else if ( c->line_length < SERVER_LINE_LENGTH - 1 )
+		{
+			c->line[c->line_length++] = buffer[i];
+		}
+		else
+			c->line_too_long = true;
+	}
+}
+
+static void accept_client( LifeServer* server )
+{
+	int fd = accept( server->listen_fd, NULL, NULL );
+	if ( fd < 0 )
+		return;
+
+	for ( int client = 0; client < SERVER_MAX_CLIENTS; ++client )
+	{
+		Client* c = &server->clients[client];
+		if ( c->fd < 0 )
+		{
+			memset( c, 0, sizeof( *c ) );
+			c->fd = fd;
+			c->reading = true;
+			return;
+		}
+	}
+
+	const char* full = "error: too many connections\n";
+	send( fd, full, strlen( full ), MSG_NOSIGNAL );
+	close( fd );
+}
+
+// Hands waiting requests to idle workers, or plays them here if there are none
+static void dispatch( LifeServer* server )
+{
+	while ( server->queue_length > 0 )
+	{
+		Request* request = &server->queue[server->queue_start];
+		if ( server->world_size == 1 )
+		{
+			bool* board = board_for( &request->job );
+			BatchResult result = play_batch_job( &request->job, server->pool, board );
+			answer( server, request, &result, board );
+			free( board );
+		}
+		else
+		{
+			int worker = 1;
+			while ( worker < server->world_size && server->worker_busy[worker] )
+				++worker;
+			if ( worker == server->world_size )
+				return;
+
+			MPI_Send( &request->job, 1, server->job_type, worker, BATCH_JOB,
+			          MPI_COMM_WORLD );
+			server->running[worker] = *request;
+			server->worker_busy[worker] = true;
+			server->num_busy++;
+		}
+		server->queue_start = ( server->queue_start + 1 ) % server->queue_capacity;
+		server->queue_length--;
+	}
+}
+
+static void collect_results( LifeServer* server )
+{
+	int finished;
+	MPI_Status status;
+	MPI_Iprobe( MPI_ANY_SOURCE, BATCH_RESULT, MPI_COMM_WORLD, &finished,
+	            &status );
+	while ( finished )
+	{
+		int worker = status.MPI_SOURCE;
+		Request* request = &server->running[worker];
+		BatchResult result;
+		MPI_Recv( &result, 1, server->result_type, worker, BATCH_RESULT,
+		          MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+		bool* board = board_for( &request->job );
+		if ( board != NULL )
+		{
+			MPI_Recv( board, request->job.width * request->job.height, MPI_C_BOOL,
+			          worker, BATCH_RESULT, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+		}
+		server->worker_busy[worker] = false;
+		server->num_busy--;
+		answer( server, request, &result, board );
+		free( board );
+
+		MPI_Iprobe( MPI_ANY_SOURCE, BATCH_RESULT, MPI_COMM_WORLD, &finished,
+		            &status );
+	}
+}
+
+static void serve( LifeServer* server, const char* path )
+{
+	server->listen_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	struct sockaddr_un address;
+	memset( &address, 0, sizeof( address ) );
+	address.sun_family = AF_UNIX;
+	if ( server->listen_fd < 0 || strlen( path ) >= sizeof( address.sun_path ) )
+	{
+		fprintf( stderr, "Can't listen on %s\n", path );
+		MPI_Abort( MPI_COMM_WORLD, 1 );
+	}
+	strcpy( address.sun_path, path );
+	unlink( path );
+	if ( bind( server->listen_fd, (struct sockaddr*)&address,
+	           sizeof( address ) ) != 0 ||
+	     listen( server->listen_fd, SERVER_MAX_CLIENTS ) != 0 )
+	{
+		fprintf( stderr, "Listening on %s: %s\n", path, strerror( errno ) );
+		MPI_Abort( MPI_COMM_WORLD, 1 );
+	}
+	printf( "Serving on %s with %d workers\n", path,
+	        server->world_size > 1 ? server->world_size - 1 : 1 );
+	fflush( stdout );
+
+	struct pollfd fds[SERVER_MAX_CLIENTS + 1];
+	int fd_client[SERVER_MAX_CLIENTS + 1];
+	while ( !server->quitting || server->queue_length > 0 ||
+	        server->num_busy > 0 )
+	{
+		// Collected first, so workers they free up get the waiting requests
+		collect_results( server );
+		dispatch( server );
+		if ( server->quitting && server->queue_length == 0 &&
+		     server->num_busy == 0 )
+			break;
+
+		// Once quitting, nothing new gets read in
+		int num_fds = 0;
+		if ( !server->quitting )
+		{
+			fds[num_fds].fd = server->listen_fd;
+			fds[num_fds].events = POLLIN;
+			fd_client[num_fds++] = -1;
+			for ( int client = 0; client < SERVER_MAX_CLIENTS; ++client )
+			{
+				if ( server->clients[client].fd >= 0 &&
+				     server->clients[client].reading )
+				{
+					fds[num_fds].fd = server->clients[client].fd;
+					fds[num_fds].events = POLLIN;
+					fd_client[num_fds++] = client;
+				}
+			}
+		}
+
+		// MPI can't wake poll up, so look for results every millisecond
+		// while anyone is busy
+		int ready = poll( fds, num_fds, server->num_busy > 0 ? 1 : -1 );
+		for ( int i = 0; ready > 0 && i < num_fds; ++i )
+		{
+			if ( fds[i].revents == 0 )
+				continue;
+			if ( fd_client[i] < 0 )
+				accept_client( server );
+			else
+				read_client( server, fd_client[i] );
+		}
+	}
+
+	for ( int client = 0; client < SERVER_MAX_CLIENTS; ++client )
+	{
+		if ( server->clients[client].fd >= 0 )
+			close( server->clients[client].fd );
+	}
+	close( server->listen_fd );
+	unlink( path );
+}
+
+void play_server_game( const char* path, WorkerPool* pool )
+{
+	LifeServer server;
+	memset( &server, 0, sizeof( server ) );
+	MPI_Comm_size( MPI_COMM_WORLD, &server.world_size );
+	server.pool = pool;
+	batch_types_create( &server.job_type, &server.result_type );
+
+	int world_rank;
+	MPI_Comm_rank( MPI_COMM_WORLD, &world_rank );
+	if ( world_rank != 0 )
+	{
+		// Play whatever we're given until told to stop
+		BatchJob job;
+		MPI_Recv( &job, 1, server.job_type, 0, BATCH_JOB, MPI_COMM_WORLD,
+		          MPI_STATUS_IGNORE );
+		while ( job.index >= 0 )
+		{
+			bool* board = board_for( &job );
+			BatchResult result = play_batch_job( &job, pool, board );
+			MPI_Send( &result, 1, server.result_type, 0, BATCH_RESULT,
+			          MPI_COMM_WORLD );
+			if ( board != NULL )
+			{
+				MPI_Send( board, job.width * job.height, MPI_C_BOOL, 0, BATCH_RESULT,
+				          MPI_COMM_WORLD );
+			}
+			free( board );
+			MPI_Recv( &job, 1, server.job_type, 0, BATCH_JOB, MPI_COMM_WORLD,
+			          MPI_STATUS_IGNORE );
+		}
+	}
+	else
+	{
+		for ( int client = 0; client < SERVER_MAX_CLIENTS; ++client )
+			server.clients[client].fd = -1;
+		server.queue_capacity = 16;
+		server.queue = malloc( server.queue_capacity * sizeof( Request ) );
+		server.running = calloc( server.world_size, sizeof( Request ) );
+		server.worker_busy = calloc( server.world_size, sizeof( bool ) );
+		server.max_latencies = 1024;
+		server.latencies = malloc( server.max_latencies * sizeof( double ) );
+
+		serve( &server, path );
+
+		char text[SERVER_LINE_LENGTH];
+		format_stats( &server, text, sizeof( text ) );
+		printf( "Server: %s", text );
+
+		BatchJob stop = { .index = -1 };
+		for ( int worker = 1; worker < server.world_size; ++worker )
+			MPI_Send( &stop, 1, server.job_type, worker, BATCH_JOB, MPI_COMM_WORLD );
+
+		free( server.queue );
+		free( server.running );
+		free( server.worker_busy );
+		free( server.latencies );
+	}
+
+	MPI_Type_free( &server.job_type );
+	MPI_Type_free( &server.result_type );
+}
@@ -0,0 +1,74 @@
+/* File:    skewed.c
+ *
+ * Purpose: The "skewed" kernel, which plays a whole round of generations with
+ *          time skewing instead of sweeping the board once per generation.
+ *          The rows are cut into bands of -g rows, and each band is taken
+ *          through every generation of the round before moving on to the
+ *          next one, so it stays in cache the whole time rather than being
+ *          read from memory once per generation.
+ *
+ *          A row depends on the rows above and below it one generation
+ *          earlier, so each generation of a band is moved up by a row: band b
+ *          covers rows [b * rows - g, (b + 1) * rows - g) in generation g.
+ *          Everything it needs from above was done by the band before it,
+ *          everything below it it did itself one generation ago, and with
+ *          two boards nothing it overwrites is still needed by anyone, so the
+ *          bands are parallelograms that go down the board one at a time.
+ *          The rows of a band are split between the threads as usual.
+ *
+ *          A single generation (or a depth of 1) is just the plain sweep.
+ */
+
+#include "life.h"
+
+static void skewed_apply( LifeStep* step );
+static void skewed_advance( LifeStep* step, int generations );
+
+const LifeKernel skewed_kernel = { "skewed", skewed_apply, NULL,
+                                   skewed_advance, false, true };
+
+static void skewed_apply( LifeStep* step )
+{
+	static_kernel.apply( step );
+}
+
+// The cells of a round are always whole rows
+static void skewed_advance( LifeStep* step, int generations )
+{
+	int width = step->width;
+	int first_row = step->cells.offset / width;
+	int num_rows = step->cells.num_cells / width;
+	int band_rows = step->tile_size;
+	bool* boards[2] = { step->last_game_state, step->new_game_state };
+
+	LifeStep band = *step;
+	band.boundary_done = NULL;
+	for ( int start = 0; start - ( generations - 1 ) < num_rows;
+	      start += band_rows )
+	{
+		for ( int generation = 0; generation < generations; ++generation )
+		{
+			int low = start - generation;
+			int high = low + band_rows;
+			if ( low < 0 )
+				low = 0;
+			if ( high > num_rows )
+				high = num_rows;
+			if ( high <= low )
+				continue;
+
+			band.cells.offset = ( first_row + low ) * width;
+			band.cells.num_cells = ( high - low ) * width;
+			band.last_game_state = boards[generation % 2];
+			band.new_game_state = boards[( generation + 1 ) % 2];
+			static_kernel.apply( &band );
+		}
+	}
+
+	if ( generations % 2 == 1 )
+	{
+		bool* temp_game_state = step->last_game_state;
+		step->last_game_state = step->new_game_state;
+		step->new_game_state = temp_game_state;
+	}
+}
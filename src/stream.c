@@ -0,0 +1,390 @@
+/* File:    stream.c
+ *
+ * Purpose: The out-of-core game (-o file), for boards that do not fit in the
+ *          memory of all the processors put together. The board lives in a
+ *          file, one byte per cell row by row like the bool boards, and every
+ *          pass streams it through memory a band of rows at a time, writing
+ *          the next board to a second file that then takes its place.
+ *
+ *          A pass plays up to -d generations. Each processor streams its own
+ *          rows plus -d rows either side of them (the file is the halo, so
+ *          there is nothing to exchange), and keeps a window of three rows
+ *          for every generation: as soon as a row of generation g and the
+ *          rows either side of it are in, the row of generation g + 1 above
+ *          it can be played. Only the last generation gets written out, so
+ *          playing d generations a pass cuts the reading and writing by d.
+ *
+ *          Reading the next band and writing the last one happen in the
+ *          background (POSIX asynchronous I/O) while the current band is
+ *          being played.
+ *
+ *          If the file does not exist, a random board is written to it first.
+ */
+
+#include <aio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "life.h"
+
+// Roughly how much of the board each read or write moves
+#define BAND_BYTES ( 4 << 20 )
+
+typedef struct Band
+{
+	struct aiocb request;
+	bool* rows;
+	int first_row;
+	int num_rows;
+	bool pending;
+} Band;
+
+typedef struct StreamGame
+{
+	const char* path;
+	char* next_path;
+	int width;
+	int height;
+	// Our rows of the board
+	int first_row;
+	int num_rows;
+	int band_rows;
+	MPI_Comm comm;
+	// Bookkeeping for the summary printed at the end
+	int passes;
+	long long bytes_read;
+	long long bytes_written;
+} StreamGame;
+
+static void stream_abort( StreamGame* game, const char* what )
+{
+	fprintf( stderr, "%s %s: %s\n", what, game->path, strerror( errno ) );
+	MPI_Abort( game->comm, 1 );
+}
+
+static void band_start( Band* band, int fd, int width, bool write )
+{
+	memset( &band->request, 0, sizeof( band->request ) );
+	band->request.aio_fildes = fd;
+	band->request.aio_buf = band->rows;
+	band->request.aio_nbytes = (size_t)band->num_rows * width;
+	band->request.aio_offset = (off_t)band->first_row * width;
+	if ( ( write ? aio_write( &band->request ) : aio_read( &band->request ) ) !=
+	     0 )
+	{
+		perror( "Starting streamed I/O" );
+		MPI_Abort( MPI_COMM_WORLD, 1 );
+	}
+	band->pending = true;
+}
+
+static void band_wait( Band* band )
+{
+	if ( !band->pending )
+		return;
+
+	const struct aiocb* requests[1] = { &band->request };
+	double waited = MPI_Wtime();
+	while ( aio_error( &band->request ) == EINPROGRESS )
+		aio_suspend( requests, 1, NULL );
+	trace_event( TRACE_IO, waited, -1 );
+	if ( aio_return( &band->request ) != (ssize_t)band->request.aio_nbytes )
+	{
+		fprintf( stderr, "Streamed I/O came up short\n" );
+		MPI_Abort( MPI_COMM_WORLD, 1 );
+	}
+	band->pending = false;
+}
+
+// Writes a random board to the file, a band at a time, the same way the
+// in-memory games fill theirs
+static void create_board( StreamGame* game, int live_cells, long seed )
+{
+	int fd = open( game->path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+	if ( fd < 0 )
+		stream_abort( game, "Creating" );
+
+	long long total_cells = (long long)game->width * game->height;
+	int cells_to_generate = live_cells;
+	srand( seed < 0 ? time( NULL ) : seed );
+	bool* rows = malloc( (size_t)game->band_rows * game->width );
+	for ( int row = 0; row < game->height; row += game->band_rows )
+	{
+		int num_rows = game->height - row < game->band_rows ? game->height - row
+		                                                    : game->band_rows;
+		size_t size = (size_t)num_rows * game->width;
+		memset( rows, 0, size );
+		fill_game_cells( rows, (long long)row * game->width, size, total_cells,
+		                 live_cells, &cells_to_generate );
+		if ( write( fd, rows, size ) != (ssize_t)size )
+			stream_abort( game, "Writing" );
+	}
+	free( rows );
+	close( fd );
+}
+
+static void print_board( StreamGame* game )
+{
+	int fd = open( game->path, O_RDONLY );
+	if ( fd < 0 )
+		stream_abort( game, "Opening" );
+
+	bool* rows = malloc( (size_t)game->band_rows * game->width );
+	for ( int row = 0; row < game->height; row += game->band_rows )
+	{
+		int num_rows = game->height - row < game->band_rows ? game->height - row
+		                                                    : game->band_rows;
+		size_t size = (size_t)num_rows * game->width;
+		if ( pread( fd, rows, size, (off_t)row * game->width ) != (ssize_t)size )
+			stream_abort( game, "Reading" );
+		print_game( rows, game->width, num_rows );
+	}
+	free( rows );
+	close( fd );
+}
+
+// Plays a pass of the given number of generations from the file into the
+// next file
+static void stream_pass( StreamGame* game, int generations )
+{
+	int width = game->width;
+	int height = game->height;
+	int end_row = game->first_row + game->num_rows;
+
+	int in_fd = open( game->path, O_RDONLY );
+	int out_fd = open( game->next_path, O_WRONLY );
+	if ( in_fd < 0 || out_fd < 0 )
+		stream_abort( game, "Opening" );
+
+	// Rows of generation g are good from lowest_row[g] up to (not including)
+	// highest_row[g]; each generation loses a row at either end, except at the
+	// edges of the board, where the dead cells past it stay dead
+	int first_in = game->first_row - generations;
+	int last_in = end_row + generations;
+	if ( first_in < 0 )
+		first_in = 0;
+	if ( last_in > height )
+		last_in = height;
+	int* lowest_row = malloc( ( generations + 1 ) * sizeof( int ) );
+	int* highest_row = malloc( ( generations + 1 ) * sizeof( int ) );
+	for ( int generation = 0; generation <= generations; ++generation )
+	{
+		lowest_row[generation] = first_in == 0 ? 0 : first_in + generation;
+		highest_row[generation] = last_in == height ? height : last_in - generation;
+	}
+
+	// Three rows of every generation, each row r in slot r % 3
+	bool* windows = malloc( (size_t)( generations + 1 ) * 3 * width );
+	bool* dead_row = calloc( width, sizeof( bool ) );
+#define WINDOW_ROW( generation, row )                                          \
+	( windows + ( (size_t)( generation ) * 3 + ( row ) % 3 ) * width )
+#define OLD_ROW( generation, row )                                             \
+	( ( row ) < 0 || ( row ) >= height ? dead_row                                 \
+	                                   : WINDOW_ROW( generation, row ) )
+
+	Band in[2], out[2];
+	for ( int band = 0; band < 2; ++band )
+	{
+		in[band].rows = malloc( (size_t)game->band_rows * width );
+		in[band].pending = false;
+		in[band].num_rows = 0;
+		out[band].rows = malloc( (size_t)game->band_rows * width );
+		out[band].pending = false;
+		out[band].num_rows = 0;
+	}
+
+	// Get the first band coming in
+	int next_in_row = first_in;
+	int in_band = 0, out_band = 0;
+	Band* reading = NULL;
+	Band* writing = NULL;
+	if ( first_in < last_in )
+	{
+		in[0].first_row = first_in;
+		in[0].num_rows =
+		  last_in - first_in < game->band_rows ? last_in - first_in : game->band_rows;
+		band_start( &in[0], in_fd, width, false );
+		next_in_row = first_in + in[0].num_rows;
+	}
+
+	for ( int row = first_in; row < last_in + generations; ++row )
+	{
+		if ( row < last_in )
+		{
+			// Moving on to the next band, which should be in by now, and get
+			// the one after it coming in behind it
+			if ( reading == NULL || row == reading->first_row + reading->num_rows )
+			{
+				reading = &in[in_band];
+				band_wait( reading );
+				game->bytes_read += (long long)reading->num_rows * width;
+				in_band = 1 - in_band;
+				if ( next_in_row < last_in )
+				{
+					Band* next = &in[in_band];
+					next->first_row = next_in_row;
+					next->num_rows = last_in - next_in_row < game->band_rows
+					                   ? last_in - next_in_row
+					                   : game->band_rows;
+					band_start( next, in_fd, width, false );
+					next_in_row += next->num_rows;
+				}
+			}
+			memcpy( WINDOW_ROW( 0, row ),
+			        reading->rows + (size_t)( row - reading->first_row ) * width,
+			        width );
+		}
+
+		// Every generation plays the row just above the last one it can see
+		// all the neighbours of
+		for ( int generation = 1; generation <= generations; ++generation )
+		{
+			int played = row - generation;
+			if ( played < lowest_row[generation] ||
+			     played >= highest_row[generation] )
+				continue;
+			apply_rules_to_row( OLD_ROW( generation - 1, played - 1 ),
+			                    OLD_ROW( generation - 1, played ),
+			                    OLD_ROW( generation - 1, played + 1 ),
+			                    WINDOW_ROW( generation, played ), width );
+		}
+
+		// Our rows of the last generation go out a band at a time
+		int done = row - generations;
+		if ( done < game->first_row || done >= end_row )
+			continue;
+		if ( writing == NULL || writing->num_rows == game->band_rows )
+		{
+			if ( writing != NULL )
+				band_start( writing, out_fd, width, true );
+			writing = &out[out_band];
+			out_band = 1 - out_band;
+			band_wait( writing );
+			writing->first_row = done;
+			writing->num_rows = 0;
+		}
+		memcpy( writing->rows + (size_t)writing->num_rows * width,
+		        WINDOW_ROW( generations, done ), width );
+		writing->num_rows++;
+		game->bytes_written += width;
+	}
+#undef OLD_ROW
+#undef WINDOW_ROW
+
+	if ( writing != NULL )
+		band_start( writing, out_fd, width, true );
+	for ( int band = 0; band < 2; ++band )
+	{
+		band_wait( &in[band] );
+		band_wait( &out[band] );
+		free( in[band].rows );
+		free( out[band].rows );
+	}
+	close( in_fd );
+	close( out_fd );
+	free( windows );
+	free( dead_row );
+	free( lowest_row );
+	free( highest_row );
+}
+
+void play_stream_game( const char* path, int live_cells, int iterations,
+                       int print_modulo, int width, int height,
+                       int generations_per_pass, long seed )
+{
+	int world_rank, world_size;
+	MPI_Comm_rank( MPI_COMM_WORLD, &world_rank );
+	MPI_Comm_size( MPI_COMM_WORLD, &world_size );
+
+	StreamGame game;
+	game.path = path;
+	game.next_path = malloc( strlen( path ) + sizeof( ".next" ) );
+	sprintf( game.next_path, "%s.next", path );
+	game.width = width;
+	game.height = height;
+	game.band_rows = BAND_BYTES / width > 0 ? BAND_BYTES / width : 1;
+	game.comm = MPI_COMM_WORLD;
+	game.passes = 0;
+	game.bytes_read = 0;
+	game.bytes_written = 0;
+
+	// Same split as between threads: equal shares, remainder to the last one
+	ProcInfo all_rows = { 0, height };
+	ProcInfo rows = split_cells( &all_rows, world_rank, world_size );
+	game.first_row = rows.offset;
+	game.num_rows = rows.num_cells;
+
+	// An existing board is played as it is, as long as it is the right size
+	if ( world_rank == 0 )
+	{
+		struct stat status;
+		if ( stat( path, &status ) != 0 )
+		{
+			create_board( &game, live_cells, seed );
+		}
+		else if ( status.st_size != (off_t)width * height )
+		{
+			fprintf( stderr, "%s is not a %d x %d board\n", path, width, height );
+			MPI_Abort( MPI_COMM_WORLD, 1 );
+		}
+	}
+
+	int iteration = 0;
+	for ( ;; )
+	{
+		if ( iteration % print_modulo == 0 && world_rank == 0 )
+		{
+			printf( "Game state on iteration %d:\n", iteration );
+			print_board( &game );
+		}
+
+		if ( iteration == iterations )
+			break;
+
+		// Same rounds as the halo game, with the file as the ghost rows
+		int generations = generations_per_pass;
+		int next_print = ( iteration / print_modulo + 1 ) * print_modulo;
+		if ( generations > next_print - iteration )
+			generations = next_print - iteration;
+		if ( generations > iterations - iteration )
+			generations = iterations - iteration;
+
+		// The next board has to exist at its full size before anyone writes
+		// their part of it
+		if ( world_rank == 0 )
+		{
+			int fd = open( game.next_path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+			if ( fd < 0 || ftruncate( fd, (off_t)width * height ) != 0 )
+				stream_abort( &game, "Creating the next board for" );
+			close( fd );
+		}
+		MPI_Barrier( MPI_COMM_WORLD );
+
+		stream_pass( &game, generations );
+
+		MPI_Barrier( MPI_COMM_WORLD );
+		if ( world_rank == 0 && rename( game.next_path, path ) != 0 )
+			stream_abort( &game, "Replacing" );
+		MPI_Barrier( MPI_COMM_WORLD );
+		game.passes++;
+		iteration += generations;
+	}
+
+	long long local[2] = { game.bytes_read, game.bytes_written };
+	long long totals[2];
+	MPI_Reduce( local, totals, 2, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD );
+	if ( world_rank == 0 && game.passes > 0 )
+	{
+		printf( "Streamed %d passes: %lld bytes read, %lld bytes written "
+		        "(%.2f bytes per cell per generation)\n",
+		        game.passes, totals[0], totals[1],
+		        (double)( totals[0] + totals[1] ) /
+		          ( (double)width * height * iterations ) );
+	}
+	free( game.next_path );
+}
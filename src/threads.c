@@ -0,0 +1,174 @@
+/* File:    threads.c
+ *
+ * Purpose: A small pool of worker threads for splitting a processor's part of
+ *          the board between the cores it runs on, so one MPI processor per
+ *          computer (or per socket) can use every core without going through
+ *          MPI for the cells in between.
+ *
+ *          The thread that calls worker_pool_run takes part as worker 0 and is
+ *          the only one that ever talks to MPI (MPI_THREAD_FUNNELED). Each
+ *          worker is pinned to one of the cores mpiexec gave the processor,
+ *          and always gets the same share of the board, so the boards are
+ *          first touched by the worker that will go on to use them.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "life.h"
+
+struct WorkerPool
+{
+	int num_threads;
+	pthread_t* threads;
+	pthread_barrier_t start;
+	pthread_barrier_t finish;
+	WorkerTask task;
+	void* task_arg;
+	bool shutting_down;
+	// The cores this processor may run on; worker i gets the i-th one
+	cpu_set_t cores;
+};
+
+typedef struct WorkerStart
+{
+	WorkerPool* pool;
+	int thread;
+} WorkerStart;
+
+static void pin_to_core( WorkerPool* pool, int thread )
+{
+	int num_cores = CPU_COUNT( &pool->cores );
+	if ( num_cores == 0 )
+		return;
+
+	int wanted = thread % num_cores;
+	for ( int cpu = 0; cpu < CPU_SETSIZE; ++cpu )
+	{
+		if ( CPU_ISSET( cpu, &pool->cores ) && wanted-- == 0 )
+		{
+			cpu_set_t core;
+			CPU_ZERO( &core );
+			CPU_SET( cpu, &core );
+			pthread_setaffinity_np( pthread_self(), sizeof( core ), &core );
+			return;
+		}
+	}
+}
+
+static void* worker_main( void* arg )
+{
+	WorkerStart* start = arg;
+	WorkerPool* pool = start->pool;
+	int thread = start->thread;
+	free( start );
+
+	pin_to_core( pool, thread );
+	for ( ;; )
+	{
+		pthread_barrier_wait( &pool->start );
+		if ( pool->shutting_down )
+			break;
+		pool->task( thread, pool->num_threads, pool->task_arg );
+		pthread_barrier_wait( &pool->finish );
+	}
+	return NULL;
+}
+
+WorkerPool* worker_pool_create( int num_threads )
+{
+	WorkerPool* pool = calloc( 1, sizeof( WorkerPool ) );
+	pool->num_threads = num_threads;
+	pool->threads = calloc( num_threads, sizeof( pthread_t ) );
+	pthread_barrier_init( &pool->start, NULL, num_threads );
+	pthread_barrier_init( &pool->finish, NULL, num_threads );
+	sched_getaffinity( 0, sizeof( pool->cores ), &pool->cores );
+
+	pin_to_core( pool, 0 );
+	for ( int thread = 1; thread < num_threads; ++thread )
+	{
+		WorkerStart* start = malloc( sizeof( WorkerStart ) );
+		start->pool = pool;
+		start->thread = thread;
+		pthread_create( &pool->threads[thread], NULL, worker_main, start );
+	}
+	return pool;
+}
+
+int worker_pool_size( WorkerPool* pool )
+{
+	return pool == NULL ? 1 : pool->num_threads;
+}
+
+void worker_pool_run( WorkerPool* pool, WorkerTask task, void* arg )
+{
+	if ( pool == NULL )
+	{
+		task( 0, 1, arg );
+		return;
+	}
+
+	pool->task = task;
+	pool->task_arg = arg;
+	pthread_barrier_wait( &pool->start );
+	task( 0, pool->num_threads, arg );
+	pthread_barrier_wait( &pool->finish );
+}
+
+void worker_pool_destroy( WorkerPool* pool )
+{
+	if ( pool == NULL )
+		return;
+
+	pool->shutting_down = true;
+	pthread_barrier_wait( &pool->start );
+	for ( int thread = 1; thread < pool->num_threads; ++thread )
+		pthread_join( pool->threads[thread], NULL );
+	pthread_barrier_destroy( &pool->start );
+	pthread_barrier_destroy( &pool->finish );
+	free( pool->threads );
+	free( pool );
+}
+
+// Same split as between processors: equal shares, remainder to the last one
+ProcInfo split_cells( ProcInfo* cells, int thread, int num_threads )
+{
+	int normal_num_cells = cells->num_cells / num_threads;
+	ProcInfo share = { cells->offset + thread * normal_num_cells,
+	                   normal_num_cells };
+	if ( thread == num_threads - 1 )
+		share.num_cells += cells->num_cells % num_threads;
+	return share;
+}
+
+// Wall clock time in seconds that any thread may read (MPI_Wtime is off
+// limits to the workers under MPI_THREAD_FUNNELED)
+double thread_clock( void )
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+typedef struct TouchTask
+{
+	ProcInfo cells;
+	bool* board;
+} TouchTask;
+
+static void touch_task( int thread, int num_threads, void* arg )
+{
+	TouchTask* task = arg;
+	ProcInfo share = split_cells( &task->cells, thread, num_threads );
+	memset( task->board + share.offset, 0, share.num_cells * sizeof( bool ) );
+}
+
+void worker_pool_first_touch( WorkerPool* pool, bool* board, ProcInfo* cells )
+{
+	TouchTask task = { *cells, board };
+	worker_pool_run( pool, touch_task, &task );
+}
@@ -0,0 +1,299 @@
+/* File:    tiles.c
+ *
+ * Purpose: The "steal" kernel, a work-stealing tile scheduler. The cells are
+ *          cut into square tiles and every worker thread gets a queue of
+ *          them: the tiles on the first and last rows (the ones our
+ *          neighbours are waiting for) go to the front of the queues, and the
+ *          rest are handed out in contiguous blocks behind them.
+ *
+ *          A worker takes tiles from the front of its own queue. When that
+ *          runs dry it steals from the back of someone else's, which is as
+ *          far away as possible from what its owner is working on. Once every
+ *          boundary tile is done the main thread lets the halo transport
+ *          start sending, while the others carry on with the inside.
+ *
+ *          Each thread's busy and idle time is added up over the whole game
+ *          and printed at the end.
+ *
+ *          The tile grid itself is shared with the other tiled kernels.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "life.h"
+
+typedef struct TileQueue
+{
+	pthread_mutex_t lock;
+	int* tiles;
+	int head;
+	int tail;
+} TileQueue;
+
+typedef struct StealTask
+{
+	LifeStep* step;
+	TileGrid grid;
+	TileQueue* queues;
+	atomic_int boundary_left;
+	double* busy;
+} StealTask;
+
+// Totals over the whole game, one slot per thread
+typedef struct TileBalance
+{
+	int num_threads;
+	double* busy;
+	double* idle;
+	long* tiles;
+	long* stolen;
+} TileBalance;
+
+static TileBalance balance;
+
+static void steal_apply( LifeStep* step );
+static void steal_report( MPI_Comm comm );
+
+const LifeKernel steal_kernel = { "steal", steal_apply, steal_report, NULL,
+                                  false, true };
+
+void tile_grid_init( TileGrid* grid, ProcInfo* cells, int width,
+                     int tile_size, int boundary_rows )
+{
+	grid->width = width;
+	grid->start_cell = cells->offset;
+	grid->end_cell = cells->offset + cells->num_cells;
+	grid->first_row = grid->start_cell / width;
+	int last_row = ( grid->end_cell - 1 ) / width;
+	grid->tile_size = tile_size;
+	grid->tile_rows = ( last_row - grid->first_row + tile_size ) / tile_size;
+	grid->tile_cols = ( width + tile_size - 1 ) / tile_size;
+	grid->num_tiles = grid->tile_rows * grid->tile_cols;
+
+	// A deep halo's boundary can span several tile rows at either end, and the
+	// last tile row may be short, so both ends are found row by row
+	int inside_first_row = ( boundary_rows - 1 ) / tile_size + 1;
+	int bottom_first_row = last_row - boundary_rows + 1 - grid->first_row;
+	int inside_end_row = bottom_first_row < 0 ? 0 : bottom_first_row / tile_size;
+	if ( inside_first_row > grid->tile_rows )
+		inside_first_row = grid->tile_rows;
+	if ( inside_end_row < inside_first_row )
+		inside_end_row = inside_first_row;
+	grid->inside_first_row = inside_first_row;
+	grid->inside_end_row = inside_end_row;
+}
+
+bool is_boundary_tile( TileGrid* grid, int tile )
+{
+	int tile_row = tile / grid->tile_cols;
+	return tile_row < grid->inside_first_row ||
+	       tile_row >= grid->inside_end_row;
+}
+
+void apply_rules_to_tile( TileGrid* grid, int tile, LifeStep* step,
+                          bool* last_game_state, bool* new_game_state )
+{
+	int width = grid->width;
+	int tile_size = grid->tile_size;
+	int row = grid->first_row + ( tile / grid->tile_cols ) * tile_size;
+	int col = ( tile % grid->tile_cols ) * tile_size;
+	int end_col = col + tile_size < width ? col + tile_size : width;
+
+	// Clip each row of the tile to the cells we were given, since the first
+	// and last rows may only be partly ours
+	for ( int r = row; r < row + tile_size; ++r )
+	{
+		int start = r * width + col;
+		int end = r * width + end_col;
+		if ( start < grid->start_cell )
+			start = grid->start_cell;
+		if ( end > grid->end_cell )
+			end = grid->end_cell;
+		if ( end <= start )
+			continue;
+
+		ProcInfo cells = { start, end - start };
+		apply_rules( &cells, last_game_state, new_game_state, 0,
+		             step->adjacency_offsets, width, step->height );
+	}
+}
+
+static bool pop_front( TileQueue* queue, int* tile )
+{
+	bool found = false;
+	pthread_mutex_lock( &queue->lock );
+	if ( queue->head < queue->tail )
+	{
+		*tile = queue->tiles[queue->head++];
+		found = true;
+	}
+	pthread_mutex_unlock( &queue->lock );
+	return found;
+}
+
+static bool steal_back( TileQueue* queue, int* tile )
+{
+	bool found = false;
+	pthread_mutex_lock( &queue->lock );
+	if ( queue->head < queue->tail )
+	{
+		*tile = queue->tiles[--queue->tail];
+		found = true;
+	}
+	pthread_mutex_unlock( &queue->lock );
+	return found;
+}
+
+static void steal_task( int thread, int num_threads, void* arg )
+{
+	StealTask* task = arg;
+	LifeStep* step = task->step;
+	bool notified = step->boundary_done == NULL;
+
+	for ( ;; )
+	{
+		int tile;
+		bool stolen = false;
+		bool found = pop_front( &task->queues[thread], &tile );
+		for ( int i = 1; !found && i < num_threads; ++i )
+		{
+			found = steal_back( &task->queues[( thread + i ) % num_threads], &tile );
+			stolen = found;
+		}
+		if ( !found )
+			break;
+
+		double start = thread_clock();
+		apply_rules_to_tile( &task->grid, tile, step, step->last_game_state,
+		                     step->new_game_state );
+		task->busy[thread] += thread_clock() - start;
+		balance.tiles[thread]++;
+		balance.stolen[thread] += stolen;
+
+		if ( is_boundary_tile( &task->grid, tile ) )
+			atomic_fetch_sub( &task->boundary_left, 1 );
+
+		// Only the main thread may talk to MPI, so it is the one that checks
+		if ( thread == 0 && !notified && atomic_load( &task->boundary_left ) == 0 )
+		{
+			step->boundary_done( step->boundary_arg );
+			notified = true;
+		}
+	}
+
+	// Out of tiles, but someone may still be finishing a boundary tile
+	if ( thread == 0 && !notified )
+	{
+		while ( atomic_load( &task->boundary_left ) > 0 )
+			sched_yield();
+		step->boundary_done( step->boundary_arg );
+	}
+}
+
+static void steal_apply( LifeStep* step )
+{
+	int num_threads = worker_pool_size( step->pool );
+	if ( balance.num_threads != num_threads )
+	{
+		free( balance.busy );
+		free( balance.idle );
+		free( balance.tiles );
+		free( balance.stolen );
+		balance.num_threads = num_threads;
+		balance.busy = calloc( num_threads, sizeof( double ) );
+		balance.idle = calloc( num_threads, sizeof( double ) );
+		balance.tiles = calloc( num_threads, sizeof( long ) );
+		balance.stolen = calloc( num_threads, sizeof( long ) );
+	}
+
+	StealTask task;
+	task.step = step;
+	// Whoever is waiting on the boundary wants all of its rows done
+	tile_grid_init( &task.grid, &step->cells, step->width, step->tile_size,
+	                step->boundary_done != NULL ? step->boundary_rows : 1 );
+	TileGrid* grid = &task.grid;
+	int num_tiles = grid->num_tiles;
+
+	// Boundary tiles are dealt out one at a time so every worker starts on
+	// them, then the inside is split into contiguous blocks
+	int first_inside = grid->inside_first_row * grid->tile_cols;
+	int num_inside =
+	  ( grid->inside_end_row - grid->inside_first_row ) * grid->tile_cols;
+	int num_boundary = num_tiles - num_inside;
+	task.queues = calloc( num_threads, sizeof( TileQueue ) );
+	for ( int thread = 0; thread < num_threads; ++thread )
+	{
+		TileQueue* queue = &task.queues[thread];
+		pthread_mutex_init( &queue->lock, NULL );
+		queue->tiles = malloc( num_tiles * sizeof( int ) );
+		for ( int tile = 0, boundary = 0; tile < num_tiles; ++tile )
+		{
+			if ( is_boundary_tile( grid, tile ) &&
+			     boundary++ % num_threads == thread )
+				queue->tiles[queue->tail++] = tile;
+		}
+		ProcInfo inside = { 0, num_inside };
+		ProcInfo share = split_cells( &inside, thread, num_threads );
+		for ( int i = share.offset; i < share.offset + share.num_cells; ++i )
+			queue->tiles[queue->tail++] = first_inside + i;
+	}
+	atomic_init( &task.boundary_left, num_boundary );
+	task.busy = calloc( num_threads, sizeof( double ) );
+
+	double start = thread_clock();
+	worker_pool_run( step->pool, steal_task, &task );
+	double elapsed = thread_clock() - start;
+
+	for ( int thread = 0; thread < num_threads; ++thread )
+	{
+		balance.busy[thread] += task.busy[thread];
+		balance.idle[thread] += elapsed - task.busy[thread];
+		pthread_mutex_destroy( &task.queues[thread].lock );
+		free( task.queues[thread].tiles );
+	}
+	free( task.queues );
+	free( task.busy );
+}
+
+static void steal_report( MPI_Comm comm )
+{
+	int rank, size;
+	MPI_Comm_rank( comm, &rank );
+	MPI_Comm_size( comm, &size );
+
+	// Every processor runs the same number of threads
+	int num_threads = balance.num_threads;
+	double* local = calloc( 4 * num_threads, sizeof( double ) );
+	for ( int thread = 0; thread < num_threads; ++thread )
+	{
+		local[4 * thread] = balance.busy[thread];
+		local[4 * thread + 1] = balance.idle[thread];
+		local[4 * thread + 2] = balance.tiles[thread];
+		local[4 * thread + 3] = balance.stolen[thread];
+	}
+
+	double* all = NULL;
+	if ( rank == 0 )
+		all = calloc( 4 * num_threads * size, sizeof( double ) );
+	MPI_Gather( local, 4 * num_threads, MPI_DOUBLE, all, 4 * num_threads,
+	            MPI_DOUBLE, 0, comm );
+
+	if ( rank == 0 )
+	{
+		printf( "Tile balance (rank thread busy_s idle_s tiles stolen):\n" );
+		for ( int proc = 0; proc < size; ++proc )
+		{
+			for ( int thread = 0; thread < num_threads; ++thread )
+			{
+				double* row = all + 4 * ( proc * num_threads + thread );
+				printf( "%4d %4d %10.6f %10.6f %8.0f %8.0f\n", proc, thread, row[0],
+				        row[1], row[2], row[3] );
+			}
+		}
+	}
+	free( all );
+	free( local );
+}
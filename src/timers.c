@@ -0,0 +1,120 @@
+/* File:    timers.c
+ *
+ * Purpose: Times the phases of the main loop (-m), so a run can be told
+ *          apart as bound by the rules, the messages, the barriers or the
+ *          printing. Each phase is bracketed by timer_start and timer_stop,
+ *          which only read MPI_Wtime and add up, and do nothing at all
+ *          unless -m was given (or -T, which puts the phases on its
+ *          timeline). At the end the per-processor totals are reduced into
+ *          the least, average and most time spent in every phase, with the
+ *          most over the average as the load imbalance, and the cell updates
+ *          per second are printed for the whole game and for each processor.
+ */
+
+#include <stdlib.h>
+
+#include "life.h"
+
+static const char* phase_names[NUM_TIMER_PHASES] = {
+  "distribute", "exchange", "compute", "gather", "barrier", "print" };
+
+typedef struct PhaseTimers
+{
+	bool open;
+	double started;
+	double phase_started[NUM_TIMER_PHASES];
+	double totals[NUM_TIMER_PHASES];
+	long long cell_updates;
+} PhaseTimers;
+
+static PhaseTimers timers;
+
+void timers_open( void )
+{
+	timers.open = true;
+	timers.started = MPI_Wtime();
+}
+
+void timer_start( TimerPhase phase )
+{
+	if ( timers.open || trace_enabled() )
+		timers.phase_started[phase] = MPI_Wtime();
+}
+
+void timer_stop( TimerPhase phase )
+{
+	if ( timers.open )
+		timers.totals[phase] += MPI_Wtime() - timers.phase_started[phase];
+	// The phases make up the timeline too
+	trace_event( (TraceKind)phase, timers.phase_started[phase], -1 );
+}
+
+void timers_add_updates( long long cell_updates )
+{
+	timers.cell_updates += cell_updates;
+}
+
+void timers_report( MPI_Comm comm )
+{
+	if ( !timers.open )
+		return;
+	double elapsed = MPI_Wtime() - timers.started;
+
+	int rank, size;
+	MPI_Comm_rank( comm, &rank );
+	MPI_Comm_size( comm, &size );
+
+	double least[NUM_TIMER_PHASES], most[NUM_TIMER_PHASES],
+	  sum[NUM_TIMER_PHASES];
+	MPI_Reduce( timers.totals, least, NUM_TIMER_PHASES, MPI_DOUBLE, MPI_MIN, 0,
+	            comm );
+	MPI_Reduce( timers.totals, most, NUM_TIMER_PHASES, MPI_DOUBLE, MPI_MAX, 0,
+	            comm );
+	MPI_Reduce( timers.totals, sum, NUM_TIMER_PHASES, MPI_DOUBLE, MPI_SUM, 0,
+	            comm );
+
+	// Each processor's updates, compute time and time in the game
+	double local[3] = { timers.cell_updates, timers.totals[TIMER_COMPUTE],
+	                    elapsed };
+	double* all = rank == 0 ? malloc( 3 * size * sizeof( double ) ) : NULL;
+	MPI_Gather( local, 3, MPI_DOUBLE, all, 3, MPI_DOUBLE, 0, comm );
+
+	if ( rank == 0 )
+	{
+		printf( "Phase times over %d processors (seconds: min mean max, "
+		        "imbalance max/mean):\n",
+		        size );
+		for ( int phase = 0; phase < NUM_TIMER_PHASES; ++phase )
+		{
+			// Phases the game never went through are left out
+			if ( most[phase] == 0 )
+				continue;
+			double mean = sum[phase] / size;
+			printf( "  %-10s %10.6f %10.6f %10.6f %6.2f\n", phase_names[phase],
+			        least[phase], mean, most[phase], most[phase] / mean );
+		}
+
+		double updates = 0, slowest = 0;
+		for ( int proc = 0; proc < size; ++proc )
+		{
+			updates += all[3 * proc];
+			if ( all[3 * proc + 2] > slowest )
+				slowest = all[3 * proc + 2];
+		}
+		if ( slowest > 0 )
+		{
+			printf( "Cell updates per second: %.4g overall (%.0f updates in "
+			        "%.6f s)\n",
+			        updates / slowest, updates, slowest );
+		}
+		for ( int proc = 0; proc < size; ++proc )
+		{
+			double* row = all + 3 * proc;
+			printf( "  rank %d: %.4g per second, %.4g per second computing\n",
+			        proc, row[2] > 0 ? row[0] / row[2] : 0,
+			        row[1] > 0 ? row[0] / row[1] : 0 );
+		}
+	}
+	free( all );
+	timers.open = false;
+}
@@ -0,0 +1,288 @@
+/* File:    trace.c
+ *
+ * Purpose: Records a timeline of the game (-T file) and writes it out as a
+ *          Chrome trace, which chrome://tracing and ui.perfetto.dev can show
+ *          with a row per processor, to see the stalls that averages hide:
+ *          a neighbour that sends late, or one processor that keeps the rest
+ *          waiting every few generations.
+ *
+ *          Every event (a phase timed by timers.c, one send or receive of
+ *          the original game or of a halo exchange, waiting on a halo
+ *          exchange, waiting on streamed I/O) goes into a ring of events
+ *          allocated at the start, taken with an atomic add so recording
+ *          never locks or allocates. If a game has more events than fit, the
+ *          oldest ones are written over.
+ *
+ *          MPI_Wtime need not agree between computers, so at the start the
+ *          controller plays a few rounds of ping pong with each processor and
+ *          takes the round with the shortest trip to guess how far that
+ *          processor's clock is from its own. At the end the events are
+ *          gathered to the controller, moved onto its clock and written out.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "life.h"
+
+// A power of two, so the ring position is just a mask
+#define TRACE_EVENTS ( 1 << 16 )
+#define TRACE_CLOCK_ROUNDS 8
+
+typedef struct TraceEvent
+{
+	double begin;
+	double end;
+	int kind;
+	// The other processor, or -1
+	int peer;
+	int iteration;
+	int pad;
+} TraceEvent;
+
+typedef struct Trace
+{
+	const char* path;
+	TraceEvent* events;
+	// Events ever recorded; the ring holds the last TRACE_EVENTS of them
+	unsigned long recorded;
+	int iteration;
+	// On the controller, what to add to each processor's clock to get its own
+	double* offsets;
+} Trace;
+
+static Trace trace;
+
+static const char* kind_names[NUM_TRACE_KINDS] = {
+  "distribute", "exchange", "compute", "gather", "barrier",
+  "print",      "send",     "receive", "wait",   "io" };
+
+bool trace_enabled( void )
+{
+	return trace.events != NULL;
+}
+
+// Guesses how far each processor's clock is from the controller's
+static void estimate_offsets( MPI_Comm comm, int rank, int size )
+{
+	if ( rank == 0 )
+	{
+		trace.offsets = calloc( size, sizeof( double ) );
+		for ( int proc = 1; proc < size; ++proc )
+		{
+			double shortest = -1;
+			for ( int round = 0; round < TRACE_CLOCK_ROUNDS; ++round )
+			{
+				double sent = MPI_Wtime(), their_time;
+				MPI_Send( NULL, 0, MPI_DOUBLE, proc, TRACE_CLOCK, comm );
+				MPI_Recv( &their_time, 1, MPI_DOUBLE, proc, TRACE_CLOCK, comm,
+				          MPI_STATUS_IGNORE );
+				double received = MPI_Wtime();
+				// Their clock was read about halfway through the trip
+				if ( shortest < 0 || received - sent < shortest )
+				{
+					shortest = received - sent;
+					trace.offsets[proc] = ( sent + received ) / 2 - their_time;
+				}
+			}
+		}
+	}
+	else
+	{
+		for ( int round = 0; round < TRACE_CLOCK_ROUNDS; ++round )
+		{
+			MPI_Recv( NULL, 0, MPI_DOUBLE, 0, TRACE_CLOCK, comm, MPI_STATUS_IGNORE );
+			double now = MPI_Wtime();
+			MPI_Send( &now, 1, MPI_DOUBLE, 0, TRACE_CLOCK, comm );
+		}
+	}
+}
+
+void trace_open( const char* path, MPI_Comm comm )
+{
+	int rank, size;
+	MPI_Comm_rank( comm, &rank );
+	MPI_Comm_size( comm, &size );
+
+	trace.path = path;
+	trace.events = malloc( TRACE_EVENTS * sizeof( TraceEvent ) );
+	// Touched now, so the first events don't pay for the page faults
+	memset( trace.events, 0, TRACE_EVENTS * sizeof( TraceEvent ) );
+	estimate_offsets( comm, rank, size );
+}
+
+void trace_iteration( int iteration )
+{
+	trace.iteration = iteration;
+}
+
+void trace_event( TraceKind kind, double begin, int peer )
+{
+	if ( trace.events == NULL )
+		return;
+
+	double end = MPI_Wtime();
+	unsigned long slot =
+	  __atomic_fetch_add( &trace.recorded, 1, __ATOMIC_RELAXED ) &
+	  ( TRACE_EVENTS - 1 );
+	TraceEvent* event = &trace.events[slot];
+	event->begin = begin;
+	event->end = end;
+	event->kind = kind;
+	event->peer = peer;
+	event->iteration = trace.iteration;
+}
+
+// Peers that are MPI_PROC_NULL are kept off the timeline
+void trace_begin( TraceMessage* message, TraceKind kind, int peer )
+{
+	message->kind = kind;
+	message->peer = peer;
+	message->begin = MPI_Wtime();
+}
+
+// MPI_Waitall, but with the requests taken as they finish so each message's
+// own end goes on the timeline
+void trace_waitall( int count, MPI_Request* requests, TraceMessage* messages,
+                    MPI_Status* statuses )
+{
+	if ( trace.events == NULL )
+	{
+		MPI_Waitall( count, requests, statuses );
+		return;
+	}
+
+	for ( int done = 0; done < count; ++done )
+	{
+		int index;
+		MPI_Status status;
+		MPI_Waitany( count, requests, &index, &status );
+		if ( index == MPI_UNDEFINED )
+			break;
+		if ( statuses != MPI_STATUSES_IGNORE )
+			statuses[index] = status;
+		if ( messages[index].peer != MPI_PROC_NULL )
+		{
+			trace_event( messages[index].kind, messages[index].begin,
+			             messages[index].peer );
+		}
+	}
+}
+
+static void write_trace( FILE* file, TraceEvent* events, int* counts,
+                         int size )
+{
+	// Times in microseconds from the controller's first event
+	double origin = 0;
+	bool have_origin = false;
+	int first = 0;
+	for ( int proc = 0; proc < size; first += counts[proc++] )
+	{
+		for ( int i = first; i < first + counts[proc]; ++i )
+		{
+			double begin = events[i].begin + trace.offsets[proc];
+			if ( !have_origin || begin < origin )
+				origin = begin;
+			have_origin = true;
+		}
+	}
+
+	fprintf( file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n" );
+	for ( int proc = 0; proc < size; ++proc )
+	{
+		fprintf( file,
+		         "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+		         "\"args\": {\"name\": \"rank %d\"}},\n",
+		         proc, proc );
+	}
+
+	first = 0;
+	bool comma = false;
+	for ( int proc = 0; proc < size; first += counts[proc++] )
+	{
+		for ( int i = first; i < first + counts[proc]; ++i )
+		{
+			TraceEvent* event = &events[i];
+			double begin = event->begin + trace.offsets[proc] - origin;
+			fprintf( file,
+			         "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": 0, "
+			         "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"iteration\": %d",
+			         comma ? ",\n" : "", kind_names[event->kind], proc, begin * 1e6,
+			         ( event->end - event->begin ) * 1e6, event->iteration );
+			if ( event->peer >= 0 )
+				fprintf( file, ", \"peer\": %d", event->peer );
+			fprintf( file, "}}" );
+			comma = true;
+		}
+	}
+	fprintf( file, "\n]}\n" );
+}
+
+void trace_close( MPI_Comm comm )
+{
+	if ( trace.events == NULL )
+		return;
+
+	int rank, size;
+	MPI_Comm_rank( comm, &rank );
+	MPI_Comm_size( comm, &size );
+
+	// Oldest first, straightening out the ring if it went round
+	int count = trace.recorded < TRACE_EVENTS ? trace.recorded : TRACE_EVENTS;
+	TraceEvent* ordered = malloc( count * sizeof( TraceEvent ) );
+	unsigned long oldest = trace.recorded - count;
+	for ( int i = 0; i < count; ++i )
+		ordered[i] = trace.events[( oldest + i ) & ( TRACE_EVENTS - 1 )];
+	long long dropped = trace.recorded - count, total_dropped;
+
+	MPI_Datatype event_type;
+	MPI_Type_contiguous( sizeof( TraceEvent ), MPI_BYTE, &event_type );
+	MPI_Type_commit( &event_type );
+	int* counts = rank == 0 ? malloc( size * sizeof( int ) ) : NULL;
+	MPI_Gather( &count, 1, MPI_INT, counts, 1, MPI_INT, 0, comm );
+	MPI_Reduce( &dropped, &total_dropped, 1, MPI_LONG_LONG, MPI_SUM, 0, comm );
+
+	TraceEvent* all = NULL;
+	int* displs = NULL;
+	if ( rank == 0 )
+	{
+		displs = malloc( size * sizeof( int ) );
+		int total = 0;
+		for ( int proc = 0; proc < size; ++proc )
+		{
+			displs[proc] = total;
+			total += counts[proc];
+		}
+		all = malloc( (size_t)total * sizeof( TraceEvent ) );
+	}
+	MPI_Gatherv( ordered, count, event_type, all, counts, displs, event_type, 0,
+	             comm );
+
+	if ( rank == 0 )
+	{
+		FILE* file = fopen( trace.path, "w" );
+		if ( file == NULL )
+		{
+			fprintf( stderr, "Writing %s: %s\n", trace.path, strerror( errno ) );
+		}
+		else
+		{
+			write_trace( file, all, counts, size );
+			fclose( file );
+			printf( "Trace written to %s", trace.path );
+			if ( total_dropped > 0 )
+				printf( " (the oldest %lld events did not fit)", total_dropped );
+			printf( "\n" );
+		}
+	}
+
+	MPI_Type_free( &event_type );
+	free( all );
+	free( displs );
+	free( counts );
+	free( ordered );
+	free( trace.events );
+	free( trace.offsets );
+	trace.events = NULL;
+}
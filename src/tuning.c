@@ -0,0 +1,268 @@
+/* File:    tuning.c
+ *
+ * Purpose: Picks the kernel, tile size, halo depth and halo transport for the
+ *          halo game (-A file) by timing them on a board of the same size
+ *          and density, on the same processors, before the game starts. The
+ *          kernel and depth are tried together (some kernels only pay off
+ *          over several generations a round), then the tile size for the
+ *          kernel that won if it works in tiles, then every transport. Each
+ *          setup plays a couple of short headless games and keeps the faster.
+ *
+ *          What wins is appended to the tuning file, keyed by the computer
+ *          the controller runs on, the number of processors and threads, and
+ *          the board size, so the next game with the same key starts with it
+ *          straight away. The last line for a key wins, and deleting the
+ *          file (or its lines) tunes again.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "life.h"
+
+// Every trial plays at least this many cell updates, in whole rounds of the
+// deepest halo
+#define TUNING_UPDATES ( 1 << 19 )
+#define TUNING_RUNS 2
+
+static const int tuning_depths[] = { 1, 2, 4, 8 };
+static const int tuning_tile_sizes[] = { 16, 32, 64, 128 };
+
+#define NUM_TUNING_DEPTHS                                                      \
+	( sizeof( tuning_depths ) / sizeof( tuning_depths[0] ) )
+#define NUM_TUNING_TILE_SIZES                                                  \
+	( sizeof( tuning_tile_sizes ) / sizeof( tuning_tile_sizes[0] ) )
+
+typedef struct TunedSetup
+{
+	char kernel[32];
+	int tile_size;
+	int halo_depth;
+	char transport[32];
+	double cell_updates_per_second;
+} TunedSetup;
+
+// What the setups are tried on, and what they are keyed by in the file
+typedef struct TuningProblem
+{
+	char host[MPI_MAX_PROCESSOR_NAME];
+	int processors;
+	int threads;
+	int live_cells;
+	int width;
+	int height;
+	long seed;
+	int generations;
+	WorkerPool* pool;
+	int tried;
+} TuningProblem;
+
+// Looks up the problem in the tuning file; the last line that matches wins
+static bool find_setup( const char* path, TuningProblem* problem,
+                        TunedSetup* setup )
+{
+	FILE* file = fopen( path, "r" );
+	if ( file == NULL )
+		return false;
+
+	bool found = false;
+	char line[512];
+	while ( fgets( line, sizeof( line ), file ) != NULL )
+	{
+		char host[MPI_MAX_PROCESSOR_NAME];
+		int processors, threads, width, height;
+		TunedSetup candidate;
+		if ( line[0] == '#' ||
+		     sscanf( line, "%255s %d %d %d %d %31s %d %d %31s %lf", host,
+		             &processors, &threads, &width, &height, candidate.kernel,
+		             &candidate.tile_size, &candidate.halo_depth,
+		             candidate.transport,
+		             &candidate.cell_updates_per_second ) != 10 )
+			continue;
+
+		// Lines for kernels or transports this build lacks are no use
+		if ( strcmp( host, problem->host ) == 0 &&
+		     processors == problem->processors &&
+		     threads == problem->threads && width == problem->width &&
+		     height == problem->height && find_kernel( candidate.kernel ) &&
+		     find_halo_transport( candidate.transport ) )
+		{
+			*setup = candidate;
+			found = true;
+		}
+	}
+	fclose( file );
+	return found;
+}
+
+static void save_setup( const char* path, TuningProblem* problem,
+                        TunedSetup* setup )
+{
+	FILE* existing = fopen( path, "r" );
+	if ( existing != NULL )
+		fclose( existing );
+	FILE* file = fopen( path, "a" );
+	if ( file == NULL )
+	{
+		fprintf( stderr, "Writing %s: %s\n", path, strerror( errno ) );
+		return;
+	}
+	if ( existing == NULL )
+	{
+		fprintf( file, "# host processors threads width height kernel "
+		               "tile_size depth transport cell_updates_per_second\n" );
+	}
+	fprintf( file, "%s %d %d %d %d %s %d %d %s %.6g\n", problem->host,
+	         problem->processors, problem->threads, problem->width,
+	         problem->height, setup->kernel, setup->tile_size,
+	         setup->halo_depth, setup->transport,
+	         setup->cell_updates_per_second );
+	fclose( file );
+}
+
+// Times a setup; every processor gets the controller's time so they all
+// pick the same one
+static double try_setup( TuningProblem* problem, TunedSetup* setup )
+{
+	int width = problem->width;
+	int adjacency_offsets[] = {
+	  -( width + 1 ), -width, -( width - 1 ), -1, 1,
+	  width - 1,      width,  width + 1 };
+	LifeStep step = { { 0, 0 },        NULL, NULL, adjacency_offsets, width,
+	                  problem->height, problem->pool, setup->tile_size,
+	                  NULL,            NULL };
+
+	double fastest = 0;
+	for ( int run = 0; run < TUNING_RUNS; ++run )
+	{
+		double seconds = time_halo_game(
+		  MPI_COMM_WORLD, problem->live_cells, problem->generations, width,
+		  problem->height, problem->seed, setup->halo_depth,
+		  find_halo_transport( setup->transport ),
+		  find_kernel( setup->kernel ), &step );
+		MPI_Bcast( &seconds, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD );
+		if ( run == 0 || seconds < fastest )
+			fastest = seconds;
+	}
+	problem->tried++;
+	return (double)width * problem->height * problem->generations / fastest;
+}
+
+// Tries the setup and keeps it as the best if it is faster; setups the
+// transport can't play are passed over
+static void try_candidate( TuningProblem* problem, TunedSetup* candidate,
+                           TunedSetup* best )
+{
+	const HaloTransport* transport = find_halo_transport( candidate->transport );
+	if ( ( transport->max_depth > 0 &&
+	       candidate->halo_depth > transport->max_depth ) ||
+	     ( transport->needs_two_boards &&
+	       find_kernel( candidate->kernel )->in_place ) )
+		return;
+
+	candidate->cell_updates_per_second = try_setup( problem, candidate );
+	if ( candidate->cell_updates_per_second > best->cell_updates_per_second )
+		*best = *candidate;
+}
+
+static void tune( TuningProblem* problem, TunedSetup* best )
+{
+	int max_depth = problem->height / problem->processors;
+	strcpy( best->transport, get_halo_transport( 0 )->name );
+	best->tile_size = 64;
+	best->cell_updates_per_second = 0;
+
+	for ( int k = 0; k < num_kernels(); ++k )
+	{
+		for ( size_t d = 0; d < NUM_TUNING_DEPTHS; ++d )
+		{
+			if ( tuning_depths[d] > max_depth )
+				continue;
+			TunedSetup candidate = *best;
+			strcpy( candidate.kernel, get_kernel( k )->name );
+			candidate.halo_depth = tuning_depths[d];
+			try_candidate( problem, &candidate, best );
+		}
+	}
+
+	if ( find_kernel( best->kernel )->tiled )
+	{
+		TunedSetup tried = *best;
+		for ( size_t t = 0; t < NUM_TUNING_TILE_SIZES; ++t )
+		{
+			if ( tuning_tile_sizes[t] == tried.tile_size )
+				continue;
+			TunedSetup candidate = tried;
+			candidate.tile_size = tuning_tile_sizes[t];
+			try_candidate( problem, &candidate, best );
+		}
+	}
+
+	TunedSetup tried = *best;
+	for ( int t = 0; t < num_halo_transports(); ++t )
+	{
+		const char* name = get_halo_transport( t )->name;
+		if ( strcmp( name, tried.transport ) == 0 )
+			continue;
+		TunedSetup candidate = tried;
+		strcpy( candidate.transport, name );
+		try_candidate( problem, &candidate, best );
+	}
+}
+
+void autotune( const char* path, LifeOptions* options, int live_cells,
+               int width, int height, WorkerPool* pool )
+{
+	int world_rank;
+	MPI_Comm_rank( MPI_COMM_WORLD, &world_rank );
+
+	TuningProblem problem = { .live_cells = live_cells,
+	                          .width = width,
+	                          .height = height,
+	                          .seed = options->seed,
+	                          .threads = worker_pool_size( pool ),
+	                          .pool = pool };
+	MPI_Comm_size( MPI_COMM_WORLD, &problem.processors );
+	int length;
+	MPI_Get_processor_name( problem.host, &length );
+	MPI_Bcast( problem.host, sizeof( problem.host ), MPI_CHAR, 0,
+	           MPI_COMM_WORLD );
+	// Whole rounds of the deepest halo, at least
+	int deepest = tuning_depths[NUM_TUNING_DEPTHS - 1];
+	problem.generations = TUNING_UPDATES / ( (long long)width * height );
+	problem.generations = ( problem.generations / deepest + 1 ) * deepest;
+
+	TunedSetup setup;
+	int found = world_rank == 0 && find_setup( path, &problem, &setup );
+	MPI_Bcast( &found, 1, MPI_INT, 0, MPI_COMM_WORLD );
+	double started = MPI_Wtime();
+	if ( found )
+		MPI_Bcast( &setup, sizeof( setup ), MPI_BYTE, 0, MPI_COMM_WORLD );
+	else
+		tune( &problem, &setup );
+
+	if ( world_rank == 0 )
+	{
+		if ( found )
+			printf( "Tuning: found in %s\n", path );
+		else
+		{
+			printf( "Tuning: tried %d setups in %.3f seconds\n", problem.tried,
+			        MPI_Wtime() - started );
+			save_setup( path, &problem, &setup );
+		}
+		printf( "Tuned for %s (%d processors, %d threads, %d x %d): kernel %s, "
+		        "tile size %d, depth %d, transport %s, %.4g cell updates per "
+		        "second\n",
+		        problem.host, problem.processors, problem.threads, width, height,
+		        setup.kernel, setup.tile_size, setup.halo_depth,
+		        setup.transport, setup.cell_updates_per_second );
+	}
+
+	// The names have to outlive the setup
+	options->kernel = find_kernel( setup.kernel )->name;
+	options->transport = find_halo_transport( setup.transport )->name;
+	options->tile_size = setup.tile_size;
+	options->halo_depth = setup.halo_depth;
+}
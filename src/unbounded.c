@@ -0,0 +1,609 @@
+/* File:    unbounded.c
+ *
+ * Purpose: The unbounded game (-u), where the board has no edges. The
+ *          starting board is still m x n, but after that the universe is
+ *          only stored where something is alive: it is cut into chunks of
+ *          64 x 64 cells (a uint64_t per row, a bit per cell) that live in a
+ *          hash map keyed by their chunk coordinates. A chunk is made as soon
+ *          as a live cell on the edge of its neighbour could give birth in it,
+ *          and goes away once everything in it has died, so the memory used
+ *          follows the live area rather than a guess at the board size.
+ *
+ *          Chunks come out of a pool that hands out slabs of them at a time
+ *          and keeps the dead ones on a free list for reuse.
+ *
+ *          Blocks of 4 x 4 chunks are spread over the processors by a hash
+ *          of their coordinates, so most neighbouring chunks are on the same
+ *          processor. Every generation each processor sends a copy of every
+ *          chunk with live cells on an edge to the processors that own the
+ *          chunks on the other side of it, with one MPI_Alltoallv.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "life.h"
+
+#define CHUNK_EDGE 64
+#define CHUNKS_PER_SLAB 256
+// log2 of the edge of the blocks of chunks that share an owner
+#define BLOCK_SHIFT 2
+
+typedef struct Chunk
+{
+	// In chunks, so cell (x * 64 + col, y * 64 + row)
+	int x;
+	int y;
+	// Both generations, bit col of each row; game->current is the live one
+	uint64_t rows[2][CHUNK_EDGE];
+	struct Chunk* next_free;
+} Chunk;
+
+// What gets sent to the neighbours of a chunk
+typedef struct ChunkRecord
+{
+	int x;
+	int y;
+	uint64_t rows[CHUNK_EDGE];
+} ChunkRecord;
+
+typedef struct ChunkPool
+{
+	Chunk** slabs;
+	int num_slabs;
+	Chunk* free_list;
+	long in_use;
+	long peak_in_use;
+} ChunkPool;
+
+// Open addressing, with room for twice as many chunks as it holds
+typedef struct ChunkMap
+{
+	Chunk** slots;
+	int capacity;
+	int size;
+} ChunkMap;
+
+typedef struct UnboundedGame
+{
+	int world_rank;
+	int world_size;
+	WorkerPool* workers;
+	ChunkPool pool;
+	// Our chunks, and copies of the other processors' chunks next to them
+	ChunkMap owned;
+	ChunkMap ghosts;
+	Chunk** chunks;
+	int num_chunks;
+	int max_chunks;
+	int current;
+} UnboundedGame;
+
+// Chunk coordinates to any of the eight directions around a chunk
+static const int around_x[8] = { -1, 0, 1, -1, 1, -1, 0, 1 };
+static const int around_y[8] = { -1, -1, -1, 0, 0, 1, 1, 1 };
+
+static Chunk* pool_alloc( ChunkPool* pool )
+{
+	if ( pool->free_list == NULL )
+	{
+		Chunk* slab = malloc( CHUNKS_PER_SLAB * sizeof( Chunk ) );
+		pool->slabs =
+		  realloc( pool->slabs, ( pool->num_slabs + 1 ) * sizeof( Chunk* ) );
+		pool->slabs[pool->num_slabs++] = slab;
+		for ( int i = 0; i < CHUNKS_PER_SLAB; ++i )
+		{
+			slab[i].next_free = pool->free_list;
+			pool->free_list = &slab[i];
+		}
+	}
+
+	Chunk* chunk = pool->free_list;
+	pool->free_list = chunk->next_free;
+	memset( chunk->rows, 0, sizeof( chunk->rows ) );
+	if ( ++pool->in_use > pool->peak_in_use )
+		pool->peak_in_use = pool->in_use;
+	return chunk;
+}
+
+static void pool_free( ChunkPool* pool, Chunk* chunk )
+{
+	chunk->next_free = pool->free_list;
+	pool->free_list = chunk;
+	pool->in_use--;
+}
+
+static unsigned hash_coords( int x, int y )
+{
+	uint64_t key = (uint64_t)(uint32_t)x << 32 | (uint32_t)y;
+	return ( key * 0x9e3779b97f4a7c15ULL ) >> 32;
+}
+
+static void map_init( ChunkMap* map, int capacity )
+{
+	map->capacity = capacity;
+	map->size = 0;
+	map->slots = calloc( capacity, sizeof( Chunk* ) );
+}
+
+static Chunk* map_find( ChunkMap* map, int x, int y )
+{
+	int mask = map->capacity - 1;
+	for ( int slot = hash_coords( x, y ) & mask; map->slots[slot] != NULL;
+	      slot = ( slot + 1 ) & mask )
+	{
+		if ( map->slots[slot]->x == x && map->slots[slot]->y == y )
+			return map->slots[slot];
+	}
+	return NULL;
+}
+
+static void map_insert( ChunkMap* map, Chunk* chunk )
+{
+	if ( 2 * ( map->size + 1 ) > map->capacity )
+	{
+		ChunkMap bigger;
+		map_init( &bigger, 2 * map->capacity );
+		for ( int slot = 0; slot < map->capacity; ++slot )
+		{
+			if ( map->slots[slot] != NULL )
+				map_insert( &bigger, map->slots[slot] );
+		}
+		free( map->slots );
+		*map = bigger;
+	}
+
+	int mask = map->capacity - 1;
+	int slot = hash_coords( chunk->x, chunk->y ) & mask;
+	while ( map->slots[slot] != NULL )
+		slot = ( slot + 1 ) & mask;
+	map->slots[slot] = chunk;
+	map->size++;
+}
+
+static void map_clear( ChunkMap* map )
+{
+	memset( map->slots, 0, map->capacity * sizeof( Chunk* ) );
+	map->size = 0;
+}
+
+static int chunk_owner( UnboundedGame* game, int x, int y )
+{
+	return hash_coords( x >> BLOCK_SHIFT, y >> BLOCK_SHIFT ) % game->world_size;
+}
+
+static void add_chunk( UnboundedGame* game, Chunk* chunk )
+{
+	if ( game->num_chunks == game->max_chunks )
+	{
+		game->max_chunks = game->max_chunks == 0 ? 64 : 2 * game->max_chunks;
+		game->chunks =
+		  realloc( game->chunks, game->max_chunks * sizeof( Chunk* ) );
+	}
+	game->chunks[game->num_chunks++] = chunk;
+	map_insert( &game->owned, chunk );
+}
+
+// Whether any live cell of rows is next to the chunk in the given direction
+static bool touches( const uint64_t* rows, int dx, int dy )
+{
+	uint64_t columns = dx < 0 ? 1 : dx > 0 ? 1ULL << 63 : ~0ULL;
+	int first_row = dy > 0 ? CHUNK_EDGE - 1 : 0;
+	int last_row = dy < 0 ? 0 : CHUNK_EDGE - 1;
+	for ( int row = first_row; row <= last_row; ++row )
+	{
+		if ( rows[row] & columns )
+			return true;
+	}
+	return false;
+}
+
+static uint64_t chunk_row( Chunk* chunk, int current, int row )
+{
+	return chunk == NULL ? 0 : chunk->rows[current][row];
+}
+
+static Chunk* find_any( UnboundedGame* game, int x, int y )
+{
+	Chunk* chunk = map_find( &game->owned, x, y );
+	return chunk != NULL ? chunk : map_find( &game->ghosts, x, y );
+}
+
+static void play_chunk( UnboundedGame* game, Chunk* chunk )
+{
+	int current = game->current;
+	uint64_t* new_rows = chunk->rows[1 - current];
+
+	// The chunks around this one, 3 x 3 row by row
+	Chunk* around[9];
+	for ( int i = 0; i < 9; ++i )
+		around[i] = find_any( game, chunk->x + i % 3 - 1, chunk->y + i / 3 - 1 );
+
+	for ( int row = 0; row < CHUNK_EDGE; ++row )
+	{
+		// The row above, this one and the row below, with the west and east
+		// chunks' rows next to them
+		uint64_t west[3], middle[3], east[3];
+		for ( int i = 0; i < 3; ++i )
+		{
+			int r = row + i - 1;
+			int chunk_row_index = 1;
+			if ( r < 0 )
+			{
+				r += CHUNK_EDGE;
+				chunk_row_index = 0;
+			}
+			else if ( r >= CHUNK_EDGE )
+			{
+				r -= CHUNK_EDGE;
+				chunk_row_index = 2;
+			}
+			west[i] = chunk_row( around[3 * chunk_row_index], current, r );
+			middle[i] = chunk_row( around[3 * chunk_row_index + 1], current, r );
+			east[i] = chunk_row( around[3 * chunk_row_index + 2], current, r );
+		}
+
+		// Bit col is column col, so the cell to the west is one bit down
+		uint64_t neighbours[8] = {
+		  middle[0] << 1 | west[0] >> 63, middle[0],
+		  middle[0] >> 1 | east[0] << 63, middle[1] << 1 | west[1] >> 63,
+		  middle[1] >> 1 | east[1] << 63, middle[2] << 1 | west[2] >> 63,
+		  middle[2],                      middle[2] >> 1 | east[2] << 63,
+		};
+		new_rows[row] = apply_rules_to_bits( neighbours, middle[1] );
+	}
+}
+
+static void play_chunks_task( int thread, int num_threads, void* arg )
+{
+	UnboundedGame* game = arg;
+	ProcInfo all = { 0, game->num_chunks };
+	ProcInfo share = split_cells( &all, thread, num_threads );
+	for ( int i = share.offset; i < share.offset + share.num_cells; ++i )
+		play_chunk( game, game->chunks[i] );
+}
+
+// Sends copies of our chunks to whoever owns a chunk they could affect
+static void exchange_ghosts( UnboundedGame* game, ChunkRecord** received,
+                             int* num_received )
+{
+	int size = game->world_size;
+	int* send_counts = calloc( size, sizeof( int ) );
+	int* recv_counts = calloc( size, sizeof( int ) );
+	int* send_displs = calloc( size, sizeof( int ) );
+	int* recv_displs = calloc( size, sizeof( int ) );
+
+	// Two passes over the chunks: count, then fill in
+	ChunkRecord* records = NULL;
+	int* filled = calloc( size, sizeof( int ) );
+	for ( int pass = 0; pass < 2; ++pass )
+	{
+		for ( int i = 0; i < game->num_chunks; ++i )
+		{
+			Chunk* chunk = game->chunks[i];
+			uint64_t* rows = chunk->rows[game->current];
+			int sent_to[8], num_sent = 0;
+			for ( int dir = 0; dir < 8; ++dir )
+			{
+				int owner = chunk_owner( game, chunk->x + around_x[dir],
+				                         chunk->y + around_y[dir] );
+				bool already = owner == game->world_rank;
+				for ( int j = 0; j < num_sent; ++j )
+					already |= sent_to[j] == owner;
+				if ( already || !touches( rows, around_x[dir], around_y[dir] ) )
+					continue;
+
+				sent_to[num_sent++] = owner;
+				if ( pass == 0 )
+				{
+					send_counts[owner]++;
+				}
+				else
+				{
+					ChunkRecord* record = &records[send_displs[owner] + filled[owner]++];
+					record->x = chunk->x;
+					record->y = chunk->y;
+					memcpy( record->rows, rows, sizeof( record->rows ) );
+				}
+			}
+		}
+
+		if ( pass == 0 )
+		{
+			int total = 0;
+			for ( int proc = 0; proc < size; ++proc )
+			{
+				send_displs[proc] = total;
+				total += send_counts[proc];
+			}
+			records = malloc( ( total > 0 ? total : 1 ) * sizeof( ChunkRecord ) );
+		}
+	}
+
+	MPI_Alltoall( send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT,
+	              MPI_COMM_WORLD );
+	int total = 0;
+	for ( int proc = 0; proc < size; ++proc )
+	{
+		recv_displs[proc] = total;
+		total += recv_counts[proc];
+	}
+	*received = malloc( ( total > 0 ? total : 1 ) * sizeof( ChunkRecord ) );
+	*num_received = total;
+
+	// Records are sent as bytes, so the counts are scaled to match
+	MPI_Datatype record_type;
+	MPI_Type_contiguous( sizeof( ChunkRecord ), MPI_BYTE, &record_type );
+	MPI_Type_commit( &record_type );
+	MPI_Alltoallv( records, send_counts, send_displs, record_type, *received,
+	               recv_counts, recv_displs, record_type, MPI_COMM_WORLD );
+	MPI_Type_free( &record_type );
+
+	free( records );
+	free( filled );
+	free( send_counts );
+	free( recv_counts );
+	free( send_displs );
+	free( recv_displs );
+}
+
+// Makes the chunks of ours that something next to them could give birth in
+static void grow( UnboundedGame* game, int x, int y, const uint64_t* rows )
+{
+	for ( int dir = 0; dir < 8; ++dir )
+	{
+		int nx = x + around_x[dir], ny = y + around_y[dir];
+		if ( chunk_owner( game, nx, ny ) != game->world_rank ||
+		     map_find( &game->owned, nx, ny ) != NULL ||
+		     !touches( rows, around_x[dir], around_y[dir] ) )
+			continue;
+
+		Chunk* chunk = pool_alloc( &game->pool );
+		chunk->x = nx;
+		chunk->y = ny;
+		add_chunk( game, chunk );
+	}
+}
+
+static void play_generation( UnboundedGame* game )
+{
+	ChunkRecord* received;
+	int num_received;
+	exchange_ghosts( game, &received, &num_received );
+
+	for ( int i = 0; i < num_received; ++i )
+	{
+		Chunk* ghost = pool_alloc( &game->pool );
+		ghost->x = received[i].x;
+		ghost->y = received[i].y;
+		memcpy( ghost->rows[game->current], received[i].rows,
+		        sizeof( received[i].rows ) );
+		map_insert( &game->ghosts, ghost );
+	}
+
+	// New chunks are added to the end, and only need to be checked as
+	// ghosts' neighbours, since a new chunk is empty
+	int num_chunks = game->num_chunks;
+	for ( int i = 0; i < num_chunks; ++i )
+	{
+		Chunk* chunk = game->chunks[i];
+		grow( game, chunk->x, chunk->y, chunk->rows[game->current] );
+	}
+	for ( int i = 0; i < num_received; ++i )
+		grow( game, received[i].x, received[i].y, received[i].rows );
+
+	worker_pool_run( game->workers, play_chunks_task, game );
+	game->current = 1 - game->current;
+
+	// Dead chunks go back to the pool, and the map is rebuilt without them
+	int kept = 0;
+	map_clear( &game->owned );
+	for ( int i = 0; i < game->num_chunks; ++i )
+	{
+		Chunk* chunk = game->chunks[i];
+		bool alive = false;
+		for ( int row = 0; row < CHUNK_EDGE && !alive; ++row )
+			alive = chunk->rows[game->current][row] != 0;
+		if ( alive )
+		{
+			game->chunks[kept++] = chunk;
+			map_insert( &game->owned, chunk );
+		}
+		else
+		{
+			pool_free( &game->pool, chunk );
+		}
+	}
+	game->num_chunks = kept;
+
+	for ( int slot = 0; slot < game->ghosts.capacity; ++slot )
+	{
+		if ( game->ghosts.slots[slot] != NULL )
+			pool_free( &game->pool, game->ghosts.slots[slot] );
+	}
+	map_clear( &game->ghosts );
+	free( received );
+}
+
+// Gathers every live chunk on the controller and prints the smallest
+// rectangle that holds all the live cells
+static void print_universe( UnboundedGame* game, int iteration )
+{
+	int size = game->world_size;
+	ChunkRecord* records =
+	  malloc( ( game->num_chunks > 0 ? game->num_chunks : 1 ) *
+	          sizeof( ChunkRecord ) );
+	for ( int i = 0; i < game->num_chunks; ++i )
+	{
+		records[i].x = game->chunks[i]->x;
+		records[i].y = game->chunks[i]->y;
+		memcpy( records[i].rows, game->chunks[i]->rows[game->current],
+		        sizeof( records[i].rows ) );
+	}
+
+	int* counts = NULL;
+	int* displs = NULL;
+	ChunkRecord* all = NULL;
+	int total = 0;
+	if ( game->world_rank == 0 )
+	{
+		counts = calloc( size, sizeof( int ) );
+		displs = calloc( size, sizeof( int ) );
+	}
+	MPI_Gather( &game->num_chunks, 1, MPI_INT, counts, 1, MPI_INT, 0,
+	            MPI_COMM_WORLD );
+	if ( game->world_rank == 0 )
+	{
+		for ( int proc = 0; proc < size; ++proc )
+		{
+			displs[proc] = total;
+			total += counts[proc];
+		}
+		all = malloc( ( total > 0 ? total : 1 ) * sizeof( ChunkRecord ) );
+	}
+
+	MPI_Datatype record_type;
+	MPI_Type_contiguous( sizeof( ChunkRecord ), MPI_BYTE, &record_type );
+	MPI_Type_commit( &record_type );
+	MPI_Gatherv( records, game->num_chunks, record_type, all, counts, displs,
+	             record_type, 0, MPI_COMM_WORLD );
+	MPI_Type_free( &record_type );
+	free( records );
+
+	if ( game->world_rank == 0 )
+	{
+		long long min_x = 0, max_x = -1, min_y = 0, max_y = -1;
+		long long live_cells = 0;
+		for ( int i = 0; i < total; ++i )
+		{
+			for ( int row = 0; row < CHUNK_EDGE; ++row )
+			{
+				for ( int col = 0; col < CHUNK_EDGE; ++col )
+				{
+					if ( !( all[i].rows[row] >> col & 1 ) )
+						continue;
+					long long x = (long long)all[i].x * CHUNK_EDGE + col;
+					long long y = (long long)all[i].y * CHUNK_EDGE + row;
+					if ( live_cells++ == 0 )
+					{
+						min_x = max_x = x;
+						min_y = max_y = y;
+					}
+					min_x = x < min_x ? x : min_x;
+					max_x = x > max_x ? x : max_x;
+					min_y = y < min_y ? y : min_y;
+					max_y = y > max_y ? y : max_y;
+				}
+			}
+		}
+
+		printf( "Game state on iteration %d", iteration );
+		if ( live_cells == 0 )
+		{
+			printf( ": everything is dead\n" );
+		}
+		else
+		{
+			printf( " (%lld live cells in columns %lld to %lld, rows %lld to "
+			        "%lld):\n",
+			        live_cells, min_x, max_x, min_y, max_y );
+			int width = max_x - min_x + 1;
+			int height = max_y - min_y + 1;
+			bool* field = calloc( (size_t)width * height, sizeof( bool ) );
+			for ( int i = 0; i < total; ++i )
+			{
+				for ( int row = 0; row < CHUNK_EDGE; ++row )
+				{
+					for ( int col = 0; col < CHUNK_EDGE; ++col )
+					{
+						if ( all[i].rows[row] >> col & 1 )
+						{
+							long long x = (long long)all[i].x * CHUNK_EDGE + col;
+							long long y = (long long)all[i].y * CHUNK_EDGE + row;
+							field[( y - min_y ) * width + ( x - min_x )] = true;
+						}
+					}
+				}
+			}
+			print_game( field, width, height );
+			free( field );
+		}
+	}
+	free( all );
+	free( counts );
+	free( displs );
+}
+
+void play_unbounded_game( bool* game_field, int width, int height,
+                          int iterations, int print_modulo, WorkerPool* pool )
+{
+	UnboundedGame game;
+	memset( &game, 0, sizeof( game ) );
+	MPI_Comm_rank( MPI_COMM_WORLD, &game.world_rank );
+	MPI_Comm_size( MPI_COMM_WORLD, &game.world_size );
+	game.workers = pool;
+	map_init( &game.owned, 64 );
+	map_init( &game.ghosts, 64 );
+
+	// Everyone gets the starting board and keeps the live chunks they own
+	MPI_Bcast( game_field, width * height, MPI_C_BOOL, 0, MPI_COMM_WORLD );
+	for ( int y = 0; y < height; y += CHUNK_EDGE )
+	{
+		for ( int x = 0; x < width; x += CHUNK_EDGE )
+		{
+			if ( chunk_owner( &game, x / CHUNK_EDGE, y / CHUNK_EDGE ) !=
+			     game.world_rank )
+				continue;
+
+			Chunk* chunk = pool_alloc( &game.pool );
+			chunk->x = x / CHUNK_EDGE;
+			chunk->y = y / CHUNK_EDGE;
+			bool alive = false;
+			for ( int row = 0; row < CHUNK_EDGE && y + row < height; ++row )
+			{
+				for ( int col = 0; col < CHUNK_EDGE && x + col < width; ++col )
+				{
+					if ( game_field[( y + row ) * width + x + col] )
+					{
+						chunk->rows[0][row] |= 1ULL << col;
+						alive = true;
+					}
+				}
+			}
+			if ( alive )
+				add_chunk( &game, chunk );
+			else
+				pool_free( &game.pool, chunk );
+		}
+	}
+
+	for ( int iteration = 0; iteration <= iterations; ++iteration )
+	{
+		if ( iteration % print_modulo == 0 )
+			print_universe( &game, iteration );
+		if ( iteration < iterations )
+			play_generation( &game );
+	}
+
+	// The pools never give their slabs back, so the slabs are what the
+	// universe really cost; the peak (copies of neighbours included) is how
+	// much of them was ever in use at once
+	long local[3] = { game.pool.peak_in_use, game.num_chunks,
+	                  (long)game.pool.num_slabs * CHUNKS_PER_SLAB };
+	long totals[3];
+	MPI_Reduce( local, totals, 3, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD );
+	if ( game.world_rank == 0 )
+	{
+		printf( "Unbounded: %ld chunks left; the processors' pools hold %ld "
+		        "chunks (%.1f KB) between them, and at most %ld were in use\n",
+		        totals[1], totals[2], totals[2] * sizeof( Chunk ) / 1024.0,
+		        totals[0] );
+	}
+
+	for ( int slab = 0; slab < game.pool.num_slabs; ++slab )
+		free( game.pool.slabs[slab] );
+	free( game.pool.slabs );
+	free( game.owned.slots );
+	free( game.ghosts.slots );
+	free( game.chunks );
+}